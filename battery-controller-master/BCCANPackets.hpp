@@ -49,6 +49,9 @@ namespace BCCANPackets {
                 UNDER_TEMPERATURE = 1 << 8,
                 PRECHARGE_FAIL = 1 << 9,
                 HEARTBEAT_TIMEOUT = 1 << 10,
+                OVER_CURRENT_HARDWARE = 1 << 11, // Over current comparator tripped
+                FAN_STALL = 1 << 12, // A driven fan isn't turning
+                ADC_STALL = 1 << 13, // Continuous conversions stopped, back to single shot readings
                 UNKNOWN = 1 << 31
             };
         };
@@ -65,6 +68,166 @@ namespace BCCANPackets {
             float percentage;
             float amp_hours;
         };
+
+        /** Currents the rest of the car should stay within, derated ahead of the protection limits. */
+        struct CurrentLimit {
+            _CANID(0x6);
+            int32_t maxCharge; // mA
+            int32_t maxDischarge; // mA - negative
+        };
+
+        /** Charge throughput counted since boot. */
+        struct ChargeThroughput {
+            _CANID(0x7);
+            uint32_t charged; // mAh
+            uint32_t discharged; // mAh
+        };
+
+        /** Cell group state of charge from the cell model. */
+        struct CellSOC {
+            _CANID(0x8);
+            uint16_t minSOC; // 1/10 %
+            uint16_t maxSOC; // 1/10 %
+            uint16_t meanSOC; // 1/10 %
+            uint8_t minCell;
+            uint8_t maxCell;
+        };
+
+        /** State of one cell group, sent in reply to RX::CellStateRequest. */
+        struct CellState {
+            _CANID(0x9);
+            uint8_t cell;
+            uint8_t soh; // %: Capacity relative to new
+            uint16_t soc; // 1/10 %
+            uint16_t capacity; // mAh
+            uint16_t remaining; // mAh
+        };
+
+        /** Charge the pack can deliver and take, limited by its weakest cell groups. */
+        struct UsableCharge {
+            _CANID(0xA);
+            uint32_t usable; // mAh
+            uint32_t headroom; // mAh
+        };
+
+        /** Fitted resistance of one cell group, sent with CellState. */
+        struct CellResistance {
+            _CANID(0xB);
+            uint8_t cell;
+            uint8_t valid; // 0 until enough current steps have been seen
+            uint16_t resistance; // uOhm
+        };
+
+        /** Summary of cell group resistances. */
+        struct PackResistance {
+            _CANID(0xC);
+            uint16_t meanResistance; // uOhm
+            uint16_t maxResistance; // uOhm
+            uint8_t maxCell;
+            uint8_t valid; // 0 until enough current steps have been seen
+        };
+
+        /** Current shunt zero offset and the error it leaves in current readings. */
+        struct ShuntCalibration {
+            _CANID(0xD);
+            int16_t offset; // 1/16 ADC count
+            uint16_t noise; // 1/10 mA: Standard deviation of a single reading at zero current
+            int16_t drift; // 1/10 mA: Offset change since calibration
+            uint8_t samples; // Readings used for calibration, after outliers
+            uint8_t status;
+            enum {
+                CALIBRATED = 1 << 0, // Measured at boot
+                RESTORED = 1 << 1, // Restored from the last run
+                TRACKING = 1 << 2 // Following drift while idle
+            };
+        };
+
+        /** Switching times of one contactor, from drive to feedback. */
+        struct ContactorTiming {
+            _CANID(0xE);
+            uint8_t contactor; // BCOutputInterface::Contactor
+            uint8_t failures; // Switches that timed out, saturating
+            uint16_t lastClose; // 1/10 ms
+            uint16_t lastOpen; // 1/10 ms
+            uint16_t slowClose; // 1/10 ms: 90th percentile close time, upper bin edge
+        };
+
+        /** Contactor coil economizer state. */
+        struct CoilEconomizer {
+            _CANID(0xF);
+            uint32_t saving; // J: Coil energy saved since power up, at Config::CONTACTOR_COIL_POWER
+            uint8_t holding; // 1 << BCOutputInterface::Contactor for coils held by PWM
+            uint8_t dropouts; // Contactors that dropped out while held, saturating
+        };
+
+        /** Pack fan speed and tachometer readings. */
+        struct Fans {
+            _CANID(0x10);
+            uint16_t rpm[2]; // rpm: Fan 1, fan 2
+            uint8_t speed; // Drive, 0-255
+            uint8_t stalled; // 1 << FanControl::Fan
+        };
+
+        /** Start of a trace dump, followed by its TraceEvent frames oldest first. */
+        struct TraceStart {
+            _CANID(0x11);
+            uint32_t clock; // Hz: Cycle counter rate
+            uint16_t events; // TraceEvent frames to follow
+        };
+
+        /** One trace event, see Trace::Event. */
+        struct TraceEvent {
+            _CANID(0x12);
+            uint32_t cycles;
+            uint16_t id; // Hash of the event name
+            uint8_t arg;
+            uint8_t flags; // Phase << 6 | context
+        };
+
+        /** Start of the black box dump sent at boot, followed by a BlackBoxEntry and
+         *  BlackBoxValues pair per entry, oldest first. */
+        struct BlackBoxStart {
+            _CANID(0x13);
+            uint16_t entries; // At most this many entries follow
+            uint16_t corrupt; // Entries that failed their checksum
+            uint8_t boot; // Boot count, wrapping
+            uint8_t resetCause; // LPC_SC->RSID: POR, EXTR, WDTR, BODR, SYSRESET, LOCKUP bits
+        };
+
+        /** One black box entry, see BlackBox::Entry. */
+        struct BlackBoxEntry {
+            _CANID(0x14);
+            uint32_t time; // ms since its boot
+            uint16_t sequence; // Low bits
+            uint8_t kind; // BlackBox::Kind
+            uint8_t boot;
+        };
+
+        /** Values of the BlackBoxEntry just sent, see BlackBox::Kind. */
+        struct BlackBoxValues {
+            _CANID(0x15);
+            int32_t a;
+            int32_t b;
+        };
+
+        /** Part of a store record, in reply to RX::StoreRequest.  Frames follow in order until
+         *  the record has been sent; a missing record is one frame of length 0. */
+        struct StoreData {
+            _CANID(0x16);
+            uint8_t key;
+            uint8_t offset; // bytes: Of data into the record
+            uint8_t length; // bytes: Whole record
+            uint8_t data[5];
+        };
+
+        /** Coil hold time of one contactor since power up, and the coil energy it saved. */
+        struct CoilSaving {
+            _CANID(0x17);
+            uint8_t contactor; // BCOutputInterface::Contactor
+            uint8_t duty; // %: Coil PWM hold duty, 100 without the economizer
+            uint16_t holdTime; // min: Held by PWM, saturating
+            uint16_t saving; // min at full drive: Hold time times 1 - duty^2, saturating
+        };
     }
 
     namespace RX {
@@ -78,6 +241,26 @@ namespace BCCANPackets {
             _CANID(0x21);
             uint8_t newstate;
         };
+
+        /** Request TX::CellState and TX::CellResistance for one cell group, or all of them. */
+        struct CellStateRequest {
+            _CANID(0x22);
+            enum { ALL = 0xFF };
+            uint8_t cell;
+        };
+
+        /** Dump the trace ring, pausing recording until it has been sent. */
+        struct TraceRequest {
+            _CANID(0x23);
+            enum { UART = 0, CAN = 1 };
+            uint8_t target; // Console log records or TX::TraceEvent frames
+        };
+
+        /** Read back a store record as TX::StoreData frames, see StoreRecords::Key. */
+        struct StoreRequest {
+            _CANID(0x24);
+            uint8_t key;
+        };
  
 		struct HMIStatus {
             _CANID(0x01);
@@ -1,6 +1,7 @@
 #ifndef BC_CONFIG
 #define BC_CONFIG
 #include "BCTypes.hpp"
+#include "FixedPoint.hpp"
 #include <mbed.h>
 
 namespace Config {
@@ -24,12 +25,57 @@ namespace Config {
     constexpr voltage_t CHARGE_CUTIN_PACK_VOLTAGE = CHARGE_CUTIN_CELL_VOLTAGE * NUM_CELLS_SERIES; // Voltage at which charging restarts
 
     constexpr float PRECHARGE_COMPLETE_PERCENTAGE = 0.95; // Percentage of pack voltage that car voltage must reach before precharge is complete 
+    constexpr float PRECHARGE_FIT_MARGIN = 0.02; // Fraction of pack voltage the fitted final car voltage must clear the threshold by
+    constexpr float PRECHARGE_MIN_RISE = 0.05; // Fraction of pack voltage car voltage must rise by before PRECHARGE_OPEN_PERIOD
+    constexpr uint8_t PRECHARGE_MIN_SAMPLES = 4; // Car voltage samples needed before the RC fit is trusted
+    // XXX: Requires calibration (depends on precharge resistor)
+    constexpr current_t PRECHARGE_SHORT_CURRENT = 500; // mA: Precharge current that separates a short from an open circuit
 
     // Used for both charging and discharging
     constexpr temperature_t MAX_CELL_TEMPERATURE = 650; // 1/10 C
     constexpr temperature_t MIN_CELL_TEMPERATURE = 100; // 1/10 C
 
+    // Fan speed (0-255) from the hottest cell, interpolated between points
+    constexpr temperature_t FAN_CURVE_TEMPERATURE[] = { 250, 300, 400, 450 }; // 1/10 C, ascending
+    constexpr uint8_t FAN_CURVE_SPEED[] = { 0, 80, 200, 255 };
+    constexpr uint8_t FAN_MIN_SPEED = 64; // Lowest speed the fans start and keep turning at, the curve is raised to it
+    constexpr temperature_t FAN_HYSTERESIS = 20; // 1/10 C: Temperature fall before the fans slow down
+    constexpr uint8_t FAN_TACH_PULSES = 2; // Tach pulses per revolution
+    constexpr uint16_t FAN_STALL_RPM = 300; // rpm: A driven fan turning slower than this is stalled
+    constexpr time_t FAN_SPINUP = 3000; // ms: Time for a fan to spin up from stopped
+
+    // Fault debouncing: a fault only sets or clears once N of the last M samples agree (M < 32)
+    constexpr uint8_t CURRENT_FAULT_N = 3;
+    constexpr uint8_t CURRENT_FAULT_M = 4;
+    constexpr uint8_t CELL_VOLTAGE_FAULT_N = 4;
+    constexpr uint8_t CELL_VOLTAGE_FAULT_M = 8;
+    constexpr uint8_t TEMPERATURE_FAULT_N = 2;
+    constexpr uint8_t TEMPERATURE_FAULT_M = 3;
+
+    // Distance back inside a limit before a fault releases
+    constexpr current_t CURRENT_HYSTERESIS = 2000; // mA
+    constexpr voltage_t CELL_VOLTAGE_HYSTERESIS = 50; // mV
+    constexpr temperature_t TEMPERATURE_HYSTERESIS = 50; // 1/10 C
+
+    // Allowed current is derated linearly from the start of each band down to zero at the limit
+    constexpr voltage_t CHARGE_DERATE_CELL_VOLTAGE = 4100; // mV: Max cell voltage where charge derating starts (zero at MAX_CELL_VOLTAGE)
+    constexpr voltage_t DISCHARGE_DERATE_CELL_VOLTAGE = MIN_CELL_VOLTAGE; // mV: Min cell voltage where discharge derating starts (zero at UNDER_CELL_VOLTAGE)
+    constexpr temperature_t DERATE_TEMPERATURE_BAND = 100; // 1/10 C: Derating band inside MAX/MIN_CELL_TEMPERATURE
+    constexpr uint16_t CHARGE_DERATE_SOC = 900; // 1/10 %: SOC where charge derating starts (zero at full)
+    constexpr uint16_t DISCHARGE_DERATE_SOC = 100; // 1/10 %: SOC where discharge derating starts (zero at empty)
+
     constexpr time_t MPPT_CONTACTOR_DELAY = 50; // ms
+    constexpr uint32_t CONTACTOR_POLL_PERIOD = 500; // us: Feedback sampling period, sets switch time resolution
+    constexpr uint32_t CONTACTOR_HOLD_POLL_PERIOD = 5000; // us: Feedback sampling period while coils are only held, for drop-outs
+    constexpr uint32_t CONTACTOR_HISTOGRAM_BIN = 2000; // us: Switch time histogram bin width
+    constexpr uint8_t CONTACTOR_HISTOGRAM_BINS = 16; // Last bin also counts anything slower
+
+    // Coil economizer, only on contactors with a PWM drive pin and feedback (positive and precharge)
+    constexpr time_t CONTACTOR_PULL_IN = 100; // ms: Full coil drive after closing before PWM hold
+    constexpr uint8_t POSITIVE_HOLD_DUTY = 50; // %: Coil PWM duty once pulled in, 100 for full drive
+    constexpr uint8_t PRECHARGE_HOLD_DUTY = 50; // %: Coil PWM duty once pulled in, 100 for full drive
+    // XXX: Requires the coil datasheet, only scales the reported saving to J
+    constexpr uint32_t CONTACTOR_COIL_POWER = 5000; // mW: Coil power at full drive
 
     constexpr unsigned int CAN_TX_BASE = 0x600;
     constexpr unsigned int CAN_RX_BASE = 0x200;
@@ -37,18 +83,113 @@ namespace Config {
 	
     constexpr time_t HEARTBEAT_PERIOD = 10000000; // ms
     constexpr time_t PRECHARGE_ERROR_PERIOD = 1000; // ms
+    constexpr time_t PRECHARGE_MIN_PERIOD = 500; // ms: Precharge time required when the RC fit can't confirm completion
+    constexpr time_t PRECHARGE_OPEN_PERIOD = 100; // ms: Time allowed for car voltage to start rising
     constexpr time_t CAN_GROUP1_PERIOD = 200; // ms
     constexpr time_t CAN_GROUP2_PERIOD = 1000; // ms
 
-    constexpr uint16_t PACK_VOLTAGE_AVERAGE_N = 10; // Number of cells to average
+    // Protection sees raw samples, models and telemetry see filtered ones
+    constexpr uint8_t SPIKE_FILTER_N = 3; // Median window for current and voltages
+    constexpr uint8_t PACK_VOLTAGE_FILTER_SHIFT = 3; // Pack voltage averaged over 2^shift CMU scans
+    constexpr uint8_t CAR_VOLTAGE_FILTER_SHIFT = 4; // Car voltage telemetry averaged over 2^shift samples
+    constexpr uint16_t CURRENT_DECIMATION = 16; // Current samples averaged into each telemetry sample
 
 	constexpr uint16_t CELL_CAPACITY = 3200; // Each Battery cell capacity
+    constexpr uint16_t NUM_CELLS_PARALLEL = 11;
+    constexpr int32_t PACK_CAPACITY = CELL_CAPACITY * NUM_CELLS_PARALLEL; // mAh
+    constexpr int32_t CELL_RESISTANCE = 60; // mOhm: Used to compensate open circuit voltage for load
+    constexpr int32_t CELL_OHMIC_RESISTANCE = 40; // mOhm: Instantaneous part of CELL_RESISTANCE, the rest settles with CELL_TIME_CONSTANT
+    constexpr time_t CELL_TIME_CONSTANT = 30000; // ms: Polarisation time constant for the cell model
+
+    constexpr int32_t CAPACITY_MIN_THROUGHPUT = PACK_CAPACITY / 5; // mAh: Charge counted between rests before capacity is re-estimated
+    constexpr uint16_t CAPACITY_FILTER_N = 4; // Capacity estimates to average over
+    constexpr int32_t BALANCE_CHARGE_DEADBAND = 350; // mAh: Excess charge tolerated before a cell group is balanced
+
+    constexpr current_t RESISTANCE_MIN_STEP = 5000; // mA: Smallest current step between scans used to fit cell resistance
+    constexpr time_t RESISTANCE_MAX_INTERVAL = 50; // ms: Longest time between scans for a step, before polarisation moves
+    constexpr time_t RESISTANCE_MAX_SKEW = 10; // ms: Longest time between a current sample and its scan
+    constexpr uint8_t RESISTANCE_FORGET_SHIFT = 5; // Fit forgets with factor 1 - 2^-shift per step
+    constexpr uint16_t RESISTANCE_MIN_STEPS = 8; // Steps before the fit is used
+
+    constexpr current_t REST_CURRENT = 500; // mA: Pack is resting below this current
+    constexpr time_t REST_PERIOD = 60000; // ms: Rest time before open circuit voltage is trusted for SOC
 
     // XXX: Requires calibration (Current and Voltage scale factor for ADC inputs)
-    constexpr float PACK_CURRENT_SCALING = 3.263; // mA per ADC division
+    // Q8.24 so measurements are scaled with one integer multiply, factors must stay below 128
+    typedef Fixed<24> Scale;
+    constexpr Scale PACK_CURRENT_SCALING = Scale::fromConstant(3.263); // mA per ADC division
 //    int PACK_CURRENT_OFFSET = 3; // ADC raw count offset at 0.0A
     constexpr int PACK_CURRENT_OFFSET = 0; // ADC raw count offset at 0.0A
-    constexpr float PACK_VOLTAGE_SCALING = 2 * 6.28; // mV per ADC division
+    constexpr Scale PACK_VOLTAGE_SCALING = Scale::fromConstant(2 * 6.28); // mV per ADC division
+
+    // XXX: Only once ALERT/RDY is wired to PinDefs::ADC_READY, until then every trigger() takes single shot readings
+    constexpr bool ADC_CONTINUOUS = false; // Convert continuously, paced by ALERT/RDY
+    constexpr uint8_t ADC_CURRENT_PER_VOLTAGE = 7; // Current conversions between car voltage conversions
+    constexpr uint32_t ADC_QUEUE_SIZE = 512; // samples, power of two: Outlasts the longest blocking wait in the main loop, 550 ms at the end of precharge
+    constexpr time_t ADC_STALL_TIMEOUT = 10; // ms: No conversion for this long in continuous mode falls back to single shot readings
+
+    constexpr uint8_t SHUNT_CAL_SAMPLES = 64; // Single shot readings for the shunt zero offset
+    constexpr uint8_t SHUNT_CAL_OUTLIER_MAD = 4; // Readings more median absolute deviations than this from the median are rejected
+    constexpr int16_t SHUNT_CAL_MAX_OFFSET = 200; // ADC counts: Larger offsets mean current is flowing
+    constexpr int16_t SHUNT_CAL_MAX_MAD = 10; // ADC counts: Noisier than this means current is flowing
+    constexpr uint8_t SHUNT_DRIFT_SHIFT = 10; // Offset tracking while idle averages over 2^shift samples
+    constexpr int16_t SHUNT_DRIFT_WINDOW = 30; // ADC counts: Idle readings further than this from the offset are ignored
+    constexpr time_t SHUNT_DRIFT_SETTLE = 1000; // ms: Time contactors must be open before the offset is tracked
+
+    constexpr uint32_t LOG_BUFFER_SIZE = 2048; // bytes, power of two: Log records waiting for the console
+    constexpr uint8_t LOG_MAX_RECORD = 64; // bytes: Longer records are truncated
+    constexpr uint8_t LOG_MAX_STRING = 16; // bytes: String arguments are copied up to this, with the terminator
+    constexpr time_t LOG_DRAIN_PERIOD = 10; // ms: Console writes queued log records this often
+    constexpr uint32_t CONSOLE_TX_BUFFER = 1024; // bytes, power of two: Console output waiting for the UART
+    constexpr Log::Overflow CONSOLE_OVERFLOW = Log::OVERFLOW_DROP; // Full TX buffer policy for direct console output
+
+    // Most verbose log level compiled in per module, anything above compiles to nothing
+    constexpr Log::Level LOG_LEVEL_CONTROLLER = Log::LEVEL_INFO; // BatteryController
+    constexpr Log::Level LOG_LEVEL_STATE_MACHINE = Log::LEVEL_DEBUG; // BCStateMachine
+    constexpr Log::Level LOG_LEVEL_INPUT = Log::LEVEL_INFO; // BCInputInterface
+    constexpr Log::Level LOG_LEVEL_CMU = Log::LEVEL_INFO; // CMUControl
+    constexpr Log::Level LOG_LEVEL_CAN = Log::LEVEL_DEBUG; // CANInterface
+
+    constexpr uint16_t TRACE_BUFFER_SIZE = 512; // events, power of two: 8 bytes each, in AHB SRAM bank 0
+    constexpr uint8_t TRACE_DUMP_PER_TICK = 3; // events: Sent per state machine tick while dumping
+
+    constexpr uint32_t BLACK_BOX_SIZE = 512; // entries, power of two: 20 bytes each, in AHB SRAM bank 1
+    constexpr time_t BLACK_BOX_SNAPSHOT_PERIOD = 5000; // ms: Cell and current extremes are recorded this often
+    constexpr uint8_t BLACK_BOX_DUMP_PER_TICK = 1; // entries: Sent per state machine tick after boot, two frames each
+
+    // The program must stay below the first history sector (0x40000), else history and store are left read-only
+    constexpr uint8_t HISTORY_FIRST_SECTOR = 22; // 32 KB flash sectors from here to the store hold the cell history
+    constexpr uint8_t HISTORY_SECTORS = 4;
+    constexpr uint16_t HISTORY_BLOCK = 1024; // bytes, multiple of 256: Decodable on its own, written to flash whole
+    constexpr uint8_t HISTORY_RAM_BLOCKS = 11; // Blocks waiting for flash, in AHB SRAM bank 0 with the trace ring
+    constexpr time_t HISTORY_PERIOD = 5000; // ms: Cell voltages and temperatures are recorded this often
+
+    constexpr uint8_t STORE_FIRST_SECTOR = 26; // 32 KB flash sectors from here to the end are the persistent store
+    constexpr uint8_t STORE_SECTORS = 4; // One is always kept erased as the spare
+    constexpr uint8_t STORE_KEYS = 64; // Store keys are below this
+    constexpr uint8_t STORE_MAX_RECORD = 240; // bytes: Largest store record
+    constexpr uint16_t STORE_BUFFER = 1024; // bytes: Store records waiting for flash, 2 bytes overhead each
+    constexpr time_t STORE_FLUSH_PERIOD = 60000; // ms: Store records that aren't urgent are committed this often
+    constexpr time_t STORE_POLL_PERIOD = 100; // ms: Store flush thread checks for work this often
+    constexpr uint8_t STORE_FAULTS = 16; // Fault records kept, newest overwriting oldest
+    constexpr time_t LIFETIME_SAVE_PERIOD = 60000; // ms: Lifetime counters are queued for the store this often
+    constexpr uint8_t STORE_DATA_PER_TICK = 2; // frames: Store read-back sent per state machine tick
+
+    // Time at each band is kept per cell for voltage and temperature; the lowest and highest bands also count everything beyond them
+    constexpr voltage_t HISTOGRAM_CELL_VOLTAGE_FIRST = 3000; // mV: Top of the lowest cell voltage band
+    constexpr voltage_t HISTOGRAM_CELL_VOLTAGE_BAND = 200; // mV
+    constexpr uint8_t HISTOGRAM_CELL_VOLTAGE_BANDS = 8;
+    constexpr temperature_t HISTOGRAM_TEMPERATURE_FIRST = 100; // 1/10 C: Top of the lowest cell temperature band
+    constexpr temperature_t HISTOGRAM_TEMPERATURE_BAND = 100; // 1/10 C
+    constexpr uint8_t HISTOGRAM_TEMPERATURE_BANDS = 8;
+    constexpr current_t HISTOGRAM_CURRENT_FIRST = -50000; // mA: Top of the lowest pack current band
+    constexpr current_t HISTOGRAM_CURRENT_BAND = 10000; // mA
+    constexpr uint8_t HISTOGRAM_CURRENT_BANDS = 12;
+    constexpr time_t HISTOGRAM_SAVE_PERIOD = 600000; // ms: Histograms are saved this often while flash is writable, and on opening the contactors
+
+    constexpr time_t CHARGE_CHECKPOINT_PERIOD = 60000; // ms: Charge state is queued for the store this often, and on opening the contactors
+    constexpr uint32_t CHARGE_CHECKPOINT_MAX_AGE = 86400; // s: Older checkpoints give way to the open circuit voltage, settled by then
+    constexpr voltage_t CHARGE_CHECKPOINT_REST_TOLERANCE = 30; // mV per cell: Rest voltage change while off that means the pack was charged or swapped
 
 
 }
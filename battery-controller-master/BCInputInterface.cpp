@@ -1,30 +1,316 @@
 #include "BCInputInterface.hpp"
 #include "BCConfig.hpp"
 #include "Debug.hpp"
+#include "BCCANPackets.hpp"
+#include "BCStoreRecords.hpp"
+#include "CycleCounter.hpp"
 
-BCInputInterface::BCInputInterface(Callback<void(current_t)> _handleCurrent,
-        Callback<void(voltage_t)> _handleVoltage) :
+constexpr Log::Level LOG_LEVEL = Config::LOG_LEVEL_INPUT;
+
+using namespace BCCANPackets;
+
+namespace {
+    /** Sort in place and return the middle value. */
+    int16_t median(int16_t * values, uint8_t n) {
+        for(uint8_t i = 1; i < n; ++i) {
+            int16_t value = values[i];
+            uint8_t j = i;
+            for(; j > 0 && values[j - 1] > value; --j)
+                values[j] = values[j - 1];
+            values[j] = value;
+        }
+        return values[n / 2];
+    }
+
+    /** Integer square root, rounded down. */
+    uint32_t isqrt(uint32_t value) {
+        uint32_t root = 0;
+        for(uint32_t bit = 1UL << 30; bit > 0; bit >>= 2) {
+            if(value >= root + bit) {
+                value -= root + bit;
+                root = (root >> 1) + bit;
+            } else {
+                root >>= 1;
+            }
+        }
+        return root;
+    }
+}
+
+BCInputInterface::BCInputInterface(Callback<void(current_t, timestamp_t)> _handleCurrent,
+        Callback<void(voltage_t, timestamp_t)> _handleVoltage, FlashStore & store) :
     i2c(PinDefs::ADC_I2C_SDA, PinDefs::ADC_I2C_SCL),
-    adc(&i2c), handleCurrent(_handleCurrent), handleVoltage(_handleVoltage) {
+    adc(&i2c), handleCurrent(_handleCurrent), handleVoltage(_handleVoltage), store(store),
+    adc_ready(PinDefs::ADC_READY), acquisition(osPriorityHigh, 1024),
+    ready_time(0), dropped(0), reported_dropped(0), continuous(false), stalled(false),
+    config_current(0), config_voltage(0),
+    shunt_offset(0), calibrated_offset(0), shunt_noise(0), shunt_samples(0), shunt_status(0),
+    idle(false), idle_since(0), scale_cycles(0) {
+        CycleCounter::enable();
     }
 
+void BCInputInterface::startContinuous() {
+    // DR_3300SPS is the fastest rate code, 860 SPS on the ADS1115
+    const uint16_t common = ADS1015_REG_CONFIG_MODE_CONTIN | ADS1015_REG_CONFIG_DR_3300SPS
+        | ADS1015_REG_CONFIG_CMODE_TRAD | ADS1015_REG_CONFIG_CPOL_ACTVLOW
+        | ADS1015_REG_CONFIG_CLAT_NONLAT | ADS1015_REG_CONFIG_CQUE_1CONV;
+    config_current = common | ADS1015_REG_CONFIG_MUX_DIFF_0_1 | GAIN_EIGHT;
+    config_voltage = common | ADS1015_REG_CONFIG_MUX_SINGLE_3 | GAIN_ONE; // As the single shot read
+
+    i2c.frequency(400000);
+
+    // Threshold MSBs set like this turn ALERT/RDY into a pulse at the end of every conversion
+    writeRegister(ADS1015_REG_POINTER_HITHRESH, 0x8000);
+    writeRegister(ADS1015_REG_POINTER_LOWTHRESH, 0x0000);
+    writeRegister(ADS1015_REG_POINTER_CONFIG, config_current);
+
+    ready_time = us_ticker_read(); // Watchdog runs from now
+    continuous = true;
+    acquisition.start(callback(this, &BCInputInterface::acquire));
+    adc_ready.fall(callback(this, &BCInputInterface::ready));
+}
+
+void BCInputInterface::ready() {
+    ready_time = us_ticker_read();
+    acquisition.signal_set(SIGNAL_READY);
+}
+
+void BCInputInterface::acquire() {
+    bool current = true;
+    bool settling = false;
+    uint8_t remaining = Config::ADC_CURRENT_PER_VOLTAGE;
+
+    while(continuous) {
+        Thread::signal_wait(SIGNAL_READY);
+
+        Sample sample;
+        sample.timestamp = ready_time;
+        sample.value = readConversion();
+        sample.current = current;
+
+        // The conversion running when the channel was switched may have started on the old one
+        if(settling) {
+            settling = false;
+            continue;
+        }
+
+        if(!samples.push(sample))
+            ++dropped;
+
+        // Only switch channel (and lose a conversion to settling) when the pattern requires it
+        if(current && --remaining == 0) {
+            writeRegister(ADS1015_REG_POINTER_CONFIG, config_voltage);
+            current = false;
+            settling = true;
+        } else if(!current) {
+            writeRegister(ADS1015_REG_POINTER_CONFIG, config_current);
+            current = true;
+            settling = true;
+            remaining = Config::ADC_CURRENT_PER_VOLTAGE;
+        }
+    }
+}
+
+void BCInputInterface::writeRegister(uint8_t reg, uint16_t value) {
+    char data[3] = { (char) reg, (char) (value >> 8), (char) (value & 0xFF) };
+    i2c.write(ADS1015_ADDRESS << 1, data, sizeof(data));
+}
+
+int16_t BCInputInterface::readConversion() {
+    char data[2] = { ADS1015_REG_POINTER_CONVERT, 0 };
+    i2c.write(ADS1015_ADDRESS << 1, data, 1, true);
+    i2c.read(ADS1015_ADDRESS << 1, data, sizeof(data));
+    return (int16_t) ((data[0] << 8) | (uint8_t) data[1]);
+}
+
 void BCInputInterface::trigger() {
-    adc.setGain(GAIN_EIGHT);
-//    int16_t current = Config::PACK_CURRENT_OFFSET - adc.readADC_Differential_0_1() ;
-    int16_t current = shuntoffset - adc.readADC_Differential_0_1() ;
+    if(continuous && (int32_t) (us_ticker_read() - ready_time) > Config::ADC_STALL_TIMEOUT * 1000) {
+        // Readings already queued are still delivered below.  The single shot reads rewrite the
+        // config register, which takes the ADC out of continuous mode
+        adc_ready.fall(NULL);
+        continuous = false;
+        stalled = true;
+        ERROR("ADC stalled in continuous mode, back to single shot readings!");
+    }
+
+    if(dropped != reported_dropped) {
+        uint32_t total = dropped;
+        WARN("ADC queue overran, %lu readings dropped", (unsigned long) (total - reported_dropped));
+        reported_dropped = total;
+    }
+
+    if(continuous || !samples.empty()) {
+        Sample sample;
+        bool have_voltage = false;
+        int16_t voltage = 0;
+        timestamp_t voltage_time = 0;
 
-//    DEBUG("ADC current: %d (%d mA) Off:%d", current, current * Config::PACK_CURRENT_SCALING,shuntoffset);
+        while(samples.pop(sample)) {
+            if(sample.current) {
+                addCurrent(sample.value, sample.timestamp);
+            } else {
+                voltage = sample.value;
+                voltage_time = sample.timestamp;
+                have_voltage = true;
+            }
+        }
 
-    handleCurrent(current * Config::PACK_CURRENT_SCALING);
+        // Car voltage is only used at its latest value
+        if(have_voltage)
+            handleVoltage(Config::PACK_VOLTAGE_SCALING.scale(voltage), voltage_time);
+        if(continuous)
+            return;
+    }
+
+    adc.setGain(GAIN_EIGHT);
+    int16_t current = adc.readADC_Differential_0_1();
+    timestamp_t timestamp = us_ticker_read(); // Single shot conversion has just finished
+
+    addCurrent(current, timestamp);
     adc.setGain(GAIN_ONE);
     uint16_t voltage = adc.readADC_SingleEnded(3); // TODO: Check channel
+    timestamp = us_ticker_read();
+
+    //DEBUG("ADC voltage: %hi (%i mV)", voltage, Config::PACK_VOLTAGE_SCALING.scale(voltage));
+
+    handleVoltage(Config::PACK_VOLTAGE_SCALING.scale(voltage), timestamp);
+}
+
+void BCInputInterface::addCurrent(int16_t code, timestamp_t timestamp) {
+    int32_t scaled = code * 16;
+
+    // Only follow drift once current has had time to die away after the contactors opened, and
+    // ignore readings that can't be offset alone
+    if(idle && (int32_t) (timestamp - idle_since) > Config::SHUNT_DRIFT_SETTLE * 1000
+            && abs(scaled - shunt_offset) <= Config::SHUNT_DRIFT_WINDOW * 16) {
+        shunt_offset = drift.add(scaled);
+        shunt_status |= TX::ShuntCalibration::TRACKING;
+    }
 
-    //DEBUG("ADC voltage: %hi (%i mV)", voltage, (voltage_t)(voltage * Config::PACK_VOLTAGE_SCALING));
+//    DEBUG("ADC current: %d (%d mA) Off:%ld", code, Config::PACK_CURRENT_SCALING.scale(shunt_offset - scaled, 4), shunt_offset);
 
-    handleVoltage(voltage * Config::PACK_VOLTAGE_SCALING);
+    uint32_t start = CycleCounter::read();
+    current_t current = Config::PACK_CURRENT_SCALING.scale(shunt_offset - scaled, 4);
+    scale_cycles = CycleCounter::read() - start;
+
+    handleCurrent(current, timestamp);
 }
 
-void BCInputInterface::calshunt() {
+bool BCInputInterface::calshunt(bool at_rest) {
+    bool restored = restoreOffset();
+
+    if(!at_rest) {
+        WARN("Shunt not calibrated, contactors closed! Using %s offset", restored ? "last" : "zero");
+        return false;
+    }
+
+    int16_t readings[Config::SHUNT_CAL_SAMPLES];
     adc.setGain(GAIN_EIGHT);
-	shuntoffset = adc.readADC_Differential_0_1() ;
-}
\ No newline at end of file
+    for(uint8_t i = 0; i < Config::SHUNT_CAL_SAMPLES; ++i)
+        readings[i] = adc.readADC_Differential_0_1();
+
+    int16_t sorted[Config::SHUNT_CAL_SAMPLES];
+    memcpy(sorted, readings, sizeof(sorted));
+    int16_t mid = median(sorted, Config::SHUNT_CAL_SAMPLES);
+
+    for(uint8_t i = 0; i < Config::SHUNT_CAL_SAMPLES; ++i)
+        sorted[i] = abs(readings[i] - mid);
+    int16_t mad = median(sorted, Config::SHUNT_CAL_SAMPLES);
+
+    if(abs(mid) > Config::SHUNT_CAL_MAX_OFFSET || mad > Config::SHUNT_CAL_MAX_MAD) {
+        WARN("Shunt not calibrated, current flowing! Median %hd, MAD %hd counts", mid, mad);
+        return false;
+    }
+
+    // The median itself is always kept, so n > 0
+    int16_t limit = mad > 0 ? mad * Config::SHUNT_CAL_OUTLIER_MAD : 1;
+    int32_t sum = 0;
+    int32_t sum_sq = 0;
+    uint8_t n = 0;
+    for(uint8_t i = 0; i < Config::SHUNT_CAL_SAMPLES; ++i) {
+        int32_t deviation = readings[i] - mid;
+        if(abs(deviation) <= limit) {
+            sum += deviation;
+            sum_sq += deviation * deviation;
+            ++n;
+        }
+    }
+
+    // Standard deviation in 1/16 counts.  n sum_sq <= (64 * 40)^2 after rejection, so 256 times it fits
+    int32_t variance = (sum_sq * n - sum * sum) * 256 / (n * n);
+    shunt_noise = variance > 0 ? isqrt(variance) : 0;
+
+    int32_t previous = shunt_offset;
+    shunt_offset = mid * 16 + sum * 16 / n;
+    calibrated_offset = shunt_offset;
+    drift.reset(shunt_offset);
+    shunt_samples = n;
+    shunt_status = TX::ShuntCalibration::CALIBRATED;
+    storeOffset();
+
+    uint16_t noise = getShuntNoise();
+    INFO("Shunt offset %ld/16 counts from %hhu readings, noise %u.%u mA", (long) shunt_offset, n,
+            noise / 10, noise % 10);
+    if(restored)
+        DEBUG("Shunt offset moved %ld/16 counts since last run", (long) (shunt_offset - previous));
+
+    return true;
+}
+
+void BCInputInterface::setIdle(bool idle) {
+    if(idle && !this->idle)
+        idle_since = us_ticker_read();
+
+    if(!idle && this->idle) {
+        shunt_status &= ~TX::ShuntCalibration::TRACKING;
+        storeOffset();
+    }
+
+    this->idle = idle;
+}
+
+void BCInputInterface::storeOffset() {
+    store.write(StoreRecords::SHUNT_OFFSET, &shunt_offset, sizeof(shunt_offset));
+}
+
+bool BCInputInterface::restoreOffset() {
+    if(!store.read(StoreRecords::SHUNT_OFFSET, &shunt_offset, sizeof(shunt_offset)))
+        return false;
+
+    calibrated_offset = shunt_offset;
+    drift.reset(shunt_offset);
+    shunt_status |= TX::ShuntCalibration::RESTORED;
+    return true;
+}
+
+int32_t BCInputInterface::getShuntOffset() {
+    return shunt_offset;
+}
+
+uint16_t BCInputInterface::getShuntNoise() {
+    return Config::PACK_CURRENT_SCALING.scale(shunt_noise * 10, 4);
+}
+
+int16_t BCInputInterface::getShuntDrift() {
+    return Config::PACK_CURRENT_SCALING.scale((shunt_offset - calibrated_offset) * 10, 4);
+}
+
+uint8_t BCInputInterface::getShuntSamples() {
+    return shunt_samples;
+}
+
+uint8_t BCInputInterface::getShuntStatus() {
+    return shunt_status;
+}
+
+bool BCInputInterface::isStalled() {
+    return stalled;
+}
+
+uint32_t BCInputInterface::getDropped() {
+    return dropped;
+}
+
+uint32_t BCInputInterface::getScaleCycles() {
+    return scale_cycles;
+}
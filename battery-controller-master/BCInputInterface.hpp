@@ -3,28 +3,134 @@
 
 #include "BCPinDefs.hpp"
 #include "BCTypes.hpp"
+#include "RingBuffer.hpp"
+#include "Filters.hpp"
+#include "BCConfig.hpp"
+#include "FlashStore.hpp"
 #include <mbed.h>
 #include <ADS1015/Adafruit_ADS1015.h>
 
 class BCInputInterface {
     public:
-		int shuntoffset;
         /** Interface to BC ADC for reading pack current and voltage
-         * @param _handleCurrent Callback for new current reading
-         * @param _handleVoltage Callback for new voltage reading
+         * @param _handleCurrent Callback for new current reading and the time it was taken
+         * @param _handleVoltage Callback for new voltage reading and the time it was taken
+         * @param store Persistent store for the shunt offset
          */
-        BCInputInterface(Callback<void(current_t)> _handleCurrent,
-                Callback<void(voltage_t)> _handleVoltage);
+        BCInputInterface(Callback<void(current_t, timestamp_t)> _handleCurrent,
+                Callback<void(voltage_t, timestamp_t)> _handleVoltage, FlashStore & store);
 
-        /** Initiate a voltage and current reading */
+        /** Switch the ADC to continuous conversion, paced by its ALERT/RDY pin.
+         *
+         * Conversions run back to back at 860 SPS, Config::ADC_CURRENT_PER_VOLTAGE current
+         * conversions to each car voltage conversion.  A high priority thread fetches each result
+         * as the ADC signals it ready and queues it with its timestamp, so trigger() never waits
+         * on I2C.  The single shot reads in calshunt() can't be used once this has been called.
+         *
+         * If no conversion is signalled for Config::ADC_STALL_TIMEOUT, trigger() gives up on
+         * continuous mode and isStalled() is set.
+         */
+        void startContinuous();
+
+        /** Deliver queued readings to the callbacks, or take a blocking reading of each if not
+         * converting continuously */
         void trigger();
-		void calshunt();
+
+        /** True if continuous conversion stopped and readings fell back to single shot */
+        bool isStalled();
+
+        /** Calibrate the shunt zero offset from Config::SHUNT_CAL_SAMPLES single shot readings.
+         *
+         * Readings far from the median are rejected as outliers and the rest averaged.  The result
+         * is kept in the store across power cycles.  If the pack isn't at rest, or the readings
+         * show current flowing, the offset from the last run is used instead.
+         *
+         * @param at_rest True if the contactors are open, so no current can flow.
+         * @return True if a new offset was measured.
+         */
+        bool calshunt(bool at_rest);
+
+        /** Allow the shunt offset to follow drift from readings taken while no current can flow.
+         * @param idle True while the contactors are open.
+         */
+        void setIdle(bool idle);
+
+        /** Shunt zero offset in 1/16 ADC count */
+        int32_t getShuntOffset();
+
+        /** Standard deviation of a single current reading at zero current in 1/10 mA */
+        uint16_t getShuntNoise();
+
+        /** Offset drift since calibration in 1/10 mA */
+        int16_t getShuntDrift();
+
+        /** Readings used for calibration after outlier rejection, 0 if not calibrated */
+        uint8_t getShuntSamples();
+
+        /** Flags as BCCANPackets::TX::ShuntCalibration::status */
+        uint8_t getShuntStatus();
+
+        /** Readings dropped because the queue filled between calls to trigger() */
+        uint32_t getDropped();
+
+        /** Core cycles taken to scale the last current reading to mA, to keep an eye on the
+         *  per-sample cost */
+        uint32_t getScaleCycles();
 
     private:
+        struct Sample {
+            timestamp_t timestamp; // us, end of conversion
+            int16_t value; // ADC code
+            bool current; // Else car voltage
+        };
+
+        static constexpr int32_t SIGNAL_READY = 0x1;
+
+        /** Apply the offset to a current reading, follow drift and deliver it */
+        void addCurrent(int16_t code, timestamp_t timestamp);
+
+        /** Keep the offset across power cycles in the store */
+        void storeOffset();
+        bool restoreOffset();
+
+        /** ALERT/RDY interrupt: conversion complete */
+        void ready();
+
+        /** Acquisition thread */
+        void acquire();
+
+        void writeRegister(uint8_t reg, uint16_t value);
+        int16_t readConversion();
+
         I2C i2c;
         Adafruit_ADS1115 adc;
 
-        Callback<void(current_t)> handleCurrent;
-        Callback<void(voltage_t)> handleVoltage;
+        Callback<void(current_t, timestamp_t)> handleCurrent;
+        Callback<void(voltage_t, timestamp_t)> handleVoltage;
+        FlashStore & store;
+
+        InterruptIn adc_ready;
+        Thread acquisition;
+        RingBuffer<Sample, Config::ADC_QUEUE_SIZE> samples;
+        volatile timestamp_t ready_time;
+        volatile uint32_t dropped;
+        uint32_t reported_dropped;
+        volatile bool continuous;
+        bool stalled;
+
+        // Cached config register words for each channel
+        uint16_t config_current;
+        uint16_t config_voltage;
+
+        int32_t shunt_offset; // 1/16 ADC count
+        int32_t calibrated_offset; // 1/16 ADC count
+        uint16_t shunt_noise; // 1/16 ADC count, standard deviation
+        uint8_t shunt_samples;
+        uint8_t shunt_status;
+
+        bool idle;
+        timestamp_t idle_since; // us
+        uint32_t scale_cycles;
+        Filters::IIR<int32_t, int32_t, Config::SHUNT_DRIFT_SHIFT> drift;
 };
 #endif
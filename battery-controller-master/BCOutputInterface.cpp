@@ -2,7 +2,10 @@
 
 constexpr uint16_t FAN_PWM_PERIOD_US = 1000;
 
+volatile bool BCOutputInterface::tripped = false;
+
 BCOutputInterface::BCOutputInterface() :
+    poll_period(0),
 #ifdef FAN1
     fan1(PinDefs::FAN1_DRIVE),
 #endif
@@ -11,37 +14,187 @@ BCOutputInterface::BCOutputInterface() :
     fan1.period_us(FAN_PWM_PERIOD_US);
 #endif
     fan2.period_us(FAN_PWM_PERIOD_US);
+
+    // The feedback ticker starts with the first switch
 }
 
-bool BCOutputInterface::setGndContactor(bool state) {
-    return conGround.setState(state);
+void BCOutputInterface::setGndContactor(bool state) {
+    conGround.setState(state);
+    schedulePoll();
 }
 
-bool BCOutputInterface::setPrechargeContactor(bool state) {
-    return conPrecharge.setState(state);
+void BCOutputInterface::setPrechargeContactor(bool state) {
+    conPrecharge.setState(state);
+    schedulePoll();
 }
 
-bool BCOutputInterface::setPositiveContactor(bool state) {
-    return conPositive.setState(state);
+void BCOutputInterface::setPositiveContactor(bool state) {
+    conPositive.setState(state);
+    schedulePoll();
 }
 
-bool BCOutputInterface::setChargeContactor(bool state) {
-    return conCharge.setState(state);
+void BCOutputInterface::setChargeContactor(bool state) {
+    conCharge.setState(state);
+    schedulePoll();
 }
 
 
-bool BCOutputInterface::shutdown() {
+void BCOutputInterface::shutdown() {
     conCharge.setState(false);
 
     Thread::wait(Config::MPPT_CONTACTOR_DELAY);
 
+    conPositive.setState(false);
+    conPrecharge.setState(false);
+    conGround.setState(false);
+    schedulePoll();
+}
+
+void BCOutputInterface::emergencyOpen() {
+    // Latched before any drive, so nothing this interrupted can close a contactor again
+    tripped = true;
+
+    // Current paths first
     conPositive.fastSet(false);
+    conCharge.fastSet(false);
     conPrecharge.fastSet(false);
     conGround.fastSet(false);
 
-    return conPositive.waitSwitch(false)
-        && conPrecharge.waitSwitch(false)
-        && conGround.waitSwitch(false);
+    timestamp_t now = us_ticker_read();
+    conPositive.expect(false, now);
+    conCharge.expect(false, now);
+    conPrecharge.expect(false, now);
+    conGround.expect(false, now);
+    schedulePoll();
+}
+
+void BCOutputInterface::clearTrip() {
+    tripped = false;
+}
+
+bool BCOutputInterface::allOpen() {
+    return !conGround.isClosed() && !conPositive.isClosed()
+        && !conPrecharge.isClosed() && !conCharge.isClosed();
+}
+
+bool BCOutputInterface::isSettled() {
+    return !conGround.isPending() && !conPositive.isPending()
+        && !conPrecharge.isPending() && !conCharge.isPending();
+}
+
+uint8_t BCOutputInterface::takeFailures() {
+    uint8_t failures = 0;
+    for(uint8_t i = 0; i < NUM_CONTACTORS; ++i) {
+        SwitchTiming & timing = switchTiming((Contactor) i);
+        if(timing.failed) {
+            timing.failed = false;
+            failures |= 1 << i;
+        }
+    }
+    return failures;
+}
+
+uint8_t BCOutputInterface::getHolding() {
+    return conGround.isHolding() << GROUND | conPositive.isHolding() << POSITIVE
+        | conPrecharge.isHolding() << PRECHARGE | conCharge.isHolding() << CHARGE;
+}
+
+uint16_t BCOutputInterface::getDropouts() {
+    return conGround.getDropouts() + conPositive.getDropouts()
+        + conPrecharge.getDropouts() + conCharge.getDropouts();
+}
+
+uint32_t BCOutputInterface::getHoldTime(Contactor contactor) {
+    switch(contactor) {
+        case GROUND:
+            return conGround.getHoldTime();
+        case POSITIVE:
+            return conPositive.getHoldTime();
+        case PRECHARGE:
+            return conPrecharge.getHoldTime();
+        default:
+            return conCharge.getHoldTime();
+    }
+}
+
+uint32_t BCOutputInterface::getCoilSaving(Contactor contactor) {
+    switch(contactor) {
+        case GROUND:
+            return conGround.getCoilSaving();
+        case POSITIVE:
+            return conPositive.getCoilSaving();
+        case PRECHARGE:
+            return conPrecharge.getCoilSaving();
+        default:
+            return conCharge.getCoilSaving();
+    }
+}
+
+uint32_t BCOutputInterface::getCoilEnergySaving() {
+    uint64_t saving = 0;
+    for(uint8_t i = 0; i < NUM_CONTACTORS; ++i)
+        saving += getCoilSaving((Contactor) i);
+    return saving * Config::CONTACTOR_COIL_POWER / 1000;
+}
+
+uint8_t BCOutputInterface::getHoldDuty(Contactor contactor) {
+    switch(contactor) {
+        case GROUND:
+            return conGround.getHoldDuty();
+        case POSITIVE:
+            return conPositive.getHoldDuty();
+        case PRECHARGE:
+            return conPrecharge.getHoldDuty();
+        default:
+            return conCharge.getHoldDuty();
+    }
+}
+
+const BCOutputInterface::SwitchTiming & BCOutputInterface::getTiming(Contactor contactor) {
+    return switchTiming(contactor);
+}
+
+BCOutputInterface::SwitchTiming & BCOutputInterface::switchTiming(Contactor contactor) {
+    switch(contactor) {
+        case GROUND:
+            return conGround.timing;
+        case POSITIVE:
+            return conPositive.timing;
+        case PRECHARGE:
+            return conPrecharge.timing;
+        default:
+            return conCharge.timing;
+    }
+}
+
+void BCOutputInterface::pollFeedback() {
+    timestamp_t now = us_ticker_read();
+    conGround.poll(now);
+    conPositive.poll(now);
+    conPrecharge.poll(now);
+    conCharge.poll(now);
+    schedulePoll();
+}
+
+void BCOutputInterface::schedulePoll() {
+    const uint32_t needed[NUM_CONTACTORS] = {conGround.pollPeriod(), conPositive.pollPeriod(),
+        conPrecharge.pollPeriod(), conCharge.pollPeriod()};
+    uint32_t period = 0;
+    for(uint8_t i = 0; i < NUM_CONTACTORS; ++i)
+        if(needed[i] && (!period || needed[i] < period))
+            period = needed[i];
+
+    // Held off so the ticker and thread can't both change it at once
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if(period != poll_period) {
+        poll_period = period;
+        if(period)
+            feedbackPoll.attach_us(callback(this, &BCOutputInterface::pollFeedback), period);
+        else
+            feedbackPoll.detach();
+    }
+    __set_PRIMASK(primask);
 }
 
 void BCOutputInterface::setFan1(uint8_t speed) {
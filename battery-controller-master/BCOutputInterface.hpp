@@ -5,46 +5,128 @@
 #include "BCPinDefs.hpp"
 #include "BCConfig.hpp"
 #include "Debug.hpp"
+#include "Histogram.hpp"
+#include "hal/us_ticker_api.h"
+#include <type_traits>
 #include <mbed.h>
 
 class BCOutputInterface {
 public:
+    enum Contactor {
+        GROUND,
+        POSITIVE,
+        PRECHARGE,
+        CHARGE,
+        NUM_CONTACTORS
+    };
+
+    typedef Histogram<Config::CONTACTOR_HISTOGRAM_BIN, Config::CONTACTOR_HISTOGRAM_BINS> SwitchHistogram;
+
+    /** How long a contactor takes to switch, from drive to feedback.  A contactor without
+     *  feedback never records any.
+     */
+    struct SwitchTiming {
+        SwitchTiming() : last_close(0), last_open(0), closes(0), failures(0), failed(false) {}
+
+        volatile uint32_t last_close; // us
+        volatile uint32_t last_open; // us
+        volatile uint32_t closes; // Times driven closed
+        volatile uint8_t failures; // Switches that timed out, saturating
+        volatile bool failed; // Timed out since the last takeFailures()
+        SwitchHistogram closing; // us
+        SwitchHistogram opening; // us
+    };
+
     BCOutputInterface();
 
-    /** Synchronously enable/disable GROUND contactor state.
+    /** Asynchronously enable/disable GROUND contactor state.
      *
      * @param state True to turn contactor on.
-     * @return True if contactor enabled correctly.
      */
-    bool setGndContactor(bool state);
+    void setGndContactor(bool state);
 
-    /** Synchronously enable/disable PRECHARGE contactor state.
+    /** Asynchronously enable/disable PRECHARGE contactor state.
      *
      * @param state True to turn contactor on.
-     * @return True if contactor enabled correctly.
      */
-    bool setPrechargeContactor(bool state);
+    void setPrechargeContactor(bool state);
 
-    /** Synchronously enable/disable POSITIVE contactor state.
+    /** Asynchronously enable/disable POSITIVE contactor state.
      *
      * Must not be switched unless car voltage rail is close to battery voltage.
      *
      * @param state True to turn contactor on.
-     * @return True if contactor enabled correctly.
      */
-    bool setPositiveContactor(bool state);
+    void setPositiveContactor(bool state);
 
     /** Asynchronously enable/disable CHARGE contactor states.
      *
      * @param state True to turn contactor on
-     * @return True if contactor enabled correctly.
      */
-    bool setChargeContactor(bool state);
+    void setChargeContactor(bool state);
 
     /** Run shutdown procedure - turn off charging, wait then disable other contactors.
-     * @return True on successful shutdown.
+     *
+     * Returns once every contactor has been driven open; failures to open are reported by
+     * takeFailures().
+     */
+    void shutdown();
+
+    /** Drive every contactor open at once, without waiting for or checking feedback, and latch
+     *  them open until clearTrip().
+     *
+     * Only single bit-band writes before the switch timing starts, so it is safe from an
+     * interrupt handler.  While latched, closing any contactor is ignored, so thread code it
+     * interrupted can't close one again before the state machine gets to its error state.
+     * Failures to open are reported by takeFailures().
+     */
+    void emergencyOpen();
+
+    /** Allow contactors to close again after emergencyOpen().  Only for leaving the error state. */
+    void clearTrip();
+
+    /** Check no current path can be closed.
+     * @return True if every contactor is open, by its feedback where it has one.
+     */
+    bool allOpen();
+
+    /** Check every contactor with feedback has finished switching.
+     * @return True if no contactor is still waiting for its feedback.
+     */
+    bool isSettled();
+
+    /** Contactors whose feedback didn't follow the drive in time, since the last call.
+     * @return Bit mask, 1 << Contactor.
+     */
+    uint8_t takeFailures();
+
+    /** Contactors whose coil is held by PWM.
+     * @return Bit mask, 1 << Contactor.
+     */
+    uint8_t getHolding();
+
+    /** Drop-outs seen while coils were held by PWM, over all contactors. */
+    uint16_t getDropouts();
+
+    /** Time a contactor's coil has been held by PWM since power up, in s. */
+    uint32_t getHoldTime(Contactor contactor);
+
+    /** Coil energy a contactor's economizer has saved since power up, in s at full drive.
+     *
+     * The hold time times 1 - duty^2, so it needs no coil power.
+     */
+    uint32_t getCoilSaving(Contactor contactor);
+
+    /** Coil energy the economizer has saved since power up, over all contactors, in J at
+     *  Config::CONTACTOR_COIL_POWER.
      */
-    bool shutdown();
+    uint32_t getCoilEnergySaving();
+
+    /** Coil PWM duty of a contactor once pulled in, in %.  100 without the economizer. */
+    uint8_t getHoldDuty(Contactor contactor);
+
+    /** Switching times of a contactor. */
+    const SwitchTiming & getTiming(Contactor contactor);
 
     /** Set fan 1 speed.
      *
@@ -61,18 +143,34 @@ public:
 private:
     /** Provide control for a contactor.
      *
-     * When told to switch states, will drive contactor then wait for contactor to switch.
-     * If contactor does not switch after 30ms (configurable), returns error.
+     * When told to switch states, drives the contactor and returns at once.  poll(), run from a
+     * ticker interrupt, timestamps the feedback change into the switch timing, or records a
+     * failure if the contactor does not switch within switch_delay_ms.  The CON1 and CON2 sense
+     * pins are on port 1 (P1.31, P1.30), which can't raise GPIO interrupts, hence the polling.
+     * CON3's (P0.26) could, but is polled with them so every contactor is timed alike.  The
+     * ticker only runs while pollPeriod() asks for it.
+     *
+     * Economizer: once closed and Config::CONTACTOR_PULL_IN has passed, the coil is held by its
+     * PWM1 channel at hold_duty instead of full drive.  The coil current settles to the duty
+     * times its full value, so coil power falls with the duty squared, and the time held is
+     * counted to report the saving.  If the feedback shows a drop-out the coil goes straight
+     * back to full drive, timed as a new close, and stays there until the next power cycle.
      *
      * @tparam drive_pin Pin that controls contactor coil.
      * @tparam feedback_pin Pin to read to check contactor movement.  Default is to ignore this pin and not check contactor status.
+     * @tparam indicate_pin Pin driven with the contactor state, e.g. an LED.  Default is none.
      * @tparam switch_delay_ms Time to wait before panicking.
-     * @tparam poll_time_ms Time to wait between polls.
+     * @tparam hold_duty Coil PWM duty in % once pulled in.  100 disables the economizer, which needs a PWM pin and feedback.
      */
-    template<PinName drive_pin, PinName feedback_pin = drive_pin, PinName indicate_pin = drive_pin, uint16_t switch_delay_ms = 30, uint8_t poll_time_ms = 2>
+    template<PinName drive_pin, PinName feedback_pin = drive_pin, PinName indicate_pin = drive_pin, uint16_t switch_delay_ms = 30, uint8_t hold_duty = 100>
     class ContactorControl {
     public:
-        ContactorControl() {
+        static_assert(hold_duty >= 100 || (IOTemplates::pwmChannel<drive_pin>() != 0 && feedback_pin != drive_pin),
+                "Economizer needs a PWM drive pin and feedback!");
+        static_assert(hold_duty > 0, "Hold duty must be non-zero!");
+
+        ContactorControl() : commanded(false), pending(false), commanded_at(0), polled_at(0),
+                economize(hold_duty < 100), holding(false), hold_ms(0), hold_us(0), dropouts(0) {
             IOTemplates::makeOutput<drive_pin>();
 
             // Not using feedback
@@ -86,63 +184,230 @@ private:
             if(indicate_pin != drive_pin)
                 IOTemplates::makeOutput<indicate_pin>();
         }
-        /** Synchronously set contactor state.
+
+        /** Asynchronously set contactor state.  Closing is ignored while tripped.
          *
          * @param state True to turn contactor on.
-         * @return True if contactor enabled correctly.
          */
-        bool setState(bool state) {
-            DEBUG("Enabling contactor!");
-            fastSet(state);
-            DEBUG("Waiting for switch.");
+        void setState(bool state) {
+            // Held off from the trip handler, so it can't open the contactor between the latch
+            // check and the drive, only to have it driven closed again once this resumes
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            if(!state || !tripped) {
+                // Re-driving the current state is not a switch, and mustn't restart one in
+                // progress.  Commanded first, so poll() can't start the economizer on a contactor
+                // being opened.
+                if(state != commanded)
+                    expect(state, us_ticker_read());
 
-            return waitSwitch(state);
+                fastSet(state);
+            }
+            __set_PRIMASK(primask);
         }
 
-        /** Block until contactor matches state or timeout is reached.
+        /** Start timing a switch already driven by fastSet().
          *
          * @param state State being switched to.
-         * @return True if contactor switches before timeout is reached.
+         * @param timestamp Time of the drive in us.
          */
+        void expect(bool state, timestamp_t timestamp) {
+            // All or nothing to poll() and the trip handler
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            commanded = state;
+            commanded_at = timestamp;
+            if(state)
+                ++timing.closes;
 
-        bool waitSwitch(bool state) {
-            // Not using feedback
-            if(feedback_pin == drive_pin) {
-                DEBUG("Assuming successful switch!");
-                return true;
+            // Without feedback there is nothing to wait for
+            pending = feedback_pin != drive_pin;
+            __set_PRIMASK(primask);
+        }
+
+        /** Check the feedback of a switch in progress.  Interrupt context.
+         * @param timestamp Time in us.
+         */
+        void poll(timestamp_t timestamp) {
+            uint32_t elapsed = timestamp - commanded_at;
+            uint32_t since = timestamp - polled_at;
+            polled_at = timestamp;
+
+            if(!pending) {
+                economizer(elapsed, since, timestamp);
+                return;
             }
 
-            // Poll the contactor aux contacts waiting for a close.
-            for(int i = 0; i < switch_delay_ms / poll_time_ms; ++i)
-                // Waiting for the pin to be high if we're turning the contactor off
-                //  or low if we're turning it on.
-                if(IOTemplates::read<feedback_pin>() != state) {
-                    DEBUG("Contactor switch success!");
-                    return true;
-                } else
-                    Thread::wait(2);
-
-            DEBUG("Contactor switch fail!");
-            // Oh no, everyone panic!
-            return false;
+            // Feedback pin is low when the contactor is on
+            if(IOTemplates::read<feedback_pin>() != commanded) {
+                if(commanded) {
+                    timing.last_close = elapsed;
+                    timing.closing.add(elapsed);
+                } else {
+                    timing.last_open = elapsed;
+                    timing.opening.add(elapsed);
+                }
+                pending = false;
+            } else if(elapsed > switch_delay_ms * 1000UL) {
+                if(timing.failures < UINT8_MAX)
+                    ++timing.failures;
+                timing.failed = true;
+                pending = false;
+            }
+        }
+
+        /** True while the coil is held by PWM. */
+        bool isHolding() {
+            return holding;
+        }
+
+        /** Number of times the contactor dropped out while held by PWM, saturating. */
+        uint8_t getDropouts() {
+            return dropouts;
+        }
+
+        /** Time held by PWM since power up, in s. */
+        uint32_t getHoldTime() {
+            return hold_ms / 1000;
+        }
+
+        /** Coil energy saved against full drive since power up, in s at full drive. */
+        uint32_t getCoilSaving() {
+            return (uint64_t) hold_ms * (10000 - hold_duty * hold_duty) / 10000000;
+        }
+
+        /** Coil PWM duty once pulled in, in %. */
+        static constexpr uint8_t getHoldDuty() {
+            return hold_duty;
+        }
+
+        /** True while waiting for the feedback to follow the drive. */
+        bool isPending() {
+            return pending;
+        }
+
+        /** How often poll() needs to run.
+         * @return Period in us: Config::CONTACTOR_POLL_PERIOD while a switch or pull-in is being
+         *         timed, Config::CONTACTOR_HOLD_POLL_PERIOD while only watching a held coil for a
+         *         drop-out, or 0 if there is nothing to poll.
+         */
+        uint32_t pollPeriod() {
+            if(pending || (economize && commanded && !holding))
+                return Config::CONTACTOR_POLL_PERIOD;
+            if(holding)
+                return Config::CONTACTOR_HOLD_POLL_PERIOD;
+            return 0;
+        }
+
+        /** Contactor state, by feedback if used or else by what it is being driven to.
+         * @return True if contactor is on.
+         */
+        bool isClosed() {
+            if(feedback_pin == drive_pin)
+                return IOTemplates::read<drive_pin>();
+
+            return !IOTemplates::read<feedback_pin>();
         }
 
         /** Set state but don't check status.
          * @param state True to turn contactor on.
          */
         void fastSet(bool state) {
+            // The trip handler can't land between the drive and taking the pin back from PWM
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
             IOTemplates::write<drive_pin>(state);
+            if(hold_duty < 100 && !state) {
+                // Take the pin back from PWM, it then follows the write above
+                IOTemplates::setFunction<drive_pin>(0);
+                holding = false;
+            }
+            __set_PRIMASK(primask);
             if(drive_pin != indicate_pin)
                 IOTemplates::write<indicate_pin>(state);
         }
 
+        SwitchTiming timing;
+
+    private:
+        /** Start or supervise PWM hold of a closed contactor.  Interrupt context.
+         * @param elapsed Time since the contactor was commanded in us.
+         * @param since Time since the last poll in us.
+         */
+        void economizer(uint32_t elapsed, uint32_t since, timestamp_t timestamp) {
+            if(hold_duty >= 100 || !commanded)
+                return;
+
+            if(holding) {
+                // Counted in whole ms, carrying the rest, so the count lasts 49 days
+                uint32_t us = hold_us + since;
+                hold_ms += us / 1000;
+                hold_us = us % 1000;
+
+                // Feedback pin is high when the contactor is off
+                if(IOTemplates::read<feedback_pin>()) {
+                    IOTemplates::setFunction<drive_pin>(0);
+                    holding = false;
+                    economize = false;
+                    if(dropouts < UINT8_MAX)
+                        ++dropouts;
+
+                    // Fails if it doesn't pull back in at full drive
+                    commanded_at = timestamp;
+                    pending = true;
+                }
+            } else if(economize && elapsed > Config::CONTACTOR_PULL_IN * 1000UL
+                    && !IOTemplates::read<feedback_pin>()) {
+                // A trip handler that interrupted this ticker has opened the contactor, and
+                // handing the pin to PWM would close it again
+                uint32_t primask = __get_PRIMASK();
+                __disable_irq();
+                if(commanded) {
+                    startHold(std::integral_constant<bool, (hold_duty < 100)>());
+                    holding = true;
+                }
+                __set_PRIMASK(primask);
+            }
+        }
+
+        // Only instantiated with PWM for contactors that use the economizer
+        void startHold(std::true_type) {
+            IOTemplates::startPWM<drive_pin>(hold_duty);
+        }
+        void startHold(std::false_type) {}
+
+        volatile bool commanded;
+        volatile bool pending;
+        volatile timestamp_t commanded_at; // us
+        timestamp_t polled_at; // us
+
+        volatile bool economize; // Cleared for good by a drop-out
+        volatile bool holding;
+        volatile uint32_t hold_ms; // Time spent in PWM hold
+        uint16_t hold_us; // Carried towards the next ms of hold_ms
+        volatile uint8_t dropouts;
     };
 
+    // Set by emergencyOpen(), holds every contactor open until clearTrip()
+    static volatile bool tripped;
+
+    SwitchTiming & switchTiming(Contactor contactor);
+
+    /** Poll every contactor's feedback.  Ticker interrupt. */
+    void pollFeedback();
+
+    /** Run the feedback ticker at the shortest period any contactor needs, or stop it if none
+     *  needs polling.  Safe from an interrupt handler. */
+    void schedulePoll();
+
     ContactorControl<PinDefs::CON1_DRIVE, PinDefs::CON1_SENSE, LED1> conGround;
-    ContactorControl<PinDefs::CON2_DRIVE, PinDefs::CON2_SENSE, LED2> conPositive;
-    ContactorControl<PinDefs::CON3_DRIVE, PinDefs::CON3_SENSE, LED3> conPrecharge;
+    ContactorControl<PinDefs::CON2_DRIVE, PinDefs::CON2_SENSE, LED2, 30, Config::POSITIVE_HOLD_DUTY> conPositive;
+    ContactorControl<PinDefs::CON3_DRIVE, PinDefs::CON3_SENSE, LED3, 30, Config::PRECHARGE_HOLD_DUTY> conPrecharge;
     ContactorControl<PinDefs::CON4_DRIVE, PinDefs::CON4_DRIVE, LED4> conCharge;
 
+    Ticker feedbackPoll;
+    uint32_t poll_period; // us: Of feedbackPoll, 0 while stopped
+
 #ifdef FAN1
     PwmOut fan1;
 #endif
@@ -11,6 +11,9 @@ namespace PinDefs {
 
     constexpr PinName ADC_I2C_SDA = p9;
     constexpr PinName ADC_I2C_SCL = p10;
+    // XXX: ADS1115 ALERT/RDY isn't wired yet, see Config::ADC_CONTINUOUS.  Must be a port 0/2 pin
+    // for GPIO interrupts, as p15 (P0.23) is
+    constexpr PinName ADC_READY = p15;
 
     constexpr PinName FAN1_SENSE = p24;
     constexpr PinName FAN2_SENSE = p23;
@@ -1,11 +1,15 @@
 #include "BCStateMachine.hpp"
 #include "hal/us_ticker_api.h"
+#include "CycleCounter.hpp"
+#include "Trace.hpp"
 
-#define TRANSITION(state) do { DEBUG("State change to: " #state); transition(state); } while(false)
+constexpr Log::Level LOG_LEVEL = Config::LOG_LEVEL_STATE_MACHINE;
+
+#define TRANSITION(state) do { DEBUG("State change to: %s", #state); transition(state); } while(false)
 
 using namespace BCCANPackets;
 
-BCStateMachine::BCStateMachine(CANInterface & cani) :
+BCStateMachine::BCStateMachine(CANInterface & cani, FlashStore & store, CellHistory & history) :
     state(BC_IDLE),
     last_ticker(0),
     current_time(0),
@@ -14,32 +18,56 @@ BCStateMachine::BCStateMachine(CANInterface & cani) :
     last_group1(0),
     last_group2(0),
     can(cani),
+    store(store),
+    history(history),
     lastCarVoltage(0),
     lastPackVoltage(0),
-    lastCurrent(0) {
+    lastCurrent(0),
+    modelCurrent(0),
+    modelCurrentTime(0),
+    lastCellMin(0),
+    lastCellMax(0),
+    lastTemperatureMin(0),
+    lastTemperatureMax(0),
+    overCurrentTripped(false),
+    tripCycles(0),
+    lastDropouts(0),
+    traceTarget(RX::TraceRequest::UART),
+    lastIssue(TX::Issue::OK),
+    last_snapshot(0),
+    blackBoxStarted(false),
+    last_lifetime_save(0),
+    last_histogram_save(0),
+    last_checkpoint(0),
+    storeKey(0),
+    storeLength(0),
+    storeOffset(0),
+    storeSending(false),
+    lifetime(store),
+    histograms(store),
+    checkpoint(store) {
+        CycleCounter::enable();
         last_ticker = us_ticker_read();
+        output.setFan1(fans.getSpeed());
+        output.setFan2(fans.getSpeed());
         TRANSITION(BC_IDLE);
     }
 
-void BCStateMachine::setCurrent(current_t current) {
+void BCStateMachine::setCurrent(current_t current, timestamp_t timestamp) {
     lastCurrent = current;
+    modelCurrent = currentSpikes.add(current);
+    modelCurrentTime = timestamp;
+    currentDecimator.add(modelCurrent);
 
-    if(state == BC_ERROR)
-        return;
+    // Counting integrates every raw sample, which already averages out noise
+    coulombs.addSample(current, timestamp);
 
-    if(current < Config::MAX_DISCHARGE_CURRENT) {
-        TRANSITION(BC_ERROR);
-        ERROR("Discharge current limit exceeded: %i mA", current);
-        issue.whatWentWrong |= TX::Issue::OVER_DISCHARGE_CURRENT;
-        return;
-    }
+    // Debounced on every sample, the transition follows in tick()
+    faults.setCurrent(current);
 
-    if(current > Config::MAX_CHARGE_CURRENT) {
-        TRANSITION(BC_ERROR);
-        ERROR("Charge current limit exceeded: %i mA", current);
-        issue.whatWentWrong |= TX::Issue::OVER_CHARGE_CURRENT;
-        return;
-    }
+    blackBox.addCurrent(current);
+    lifetime.addSample(current, lastPackVoltage, timestamp);
+    histograms.addCurrent(current, timestamp);
 }
 
 void BCStateMachine::setPackVoltage(voltage_t voltage) {
@@ -51,8 +79,9 @@ void BCStateMachine::setPackVoltage(voltage_t voltage) {
 //    handleVoltage(voltage, true);
 }
 
-void BCStateMachine::setCarVoltage(voltage_t voltage) {
+void BCStateMachine::setCarVoltage(voltage_t voltage, timestamp_t timestamp) {
     lastCarVoltage = voltage;
+    carVoltageFilter.add(carVoltageSpikes.add(voltage));
     
     if(state == BC_ERROR)
         return;
@@ -60,16 +89,38 @@ void BCStateMachine::setCarVoltage(voltage_t voltage) {
 //    if(state == BC_RUN || state == BC_CHARGED || state == BC_BALANCE)
 //       handleVoltage(voltage, false);
 
-    if(voltage > Config::PRECHARGE_COMPLETE_PERCENTAGE * lastPackVoltage && state == BC_PRECHARGE) {
-         if(current_time - last_transition > 500) {
-            wait_ms(200);
+    if(state != BC_PRECHARGE)
+        return;
+
+    switch(precharge.update(timestamp, voltage, lastCurrent)) {
+        case PrechargeMonitor::IN_PROGRESS:
+            break;
+        case PrechargeMonitor::COMPLETE:
+            INFO("Precharge complete after %lu ms, final voltage %li mV",
+                    (unsigned long) precharge.elapsed(), (long) precharge.finalVoltage());
             output.setPositiveContactor(true);
             wait_ms(50);
             output.setPrechargeContactor(false);
             wait_ms(500);
             output.setChargeContactor(true);
             TRANSITION(BC_RUN);
-        }
+            break;
+        case PrechargeMonitor::SHORT_CIRCUIT:
+            TRANSITION(BC_ERROR);
+            ERROR("Precharge failed: car bus short circuit!");
+            DEBUG("Car voltage %li mV settling at %li mV", (long) voltage, (long) precharge.finalVoltage());
+            issue.whatWentWrong |= TX::Issue::PRECHARGE_FAIL;
+            break;
+        case PrechargeMonitor::OPEN_CIRCUIT:
+            TRANSITION(BC_ERROR);
+            ERROR("Precharge failed: open circuit!");
+            issue.whatWentWrong |= TX::Issue::PRECHARGE_FAIL;
+            break;
+        case PrechargeMonitor::TOO_SLOW:
+            TRANSITION(BC_ERROR);
+            ERROR("Precharge failed: predicted to take %lu ms!", (unsigned long) precharge.predictedCompletion());
+            issue.whatWentWrong |= TX::Issue::PRECHARGE_FAIL;
+            break;
     }
 }
 
@@ -111,6 +162,11 @@ void BCStateMachine::handleCAN(const CANMessage & msg) {
                         issue.whatWentWrong |= TX::Issue::UNKNOWN;
                         break;
                     case BC_ERROR_UNLOCK:
+                        // The comparator output stays low while the over current persists
+                        if(state == BC_ERROR && !IOTemplates::read<PinDefs::CON_ENABLE>()) {
+                            WARN("Over current comparator still tripped, staying in error!");
+                            break;
+                        }
                         if(state == BC_ERROR) {
                             WARN("CAN forced state from error to idle!");
                             IOTemplates::clear<LED1>();
@@ -120,6 +176,8 @@ void BCStateMachine::handleCAN(const CANMessage & msg) {
 
                             INFO("Clearing error flags");
                             issue.whatWentWrong = TX::Issue::OK;
+                            faults.clearLatched();
+                            output.clearTrip();
                             TRANSITION(BC_IDLE);
                         }
                     default:
@@ -149,6 +207,68 @@ void BCStateMachine::handleCAN(const CANMessage & msg) {
 
                 issue.whatWentWrong &= ~TX::Issue::HEARTBEAT_TIMEOUT;
             }
+            break;
+        case RX::CellStateRequest::ID:
+            {
+                if(msg.len != sizeof(RX::CellStateRequest)) {
+                    WARN("Malformed CAN: CellStateRequest with ID %x must have length %lu",
+                            msg.id, sizeof(RX::CellStateRequest));
+                    break;
+                }
+                RX::CellStateRequest * req = (RX::CellStateRequest*)msg.data;
+
+                if(req->cell == RX::CellStateRequest::ALL) {
+                    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell)
+                        sendCellState(cell);
+                } else if(req->cell < Config::NUM_CELLS_SERIES) {
+                    sendCellState(req->cell);
+                } else {
+                    WARN("Malformed CAN: got cell state request for cell %hhu", req->cell);
+                }
+            }
+            break;
+        case RX::TraceRequest::ID:
+            {
+                if(msg.len != sizeof(RX::TraceRequest)) {
+                    WARN("Malformed CAN: TraceRequest with ID %x must have length %lu",
+                            msg.id, sizeof(RX::TraceRequest));
+                    break;
+                }
+                RX::TraceRequest * req = (RX::TraceRequest*)msg.data;
+
+                if(req->target != RX::TraceRequest::UART && req->target != RX::TraceRequest::CAN) {
+                    WARN("Malformed CAN: got trace request to target %hhu", req->target);
+                    break;
+                }
+
+                traceTarget = req->target;
+                uint16_t events = Trace::startDump();
+                if(traceTarget == RX::TraceRequest::CAN) {
+                    TX::TraceStart start;
+                    start.clock = SystemCoreClock;
+                    start.events = events;
+                    can.send(&start);
+                } else {
+                    CONSOLE.log(Log::TRACE_START, 0, SystemCoreClock, events);
+                }
+            }
+            break;
+        case RX::StoreRequest::ID:
+            {
+                if(msg.len != sizeof(RX::StoreRequest)) {
+                    WARN("Malformed CAN: StoreRequest with ID %x must have length %lu",
+                            msg.id, sizeof(RX::StoreRequest));
+                    break;
+                }
+                RX::StoreRequest * req = (RX::StoreRequest*)msg.data;
+
+                // Replaces any read back in progress
+                int16_t length = store.read(req->key, storeData);
+                storeKey = req->key;
+                storeLength = length > 0 ? length : 0;
+                storeOffset = 0;
+                storeSending = true;
+            }
             break;
 		case RX::HMIStatus::ID: // HMI (Stop voltage check during using Horn due to noise issue)
             {
@@ -180,12 +300,34 @@ void BCStateMachine::tick() {
     current_time += (new_ticker - last_ticker)/1000;
     last_ticker = new_ticker;
 
+    if(overCurrentTripped) {
+        overCurrentTripped = false;
+        issue.whatWentWrong |= TX::Issue::OVER_CURRENT_HARDWARE;
+        ERROR("Hardware over current! Contactors opened %lu cycles (%lu ns) into the trip handler",
+                (unsigned long) tripCycles,
+                (unsigned long) ((uint64_t) tripCycles * 1000000000ULL / SystemCoreClock));
+        DEBUG("Current: %li mA", (long) lastCurrent);
+        if(state != BC_ERROR)
+            TRANSITION(BC_ERROR);
+    }
+
+    uint8_t failed = output.takeFailures();
+    if(failed) {
+        issue.whatWentWrong |= TX::Issue::CONTACTOR;
+        ERROR("Contactor feedback didn't follow drive: %hhX", failed);
+        if(state != BC_ERROR)
+            TRANSITION(BC_ERROR);
+    }
+
     if(state != BC_IDLE && state != BC_ERROR && current_time - last_heartbeat > Config::HEARTBEAT_PERIOD) {
         TRANSITION(BC_IDLE);
         INFO("Heartbeat timeout! Diff: %li", (current_time - last_heartbeat));
         issue.whatWentWrong |= TX::Issue::HEARTBEAT_TIMEOUT;
     }
 
+    // Current limits latch, so a trip on any sample since the last tick is acted on here
+    checkFaults();
+
     if(state == BC_PRECHARGE) {
         if(current_time - last_transition > Config::PRECHARGE_ERROR_PERIOD) {
             TRANSITION(BC_ERROR);
@@ -199,11 +341,11 @@ void BCStateMachine::tick() {
 
         TX::PackVoltage pv;
         pv.packVoltage = lastPackVoltage;
-        pv.carVoltage = lastCarVoltage;
+        pv.carVoltage = carVoltageFilter.get();
         can.send(&pv);
 
         TX::PackCurrent pc;
-        pc.packCurrent = lastCurrent;
+        pc.packCurrent = currentDecimator.get();
         can.send(&pc);
 
         if(state == BC_ERROR) {
@@ -212,48 +354,45 @@ void BCStateMachine::tick() {
             IOTemplates::toggle<LED3>();
             IOTemplates::toggle<LED4>();
         }
+
+		// Open circuit voltage is only meaningful before counting starts or once the pack has rested
+		if(lastPackVoltage > 0 && (!coulombs.isInitialised() || coulombs.isAtRest()))
+			coulombs.setCharge(OCV::packCharge(pv.packVoltage, pc.packCurrent));
+		if(lastPackVoltage > 0 && coulombs.isAtRest())
+			checkpoint.setRestVoltage(pv.packVoltage);
+
 		TX::ChargeState cs;
-		float comp_voltage;
-		comp_voltage = ((float)pv.packVoltage/36000) - ((float)pc.packCurrent / 11000 * 0.06);
-		if(comp_voltage >= 4.2){
-			cs.amp_hours = 11 * 3.2;
-			cs.percentage = 100 * cs.amp_hours / 35.2;
-		}else if (comp_voltage > 4.17){
-			cs.amp_hours = 11 * (3.2 + (comp_voltage - 4.2303) / 0.437);
-			cs.percentage = 100 * cs.amp_hours / 35.2;
-		}else if (comp_voltage > 4.14){
-			cs.amp_hours = 11 * (3.2 + (comp_voltage - 4.197) / 0.206);
-			cs.percentage = 100 * cs.amp_hours / 35.2;
-		}else if (comp_voltage > 4.12){
-			cs.amp_hours = 11 * (3.2 + (comp_voltage - 4.183) / 0.149);
-			cs.percentage = 100 * cs.amp_hours / 35.2;
-		}else if (comp_voltage > 4.09){
-			cs.amp_hours = 11 * (3.2 + (comp_voltage - 4.216) / 0.229);
-			cs.percentage = 100 * cs.amp_hours / 35.2;
-		}else if (comp_voltage > 3.5){
-			cs.amp_hours = 11 * (3.2 + (comp_voltage - 4.215) / 0.262);
-			cs.percentage = 100 * cs.amp_hours / 35.2;
-		}else if (comp_voltage > 3.485){
-			cs.amp_hours = 11 * (3.2 + (comp_voltage - 4.021) / 0.195);
-			cs.percentage = 100 * cs.amp_hours / 35.2;
-		}else if (comp_voltage > 3.32){
-			cs.amp_hours = 11 * (3.2 + (comp_voltage - 5.28) / 0.653);
-			cs.percentage = 100 * cs.amp_hours / 35.2;
-		}else if (comp_voltage > 3.0){
-			cs.amp_hours = 11 * (3.2 + (comp_voltage - 6.516) / 1.065);
-			cs.percentage = 100 * cs.amp_hours / 35.2;
-		}else {
-			cs.amp_hours = 0;
-			cs.percentage = 0;
-		}
+		cs.amp_hours = coulombs.getCharge() / 1000.0f;
+		cs.percentage = coulombs.getSOC() / 10.0f;
         can.send(&cs);
 
-/*
-		Cell voltage = (-0.437 * battery_AH) +4.2303
-		(Cell voltage - 4.2303)/-0.437 = battery used AH
-*/		
-		
-		
+        uint16_t soc = coulombs.getSOC();
+        TX::CurrentLimit cl;
+        cl.maxCharge = CurrentLimit::charge(lastCellMax, lastTemperatureMin, lastTemperatureMax, soc);
+        cl.maxDischarge = CurrentLimit::discharge(lastCellMin, lastTemperatureMin, lastTemperatureMax, soc);
+        // Also hold every cell group inside its voltage limits at its fitted resistance
+        if(resistance.isValid()) {
+            if(resistance.getChargeLimit() < cl.maxCharge)
+                cl.maxCharge = resistance.getChargeLimit();
+            if(resistance.getDischargeLimit() > cl.maxDischarge)
+                cl.maxDischarge = resistance.getDischargeLimit();
+        }
+        can.send(&cl);
+
+        if(cellModel.isInitialised()) {
+            TX::CellSOC csoc;
+            csoc.minSOC = cellModel.getMinSOC();
+            csoc.maxSOC = cellModel.getMaxSOC();
+            csoc.meanSOC = cellModel.getMeanSOC();
+            csoc.minCell = cellModel.getMinCell();
+            csoc.maxCell = cellModel.getMaxCell();
+            can.send(&csoc);
+
+            TX::UsableCharge uc;
+            uc.usable = cellModel.getUsableCharge();
+            uc.headroom = cellModel.getChargeHeadroom();
+            can.send(&uc);
+        }
 	}
     if(current_time - last_group2 > Config::CAN_GROUP2_PERIOD) {
         last_group2 = current_time;
@@ -266,8 +405,67 @@ void BCStateMachine::tick() {
             can.send(&issue);
         }
 
+        TX::PackResistance pr;
+        pr.meanResistance = resistance.getMeanResistance();
+        pr.maxResistance = resistance.getMaxResistance();
+        pr.maxCell = resistance.getMaxCell();
+        pr.valid = resistance.isValid();
+        can.send(&pr);
+
+        for(uint8_t i = 0; i < BCOutputInterface::NUM_CONTACTORS; ++i) {
+            const BCOutputInterface::SwitchTiming & timing = output.getTiming((BCOutputInterface::Contactor) i);
+            TX::ContactorTiming contactor;
+            contactor.contactor = i;
+            contactor.failures = timing.failures;
+            contactor.lastClose = timing.last_close / 100;
+            contactor.lastOpen = timing.last_open / 100;
+            contactor.slowClose = timing.closing.percentile(90) / 100;
+            can.send(&contactor);
+
+            TX::CoilSaving cs;
+            cs.contactor = i;
+            cs.duty = output.getHoldDuty((BCOutputInterface::Contactor) i);
+            uint32_t held = output.getHoldTime((BCOutputInterface::Contactor) i) / 60;
+            cs.holdTime = held < UINT16_MAX ? held : UINT16_MAX;
+            uint32_t saving = output.getCoilSaving((BCOutputInterface::Contactor) i) / 60;
+            cs.saving = saving < UINT16_MAX ? saving : UINT16_MAX;
+            can.send(&cs);
+        }
+
+        TX::CoilEconomizer ce;
+        ce.saving = output.getCoilEnergySaving();
+        ce.holding = output.getHolding();
+        uint16_t dropouts = output.getDropouts();
+        ce.dropouts = dropouts < UINT8_MAX ? dropouts : UINT8_MAX;
+        can.send(&ce);
+
+        if(dropouts != lastDropouts) {
+            WARN("Contactor dropped out under PWM hold, back to full drive! %hu drop-outs", dropouts);
+            lastDropouts = dropouts;
+        }
+
+        fans.measure(current_time);
+        TX::Fans f;
+        f.rpm[FanControl::FAN1] = fans.getRPM(FanControl::FAN1);
+        f.rpm[FanControl::FAN2] = fans.getRPM(FanControl::FAN2);
+        f.speed = fans.getSpeed();
+        f.stalled = fans.getStalled();
+        can.send(&f);
+
+        if(f.stalled && !(issue.whatWentWrong & TX::Issue::FAN_STALL))
+            WARN("Fan stalled: %hhX at speed %hhu", f.stalled, f.speed);
+        if(f.stalled)
+            issue.whatWentWrong |= TX::Issue::FAN_STALL;
+        else
+            issue.whatWentWrong &= ~TX::Issue::FAN_STALL;
+
+        TX::ChargeThroughput ct;
+        ct.charged = coulombs.getCharged();
+        ct.discharged = coulombs.getDischarged();
+        can.send(&ct);
+
         DEBUG("Pack voltage: %u mV, car voltage: %u mV, current: %u mA",
-                lastPackVoltage, lastCarVoltage, lastCurrent);
+                lastPackVoltage, carVoltageFilter.get(), currentDecimator.get());
 	}
 	//*********** Polling for CAN RX *******************
     CANMessage msg;
@@ -276,7 +474,149 @@ void BCStateMachine::tick() {
         handleCAN(msg);
 	}
 	//**************************************************
-	
+
+    if(issue.whatWentWrong != lastIssue) {
+        uint32_t raised = issue.whatWentWrong & ~lastIssue;
+        if(raised)
+            saveFault(raised);
+        snapshotBlackBox();
+        blackBox.record(current_time, BlackBox::ISSUE, lastIssue, issue.whatWentWrong);
+        lastIssue = issue.whatWentWrong;
+    } else if(current_time - last_snapshot >= Config::BLACK_BOX_SNAPSHOT_PERIOD) {
+        snapshotBlackBox();
+    }
+
+    if(current_time - last_lifetime_save >= Config::LIFETIME_SAVE_PERIOD)
+        saveLifetime(false);
+
+    if(current_time - last_checkpoint >= Config::CHARGE_CHECKPOINT_PERIOD)
+        saveCheckpoint(false);
+
+    if(current_time - last_histogram_save >= Config::HISTOGRAM_SAVE_PERIOD) {
+        histograms.save();
+        last_histogram_save = current_time;
+    }
+    // Queued a record at a time, and only while they can go straight to flash
+    if(output.allOpen())
+        histograms.saveNext();
+
+    sendTrace();
+    sendBlackBox();
+    sendStore();
+}
+
+void BCStateMachine::setADCStalled() {
+    if(!(issue.whatWentWrong & TX::Issue::ADC_STALL)) {
+        WARN("Current sampling slowed to single shot readings");
+        issue.whatWentWrong |= TX::Issue::ADC_STALL;
+    }
+}
+
+void BCStateMachine::tripOverCurrent() {
+    uint32_t start = CycleCounter::read();
+    output.emergencyOpen();
+    tripCycles = CycleCounter::read() - start;
+    overCurrentTripped = true;
+}
+
+void BCStateMachine::sendTrace() {
+    // A few events per tick, so a dump doesn't hold up the control loop or flood the bus
+    Trace::Event event;
+    for(uint8_t i = 0; i < Config::TRACE_DUMP_PER_TICK && Trace::nextDump(event); ++i) {
+        if(traceTarget == RX::TraceRequest::CAN) {
+            TX::TraceEvent frame;
+            frame.cycles = event.cycles;
+            frame.id = event.id;
+            frame.arg = event.arg;
+            frame.flags = event.flags;
+            can.send(&frame);
+        } else {
+            CONSOLE.log(Log::TRACE, 0, event.cycles, event.id, event.arg, event.flags);
+        }
+    }
+}
+
+void BCStateMachine::sendBlackBox() {
+    if(!blackBoxStarted) {
+        TX::BlackBoxStart start;
+        start.entries = blackBox.getDumpSize();
+        start.corrupt = blackBox.getCorrupt();
+        start.boot = blackBox.getBoot();
+        start.resetCause = blackBox.getResetCause();
+        can.send(&start);
+        blackBoxStarted = true;
+        return;
+    }
+
+    BlackBox::Entry entry;
+    for(uint8_t i = 0; i < Config::BLACK_BOX_DUMP_PER_TICK && blackBox.nextDump(entry); ++i) {
+        TX::BlackBoxEntry header;
+        header.time = entry.time;
+        header.sequence = entry.sequence;
+        header.kind = entry.kind;
+        header.boot = entry.boot;
+        can.send(&header);
+
+        TX::BlackBoxValues values;
+        values.a = entry.a;
+        values.b = entry.b;
+        can.send(&values);
+    }
+}
+
+void BCStateMachine::snapshotBlackBox() {
+    blackBox.snapshot(current_time, lastCellMin, lastCellMax, lastTemperatureMin, lastTemperatureMax);
+    last_snapshot = current_time;
+}
+
+void BCStateMachine::saveLifetime(bool urgent) {
+    uint32_t closes[BCOutputInterface::NUM_CONTACTORS];
+    for(uint8_t i = 0; i < BCOutputInterface::NUM_CONTACTORS; ++i)
+        closes[i] = output.getTiming((BCOutputInterface::Contactor) i).closes;
+
+    lifetime.save(current_time, coulombs.getCharged(), coulombs.getDischarged(), closes, urgent);
+    last_lifetime_save = current_time;
+}
+
+void BCStateMachine::saveCheckpoint(bool urgent) {
+    checkpoint.save(coulombs, cellModel, urgent);
+    last_checkpoint = current_time;
+}
+
+void BCStateMachine::saveFault(uint32_t raised) {
+    StoreRecords::Fault fault = {};
+    fault.number = lifetime.addFault();
+    fault.boot = lifetime.get().boots;
+    fault.time = current_time;
+    fault.issue = issue.whatWentWrong;
+    fault.raised = raised;
+    fault.current = lastCurrent;
+    fault.cellMin = lastCellMin;
+    fault.cellMax = lastCellMax;
+    fault.temperatureMax = lastTemperatureMax;
+    fault.state = state;
+
+    // Oldest overwritten first
+    if(!store.write(StoreRecords::FAULT + fault.number % Config::STORE_FAULTS, &fault, sizeof(fault), true))
+        WARN("Store full, fault record %lu dropped!", (unsigned long) fault.number);
+}
+
+void BCStateMachine::sendStore() {
+    for(uint8_t i = 0; i < Config::STORE_DATA_PER_TICK && storeSending; ++i) {
+        TX::StoreData frame = {};
+        frame.key = storeKey;
+        frame.offset = storeOffset;
+        frame.length = storeLength;
+
+        uint8_t n = storeLength - storeOffset;
+        if(n > sizeof(frame.data))
+            n = sizeof(frame.data);
+        memcpy(frame.data, storeData + storeOffset, n);
+        can.send(&frame);
+
+        storeOffset += n;
+        storeSending = storeOffset < storeLength;
+    }
 }
 
 void BCStateMachine::forceTransition(State state) {
@@ -331,58 +671,150 @@ void BCStateMachine::handleVoltage(voltage_t voltage, bool pack) {
 }
 
 
-////--------------Need work to check individual cell under/over voltage. (compare with min and max voltage)
 void BCStateMachine::handleCellVoltage(voltage_t voltage_min, voltage_t voltage_max) {
 //         DEBUG("voltage Max %i mV, Min %i mV", voltage_max, voltage_min);
 
-	if(horn_flag == 1) return; //When horn is turned on, skip cell voltage check due to noise isspace
+    // The horn couples noise into the cell readings - hold off giving the fault monitor new
+    // voltage samples while it sounds, so its debouncing neither trips nor releases on them.
+	if(horn_flag != 1)
+        faults.setCellVoltages(voltage_min, voltage_max);
 
-    if(voltage_max > Config::OVER_CELL_VOLTAGE) {
-//TRANSITION(BC_ERROR);
-        ERROR("Over Cell voltage!");
-        DEBUG("voltage of %i mV is too high!", voltage_max);
-        issue.whatWentWrong |= TX::Issue::OVER_VOLTAGE_LOCKOUT;
+    lastCellMin = voltage_min;
+    lastCellMax = voltage_max;
+    lifetime.setCells(voltage_min, voltage_max);
+
+    checkFaults();
+}
+
+void BCStateMachine::setCellTemperatures(temperature_t temperature_min, temperature_t temperature_max) {
+    faults.setCellTemperatures(temperature_min, temperature_max);
+
+    lastTemperatureMin = temperature_min;
+    lastTemperatureMax = temperature_max;
+    lifetime.setTemperatures(temperature_min, temperature_max);
+
+    uint8_t speed = fans.setTemperature(temperature_max, current_time);
+    output.setFan1(speed);
+    output.setFan2(speed);
+}
+
+void BCStateMachine::setCellVoltages(const uint16_t cell_codes[Config::NUM_CMUs][12]) {
+    // Before the cell model seeds itself from voltages the checkpoint may replace
+    if(checkpoint.isPending()) {
+        switch(checkpoint.restore(cell_codes, lastCurrent, coulombs, cellModel)) {
+            case ChargeCheckpoint::WAITING:
+            case ChargeCheckpoint::NONE:
+                break;
+            case ChargeCheckpoint::RESTORED:
+                INFO("Charge restored from checkpoint %li s old: %li mAh", (long) checkpoint.getAge(),
+                        (long) coulombs.getCharge());
+                break;
+            case ChargeCheckpoint::TOO_OLD:
+                INFO("Charge checkpoint %li s old, using open circuit voltage", (long) checkpoint.getAge());
+                break;
+            case ChargeCheckpoint::CHANGED:
+                WARN("Pack voltage moved while off, charge checkpoint ignored!");
+                break;
+        }
+    }
+
+    timestamp_t timestamp = us_ticker_read();
+    cellModel.update(cell_codes, modelCurrent, timestamp);
+    resistance.update(cell_codes, modelCurrent, modelCurrentTime, timestamp);
+
+    if(coulombs.isAtRest())
+        cellModel.rest(cell_codes, modelCurrent, coulombs.getNetCharge());
+
+    histograms.addCells(cell_codes, timestamp);
+}
+
+void BCStateMachine::setCellTemperatureScan(const uint8_t temperatures[Config::NUM_CMUs][12]) {
+    histograms.addTemperatures(temperatures, us_ticker_read());
+}
+
+void BCStateMachine::getBalanceCells(uint16_t cells[Config::NUM_CMUs]) {
+    cellModel.getBalanceCells(cells);
+}
+
+uint32_t BCStateMachine::getCellModelCycles() {
+    return cellModel.getUpdateCycles();
+}
+
+void BCStateMachine::sendCellState(uint8_t cell) {
+    TX::CellState cs;
+    cs.cell = cell;
+    cs.soh = cellModel.getSOH(cell) / 10;
+    cs.soc = cellModel.getSOC(cell);
+    cs.capacity = cellModel.getCapacity(cell);
+    cs.remaining = cellModel.getRemaining(cell);
+    can.send(&cs);
+
+    TX::CellResistance cr;
+    cr.cell = cell;
+    cr.valid = resistance.isValid();
+    cr.resistance = resistance.getResistance(cell);
+    can.send(&cr);
+}
+
+void BCStateMachine::checkFaults() {
+    uint32_t active = faults.evaluate();
+    uint32_t raised = active & ~issue.whatWentWrong;
+
+    issue.whatWentWrong = (issue.whatWentWrong & ~FaultMonitor::MONITORED_FAULTS) | active;
+
+    if(raised)
+        WARN("Faults raised: %lX", (unsigned long) raised);
+
+    if(state == BC_ERROR)
+        return;
+
+    if(active & FaultMonitor::TRIP_FAULTS) {
+        TRANSITION(BC_ERROR);
+        ERROR("Protection limit exceeded: %lX", (unsigned long) (active & FaultMonitor::TRIP_FAULTS));
+        DEBUG("Current: %li mA", (long) lastCurrent);
         return;
     }
 
-    if(voltage_max > Config::MAX_CELL_VOLTAGE && (state == BC_RUN || state == BC_BALANCE)) {
+    if((active & TX::Issue::OVERVOLTAGE) && (state == BC_RUN || state == BC_BALANCE)) {
         DEBUG("Stop charging!");
         output.setChargeContactor(false); // Stop charging
         TRANSITION(BC_CHARGED);
     }
 
-    if(voltage_max < Config::CHARGE_CUTIN_CELL_VOLTAGE && state == BC_CHARGED) {
+    if(!(active & TX::Issue::OVERVOLTAGE) && state == BC_CHARGED) {
         DEBUG("Resume charging!");
         output.setChargeContactor(true); // Resume charging
         TRANSITION(BC_RUN);
     }
-
-    if(voltage_min < Config::UNDER_CELL_VOLTAGE) {
-//       TRANSITION(BC_ERROR);
-        ERROR("Under pack voltage!");
-       DEBUG("Under voltage: %i mV!", voltage_min);
-        issue.whatWentWrong |= TX::Issue::UNDER_VOLTAGE_LOCKOUT;
-        return;
-    }
-
-    if(voltage_min < Config::MIN_CELL_VOLTAGE && (state != BC_IDLE && state != BC_RUN)) {
-        issue.whatWentWrong |= TX::Issue::UNDERVOLTAGE;
-    } else {
-        issue.whatWentWrong &= ~TX::Issue::UNDERVOLTAGE;
-    }
 }
 
 
 void BCStateMachine::transition(State state) {
+    TRACE_SCOPE("sm.transition", state);
+
+    // Extremes up to the moment of the transition, then the transition itself
+    snapshotBlackBox();
+    blackBox.record(current_time, BlackBox::TRANSITION, this->state, state);
+
     switch(state) {
         case BC_ERROR:
         case BC_IDLE:
             output.shutdown();
+            // Committed as soon as the contactors have opened
+            saveLifetime(true);
+            saveCheckpoint(true);
+            histograms.save();
+            last_histogram_save = current_time;
             break;
         case BC_PRECHARGE:
+            // No flash operation may hold off interrupts once contactors start closing, so these
+            // wait out one already running
+            store.setWritable(false);
+            history.setWritable(false);
             output.setGndContactor(true);
             wait_ms(500);
             output.setPrechargeContactor(true);
+            precharge.start(us_ticker_read(), lastPackVoltage);
         default:
             break;
     }
@@ -7,6 +7,21 @@
 #include "Debug.hpp"
 #include "CANInterface.hpp"
 #include "BCCANPackets.hpp"
+#include "FaultMonitor.hpp"
+#include "PrechargeMonitor.hpp"
+#include "CurrentLimit.hpp"
+#include "CoulombCounter.hpp"
+#include "OCVTable.hpp"
+#include "SOCEstimator.hpp"
+#include "ResistanceEstimator.hpp"
+#include "Filters.hpp"
+#include "FanControl.hpp"
+#include "BlackBox.hpp"
+#include "FlashStore.hpp"
+#include "CellHistory.hpp"
+#include "LifetimeStats.hpp"
+#include "LifetimeHistograms.hpp"
+#include "ChargeCheckpoint.hpp"
 
 #include <mbed.h>
 
@@ -27,21 +42,27 @@ class BCStateMachine {
 
         /** Construct a new state machine.
          * @param cani CAN interface over which messages will be sent
+         * @param store Persistent store for lifetime totals and fault records
+         * @param history Cell history, stopped from writing flash before precharge as the store is
          */
-        BCStateMachine(CANInterface & cani);
+        BCStateMachine(CANInterface & cani, FlashStore & store, CellHistory & history);
 
         /** Update current pack charge/discharge current
-         * @param current Current current
+         * @param current Current current, raw - filtered here for the cell models and telemetry
+         * @param timestamp Time the current was measured in us
          */
-        void setCurrent(current_t current);
+        void setCurrent(current_t current, timestamp_t timestamp);
 
         /** Update current pack voltage - only required during precharge, comes from CMUs
          * @param voltage Current voltage
          */
         void setPackVoltage(voltage_t voltage);
 
-        /** Update current car voltage */
-        void setCarVoltage(voltage_t voltage);
+        /** Update current car voltage, raw - filtered here for telemetry
+         * @param voltage Car voltage
+         * @param timestamp Time the voltage was measured in us, which paces the precharge fit
+         */
+        void setCarVoltage(voltage_t voltage, timestamp_t timestamp);
 
         /** Update function, must be called regularly.
          *
@@ -49,6 +70,11 @@ class BCStateMachine {
          */
         void tick();
 
+        /** Over current comparator tripped: open every contactor immediately and latch the fault
+         *  for the next tick().  Safe to call from an interrupt handler.
+         */
+        void tripOverCurrent();
+
         /** Force a state transition.  Use with care! */
         void forceTransition(State state);
 
@@ -61,6 +87,30 @@ class BCStateMachine {
         /** Handle transitions that can be caused by CMU cell voltage */
 		void handleCellVoltage(voltage_t voltage_min, voltage_t voltage_max);
 
+        /** Update lowest and highest cell temperatures, checked on the next cell voltage update */
+        void setCellTemperatures(temperature_t temperature_min, temperature_t temperature_max);
+
+        /** Run the cell model on a full CMU scan, taken after the latest current sample.
+         * @param cell_codes Cell voltages in 1/10 mV
+         */
+        void setCellVoltages(const uint16_t cell_codes[Config::NUM_CMUs][12]);
+
+        /** Count a full CMU temperature scan into the lifetime histograms.
+         * @param temperatures CMUControl::temp_scaled
+         */
+        void setCellTemperatureScan(const uint8_t temperatures[Config::NUM_CMUs][12]);
+
+        /** Raise TX::Issue::ADC_STALL once current and car voltage fall back to single shot
+         *  readings, which hold up the loop and sample far slower. */
+        void setADCStalled();
+
+        /** Cell groups to discharge to balance the pack, from the cell model.
+         * @param[out] cells Bit mask of cells per CMU
+         */
+        void getBalanceCells(uint16_t cells[Config::NUM_CMUs]);
+
+        /** Core cycles taken by the last cell model update, see SOCEstimator::getUpdateCycles(). */
+        uint32_t getCellModelCycles();
 
 		private:
         /** Handle incoming CAN message
@@ -72,6 +122,33 @@ class BCStateMachine {
         void handleVoltage(voltage_t voltage, bool pack);
 
 
+        /** Send TX::CellState and TX::CellResistance for one cell group */
+        void sendCellState(uint8_t cell);
+
+        /** Evaluate protection limits and apply any resulting transitions */
+        void checkFaults();
+
+        /** Send the next events of a trace dump in progress */
+        void sendTrace();
+
+        /** Send the black box entries from before boot, after a start frame */
+        void sendBlackBox();
+
+        /** Record cell and current extremes into the black box */
+        void snapshotBlackBox();
+
+        /** Queue the lifetime totals for the store */
+        void saveLifetime(bool urgent);
+
+        /** Queue a charge checkpoint for the store */
+        void saveCheckpoint(bool urgent);
+
+        /** Queue a fault record for newly raised issue bits */
+        void saveFault(uint32_t raised);
+
+        /** Send the next frames of a store record being read back */
+        void sendStore();
+
         /** Transition to a new state and apply some entry/exit conditions */
         void transition(State state);
 
@@ -89,12 +166,67 @@ class BCStateMachine {
         time_t last_group2; // ms - slower CAN messages
 
         CANInterface & can;
+        FlashStore & store;
+        CellHistory & history;
 
+        // Raw samples, for protection and precharge
         voltage_t lastCarVoltage;
         voltage_t lastPackVoltage;
         current_t lastCurrent;
 
+        // Spike filtered current for the cell models, and the time of its latest sample
+        current_t modelCurrent;
+        timestamp_t modelCurrentTime; // us
+        Filters::Median<current_t, Config::SPIKE_FILTER_N> currentSpikes;
+
+        // Telemetry
+        Filters::Boxcar<current_t, int32_t, Config::CURRENT_DECIMATION> currentDecimator;
+        Filters::Median<voltage_t, Config::SPIKE_FILTER_N> carVoltageSpikes;
+        Filters::IIR<voltage_t, int32_t, Config::CAR_VOLTAGE_FILTER_SHIFT> carVoltageFilter;
+
+        // Limits stay at zero until the first CMU scans fill these in
+        voltage_t lastCellMin;
+        voltage_t lastCellMax;
+        temperature_t lastTemperatureMin;
+        temperature_t lastTemperatureMax;
+
+        // Set by tripOverCurrent(), handled in tick()
+        volatile bool overCurrentTripped;
+        // Cycles from entering tripOverCurrent() until the contactors were driven open.  Handler
+        // latency only: the GPIO interrupt dispatch in front of it isn't counted, as CON_ENABLE
+        // (P0.18) has no timer capture to timestamp the comparator edge with.
+        volatile uint32_t tripCycles;
+
+        uint16_t lastDropouts; // Contactor economizer drop-outs already warned about
+
+        uint8_t traceTarget; // RX::TraceRequest target of the trace dump in progress
+
+        uint32_t lastIssue; // Issue bits last recorded in the black box
+        time_t last_snapshot; // ms
+        bool blackBoxStarted; // Start of the boot dump sent
+
+        time_t last_lifetime_save; // ms
+        time_t last_histogram_save; // ms
+        time_t last_checkpoint; // ms
+
+        // Store record being read back over CAN
+        uint8_t storeData[Config::STORE_MAX_RECORD];
+        uint8_t storeKey;
+        uint8_t storeLength;
+        uint8_t storeOffset; // Of the next frame
+        bool storeSending;
+
         BCCANPackets::TX::Issue issue;
+        FaultMonitor faults;
+        PrechargeMonitor precharge;
+        CoulombCounter coulombs;
+        SOCEstimator cellModel;
+        ResistanceEstimator resistance;
+        FanControl fans;
+        BlackBox blackBox;
+        LifetimeStats lifetime;
+        LifetimeHistograms histograms;
+        ChargeCheckpoint checkpoint;
 		
 		char horn_flag;
 };
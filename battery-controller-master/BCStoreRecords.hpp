@@ -0,0 +1,88 @@
+#ifndef BC_STORE_RECORDS_HPP
+#define BC_STORE_RECORDS_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include <mbed.h>
+
+/** FlashStore keys and record layouts.
+ *
+ * A record is only read back at the length it was written, so a layout that changes size
+ * starts again from nothing rather than misreading old records.  Changing what a field means
+ * without changing the size needs a new key.
+ */
+namespace StoreRecords {
+    enum Key {
+        SHUNT_OFFSET = 0x01, // int32_t: Shunt zero offset in 1/16 ADC count
+        LIFETIME = 0x02, // Lifetime
+        CURRENT_TIME = 0x03, // uint32_t[Config::HISTOGRAM_CURRENT_BANDS]: s at each pack current band
+        CHARGE_STATE = 0x04, // ChargeState
+        CELL_CHARGE = 0x05, // CellCharge
+        CELL_VOLTAGE_TIME = 0x08, // uint32_t[TIME_CELLS][Config::HISTOGRAM_CELL_VOLTAGE_BANDS]: TIME_KEYS keys from here
+        CELL_TEMPERATURE_TIME = 0x10, // uint32_t[TIME_CELLS][Config::HISTOGRAM_TEMPERATURE_BANDS]: TIME_KEYS keys from here
+        FAULT = 0x20 // Fault: Config::STORE_FAULTS keys from here, by Fault::number
+    };
+
+    // Cell time records: s at each band of cells TIME_CELLS * (key - first key) onwards
+    constexpr uint8_t TIME_CELLS = 6;
+    constexpr uint8_t TIME_KEYS = Config::NUM_CMUs * 12 / TIME_CELLS;
+
+    static_assert(Config::NUM_CMUs * 12 % TIME_CELLS == 0, "Cell time records must split the cells evenly!");
+    static_assert(CELL_VOLTAGE_TIME + TIME_KEYS <= CELL_TEMPERATURE_TIME && CELL_TEMPERATURE_TIME + TIME_KEYS <= FAULT,
+            "Cell time records overlap!");
+    static_assert(FAULT + Config::STORE_FAULTS <= Config::STORE_KEYS, "Fault records overflow the store keys!");
+
+    /** Totals over the life of the pack.  Extremes start at the opposite limit. */
+    struct Lifetime {
+        uint32_t charged; // mAh
+        uint32_t discharged; // mAh
+        uint32_t energyIn; // Wh
+        uint32_t energyOut; // Wh
+        uint32_t contactorCloses[4]; // By BCOutputInterface::Contactor
+        uint32_t faults; // Fault records written
+        uint32_t boots;
+        uint32_t uptime; // s
+        voltage_t cellMin; // mV
+        voltage_t cellMax; // mV
+        temperature_t temperatureMin; // 1/10 C
+        temperature_t temperatureMax; // 1/10 C
+    };
+
+    /** Pack charge checkpoint, restored at boot rather than starting from a voltage that may
+     *  still be pulled down by load. */
+    struct ChargeState {
+        uint32_t sequence; // Of the checkpoint, matched by CellCharge
+        uint32_t time; // s: RTC when saved
+        int32_t charge; // mAh: CoulombCounter::getCharge()
+        voltage_t restVoltage; // mV: Pack voltage at the last rest, 0 before one
+        uint8_t atRest; // Still at that rest when saved
+    };
+
+    /** SOCEstimator state saved with a ChargeState. */
+    struct CellCharge {
+        uint32_t sequence; // ChargeState::sequence this goes with
+        int32_t sinceRest; // mAh: Net charge counted since the last rest
+        uint16_t soc[Config::NUM_CELLS_SERIES]; // 1/10 %
+        uint16_t capacity[Config::NUM_CELLS_SERIES]; // mAh
+        uint16_t restSoc[Config::NUM_CELLS_SERIES]; // 0-OCV::FULL: Open circuit SOC at the last rest
+        uint8_t haveRest;
+    };
+
+    static_assert(sizeof(CellCharge) <= Config::STORE_MAX_RECORD, "Cell charge record must fit in the store!");
+
+    /** Written when new TX::Issue bits are raised. */
+    struct Fault {
+        uint32_t number; // Lifetime::faults before this one
+        uint32_t boot; // Lifetime::boots
+        uint32_t time; // ms since boot
+        uint32_t issue; // TX::Issue bits
+        uint32_t raised; // Of those, the new ones
+        current_t current; // mA
+        voltage_t cellMin; // mV
+        voltage_t cellMax; // mV
+        temperature_t temperatureMax; // 1/10 C
+        uint8_t state; // BCStateMachine::State
+    };
+}
+
+#endif
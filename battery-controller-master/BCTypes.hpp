@@ -2,10 +2,22 @@
 #define BC_TYPES_HPP
 
 #include <mbed.h>
+#include "hal/us_ticker_api.h" // timestamp_t - time in us from us_ticker_read(), wraps every ~71 minutes
 
 typedef int32_t current_t; // Current in mA - positive for charge, negative for discharge
 typedef int32_t voltage_t; // Voltages in mV
 
 typedef uint16_t temperature_t; // Temperatures in 1/10 degree Celsius
 
+namespace Log {
+    /** Log verbosity of a module, each level including those before it. */
+    enum Level { LEVEL_NONE, LEVEL_ERROR, LEVEL_WARN, LEVEL_INFO, LEVEL_DEBUG };
+
+    /** What console output does when the TX buffer is full. */
+    enum Overflow {
+        OVERFLOW_DROP, // Lose the character
+        OVERFLOW_BLOCK // Wait for room, except in an interrupt handler or critical section, which drop
+    };
+}
+
 #endif
@@ -4,15 +4,18 @@
 #include "Debug.hpp"
 #include "BCConfig.hpp"
 #include "BCCANPackets.hpp"
+#include "Trace.hpp"
 
 #include <limits.h>
 
+constexpr Log::Level LOG_LEVEL = Config::LOG_LEVEL_CONTROLLER;
+
 BatteryController::BatteryController() :
     can(PinDefs::CAN_RX, PinDefs::CAN_TX, PinDefs::CAN_RS, Config::CAN_TX_BASE),
-    stateMachine(can),
-    input(Callback<void(current_t)>(&stateMachine, &BCStateMachine::setCurrent),
-            Callback<void(voltage_t)>(&stateMachine, &BCStateMachine::setCarVoltage)),
-    cmu_send_counter(0), averagedPackVoltage(-1)
+    stateMachine(can, store, history),
+    input(Callback<void(current_t, timestamp_t)>(&stateMachine, &BCStateMachine::setCurrent),
+            Callback<void(voltage_t, timestamp_t)>(&stateMachine, &BCStateMachine::setCarVoltage), store),
+    cmu_send_counter(0)
 	{
         can.frequency(500000);
 
@@ -24,13 +27,35 @@ BatteryController::BatteryController() :
 		CAN2_wrFilter (Config::CAN_RX_BASE + BCCANPackets::RX::Heartbeat::ID);
 		CAN2_wrFilter (Config::CAN_RX_BASE + BCCANPackets::RX::StateChange::ID);
 		CAN2_wrFilter (Config::CAN_RX_BASE + BCCANPackets::RX::HMIStatus::ID);
+		CAN2_wrFilter (Config::CAN_RX_BASE + BCCANPackets::RX::CellStateRequest::ID);
+		CAN2_wrFilter (Config::CAN_RX_BASE + BCCANPackets::RX::TraceRequest::ID);
+		CAN2_wrFilter (Config::CAN_RX_BASE + BCCANPackets::RX::StoreRequest::ID);
 	}
 
 void BatteryController::run() {
+    if(history.isReadOnly() || store.isReadOnly())
+        ERROR("Program image ends at %lX, into the flash kept for history and store! Both left read-only",
+                (unsigned long) IAP::imageEnd());
+
     while(true) {
+        TRACE_BEGIN("run.tick");
         stateMachine.tick();
+        TRACE_END("run.tick");
+
+        TRACE_BEGIN("run.input");
+        bool open = stateMachine.output.allOpen();
+        input.setIdle(open);
+        store.setWritable(open);
+        history.setWritable(open);
         input.trigger();
+        if(input.isStalled())
+            stateMachine.setADCStalled();
+        TRACE_END("run.input");
+
+        TRACE_BEGIN("run.cells");
         updatePackVoltage();
+        TRACE_END("run.cells");
+
         Thread::wait(5);
     }
 }
@@ -55,10 +80,15 @@ void BatteryController::updatePackVoltage() {
 
 
     if(cmu_send_counter >= 200) {
-		cmu.doCellBalance();
+        uint16_t balance[Config::NUM_CMUs];
+        stateMachine.getBalanceCells(balance);
+		cmu.doCellBalance(balance);
         cmu.doCellConversion();
         cmu.doTempConversion();
         cmu_send_counter = 0;
+
+        temperature_t tmin = UINT16_MAX;
+        temperature_t tmax = 0;
         for(int cmuc=0; cmuc < Config::NUM_CMUs; ++cmuc) {
             DEBUG_ARRAY("CMU voltages", "%hu", cmu.cell_codes[cmuc], 12);
             for(int cell=0; cell < 12; cell += 2) { //*# Starts the count at 0 and goes 11. Hence 12 battery packs are being read. 
@@ -68,6 +98,13 @@ void BatteryController::updatePackVoltage() {
                     canmsg.cell_voltage[i] = voltage;
                     packVoltage += voltage;
 					canmsg.cell_temperature[i] = cmu.temp_scaled[cmuc][cell + i];
+
+                    // 255 is returned below the thermistor table, i.e. colder than 0 C
+                    temperature_t temperature = canmsg.cell_temperature[i] == 255 ? 0 : canmsg.cell_temperature[i] * 10;
+                    if(temperature < tmin)
+                        tmin = temperature;
+                    if(temperature > tmax)
+                        tmax = temperature;
 					
                     if(voltage < vmin) {
                         vmini = i + cell + cmuc * Config::NUM_CMUs;
@@ -81,7 +118,22 @@ void BatteryController::updatePackVoltage() {
                 can.send(&canmsg);
             }
         }
-        DEBUG("Min, max, average: %i, %i, %.0f", vmin, vmax, packVoltage / (12.0f * Config::NUM_CMUs));
+        DEBUG("Min, max, average: %i, %i, %li", vmin, vmax, (long) (packVoltage / (12 * Config::NUM_CMUs)));
+
+        BCCANPackets::TX::ShuntCalibration shunt;
+        shunt.offset = input.getShuntOffset();
+        shunt.noise = input.getShuntNoise();
+        shunt.drift = input.getShuntDrift();
+        shunt.samples = input.getShuntSamples();
+        shunt.status = input.getShuntStatus();
+        can.send(&shunt);
+        stateMachine.setCellTemperatures(tmin, tmax);
+        stateMachine.setCellTemperatureScan(cmu.temp_scaled);
+
+        DEBUG("History: %lu cycles per scan, %lu bytes from %lu", (unsigned long) history.getEncodeCycles(),
+                (unsigned long) history.getEncodedBytes(), (unsigned long) history.getRawBytes());
+        DEBUG("Cell model update: %lu cycles, current scaling: %lu cycles a sample",
+                (unsigned long) stateMachine.getCellModelCycles(), (unsigned long) input.getScaleCycles());
     } else {
         cmu.doCellConversion();
 		for(int cmuc=0; cmuc < Config::NUM_CMUs; ++cmuc) {
@@ -112,18 +164,12 @@ void BatteryController::updatePackVoltage() {
 */
 
 	stateMachine.handleCellVoltage(vmin,vmax);
+    stateMachine.setCellVoltages(cmu.cell_codes);
+    history.add(cmu.cell_codes, cmu.temp_scaled);
 
     ++cmu_send_counter;
 
 
-// Loading initial pack voltage value for the first time.
-	if(averagedPackVoltage < 0) {
-        stateMachine.setPackVoltage(packVoltage);
-        return;
-    } else {
-        averagedPackVoltage -= averagedPackVoltage / Config::PACK_VOLTAGE_AVERAGE_N;
-        averagedPackVoltage += 1.0f * packVoltage / Config::PACK_VOLTAGE_AVERAGE_N;
-    }
-
-    stateMachine.setPackVoltage(averagedPackVoltage);
+    // The first scan initialises the filter, so there is no ramp up from zero
+    stateMachine.setPackVoltage(packVoltageFilter.add(packVoltageSpikes.add(packVoltage)));
 }
@@ -6,6 +6,9 @@
 #include "CMUControl.hpp"
 #include "CANInterface.hpp"
 #include "canfilter.h"
+#include "Filters.hpp"
+#include "FlashStore.hpp"
+#include "CellHistory.hpp"
 
 class BatteryController {
     public:
@@ -13,6 +16,8 @@ class BatteryController {
 
         void run();
 
+        FlashStore store; // First, as the others load from it
+        CellHistory history;
         CANInterface can;
         BCStateMachine stateMachine; //#*Object of BCStateMachine and is called stateMachine. 
         BCInputInterface input; //#*Object of BCInputInterface and is named input.
@@ -22,7 +27,8 @@ class BatteryController {
         void updatePackVoltage();
         uint8_t cmu_send_counter;
 
-        float averagedPackVoltage;
+        Filters::Median<voltage_t, Config::SPIKE_FILTER_N> packVoltageSpikes;
+        Filters::IIR<voltage_t, int32_t, Config::PACK_VOLTAGE_FILTER_SHIFT> packVoltageFilter;
 };
 
 #endif
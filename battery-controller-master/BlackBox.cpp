@@ -0,0 +1,135 @@
+#include "BlackBox.hpp"
+#include <limits.h>
+
+namespace {
+    static_assert((Config::BLACK_BOX_SIZE & (Config::BLACK_BOX_SIZE - 1)) == 0,
+            "Black box size must be a power of two!");
+
+    // Kept through resets other than power on, as the startup code doesn't touch AHB SRAM
+    BlackBox::Entry entries[Config::BLACK_BOX_SIZE] __attribute__((section("AHBSRAM1")));
+
+    BlackBox::Entry & slot(uint32_t sequence) {
+        return entries[sequence & (Config::BLACK_BOX_SIZE - 1)];
+    }
+}
+
+BlackBox::BlackBox() : sequence(0), boot(0), reset_cause(LPC_SC->RSID),
+    dump_size(0), corrupt(0), dump_next(0), dump_end(0),
+    current_min(INT_MAX), current_max(INT_MIN) {
+    // Bits are cleared by writing ones, so the next boot sees only its own cause
+    LPC_SC->RSID = reset_cause;
+
+    // Nothing survives power on, so start from an empty ring rather than trust random checksums
+    if(reset_cause & RESET_POWER_ON) {
+        for(uint32_t i = 0; i < Config::BLACK_BOX_SIZE; ++i)
+            entries[i].check = EMPTY;
+    }
+
+    // The newest valid entry gives the sequence and boot count to carry on from
+    bool found = false;
+    uint32_t newest = 0;
+    for(uint32_t i = 0; i < Config::BLACK_BOX_SIZE; ++i) {
+        if(entries[i].check == EMPTY)
+            continue;
+        if(entries[i].check != checksum(entries[i])) {
+            ++corrupt;
+            continue;
+        }
+        if(!found || (int32_t) (entries[i].sequence - newest) > 0) {
+            newest = entries[i].sequence;
+            boot = entries[i].boot + 1;
+            found = true;
+        }
+    }
+
+    if(found)
+        sequence = newest + 1;
+
+    // Only entries from the last pass round the ring belong in the dump, less the oldest, which
+    // this boot's entry is about to overwrite
+    dump_next = sequence - Config::BLACK_BOX_SIZE + 1;
+    for(uint32_t s = dump_next; s != sequence; ++s)
+        if(isValid(s))
+            ++dump_size;
+
+    record(0, BOOT, reset_cause, dump_size);
+    ++dump_size;
+    dump_end = sequence;
+}
+
+void BlackBox::record(time_t time, Kind kind, int32_t a, int32_t b) {
+    Entry & entry = slot(sequence);
+
+    // Emptied first, so a reset part way through leaves no entry rather than a wrong one
+    entry.check = EMPTY;
+    __DMB();
+    entry.time = time;
+    entry.sequence = sequence;
+    entry.kind = kind;
+    entry.boot = boot;
+    entry.a = a;
+    entry.b = b;
+    __DMB();
+    entry.check = checksum(entry);
+
+    ++sequence;
+}
+
+void BlackBox::snapshot(time_t time, voltage_t cell_min, voltage_t cell_max,
+        temperature_t temperature_min, temperature_t temperature_max) {
+    record(time, CELLS, (cell_max << 16) | (cell_min & 0xFFFF),
+            ((int32_t) temperature_max << 16) | temperature_min);
+
+    if(current_min <= current_max)
+        record(time, CURRENT, current_min, current_max);
+
+    current_min = INT_MAX;
+    current_max = INT_MIN;
+}
+
+bool BlackBox::nextDump(Entry & entry) {
+    while(dump_next != dump_end) {
+        // Entries recorded since boot have overwritten the oldest, which are sent first
+        uint32_t s = dump_next++;
+        if(isValid(s)) {
+            entry = slot(s);
+            return true;
+        }
+    }
+    return false;
+}
+
+uint16_t BlackBox::getDumpSize() {
+    return dump_size;
+}
+
+uint16_t BlackBox::getCorrupt() {
+    return corrupt;
+}
+
+uint8_t BlackBox::getBoot() {
+    return boot;
+}
+
+uint8_t BlackBox::getResetCause() {
+    return reset_cause;
+}
+
+bool BlackBox::isValid(uint32_t sequence) {
+    const Entry & entry = slot(sequence);
+    return entry.check != EMPTY && entry.sequence == sequence && entry.check == checksum(entry);
+}
+
+uint16_t BlackBox::checksum(const Entry & entry) {
+    // Everything but the checksum itself.  Both sums stay below 255, so never EMPTY.
+    const uint8_t * bytes = (const uint8_t *) &entry;
+    uint16_t sum1 = 0xFF;
+    uint16_t sum2 = 0xFF;
+    for(uint8_t i = 0; i < sizeof(Entry); ++i) {
+        if(i == offsetof(Entry, check) || i == offsetof(Entry, check) + 1)
+            continue;
+        sum1 = (sum1 + bytes[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return sum2 << 8 | sum1;
+}
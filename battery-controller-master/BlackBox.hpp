@@ -0,0 +1,103 @@
+#ifndef BLACK_BOX_HPP
+#define BLACK_BOX_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include <mbed.h>
+
+/** Record of the lead-up to a fault that survives a reset.
+ *
+ * Entries go into a ring in AHB SRAM bank 1, which the startup code neither loads nor zeroes,
+ * so it keeps its contents through watchdog, external and brown-out resets.  Each entry holds
+ * a sequence number and a Fletcher-16 checksum: at boot the ring is rebuilt from the entries
+ * that still check out, so an entry torn by a reset or RAM corrupted by a brown-out is
+ * skipped.  A power-on reset empties the ring.  The entries found at boot are then handed out
+ * oldest first by nextDump().
+ *
+ * Recording is for one thread.  State transitions and issue changes are recorded as they
+ * happen; cell and current extremes only at snapshots, so the per-sample cost is addCurrent()'s
+ * two compares.
+ */
+class BlackBox {
+    public:
+        enum Kind {
+            BOOT, // a: LPC_SC->RSID reset cause bits, b: entries found at boot
+            TRANSITION, // a: from BCStateMachine::State, b: to
+            ISSUE, // a: TX::Issue bits before, b: after
+            CELLS, // a: max << 16 | min cell voltage in mV, b: max << 16 | min temperature in 1/10 C
+            CURRENT // a: min current in mA since the last snapshot, b: max
+        };
+
+        struct Entry {
+            uint32_t time; // ms since boot
+            uint32_t sequence;
+            uint8_t kind;
+            uint8_t boot; // Boot count, wrapping
+            uint16_t check; // Fletcher-16 of the rest
+            int32_t a;
+            int32_t b;
+        };
+
+        /** Recover the entries left from before the reset and record this boot. */
+        BlackBox();
+
+        /** Record an entry.
+         * @param time Time since boot in ms.
+         */
+        void record(time_t time, Kind kind, int32_t a, int32_t b);
+
+        /** Track the current extremes for the next snapshot. */
+        void addCurrent(current_t current) {
+            if(current < current_min)
+                current_min = current;
+            if(current > current_max)
+                current_max = current;
+        }
+
+        /** Record the cell extremes and the current extremes since the last snapshot.
+         * @param time Time since boot in ms.
+         */
+        void snapshot(time_t time, voltage_t cell_min, voltage_t cell_max,
+                temperature_t temperature_min, temperature_t temperature_max);
+
+        /** Take the next entry found at boot, oldest first.
+         * @return False once every entry has been taken.
+         */
+        bool nextDump(Entry & entry);
+
+        /** Entries found at boot, including this boot's.  Fewer are dumped if entries recorded
+         *  since boot overwrite them first. */
+        uint16_t getDumpSize();
+
+        /** Entries that failed their checksum at boot. */
+        uint16_t getCorrupt();
+
+        /** Boot count, wrapping. */
+        uint8_t getBoot();
+
+        /** LPC_SC->RSID reset cause bits of this boot. */
+        uint8_t getResetCause();
+
+    private:
+        static constexpr uint16_t EMPTY = 0xFFFF; // Check of an entry not (fully) written
+        static constexpr uint32_t RESET_POWER_ON = 1 << 0; // LPC_SC->RSID POR
+
+        /** True if the slot for a sequence number holds that entry, intact. */
+        static bool isValid(uint32_t sequence);
+
+        static uint16_t checksum(const Entry & entry);
+
+        uint32_t sequence; // Of the next entry
+        uint8_t boot;
+        uint8_t reset_cause;
+
+        uint16_t dump_size;
+        uint16_t corrupt;
+        uint32_t dump_next; // Sequence
+        uint32_t dump_end;
+
+        current_t current_min;
+        current_t current_max;
+};
+
+#endif
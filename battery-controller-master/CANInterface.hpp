@@ -4,15 +4,19 @@
 #include <mbed.h>
 #include "Debug.hpp"
 #include "IOTemplates.hpp"
+#include "Trace.hpp"
 
 class CANInterface : public CAN {
     public:
+        static constexpr Log::Level LOG_LEVEL = Config::LOG_LEVEL_CAN;
+
         CANInterface(PinName rd, PinName td, PinName rs, unsigned int can_tx_base = 0) : CAN(rd, td), CAN_TX_BASE(can_tx_base), rsp(rs) {
             rsp = 0;
         }
 
         template<typename MsgType>
             void send(const MsgType * msg) {
+                TRACE_SCOPE("can.send", MsgType::ID);
                 CANMessage outgoing(CAN_TX_BASE + MsgType::ID, (char*) msg, sizeof(MsgType));
 
                 for(int i=0; i<4; ++i) {
@@ -31,7 +35,7 @@ class CANInterface : public CAN {
                 if(msg->len == sizeof(MsgType))
                     return (MsgType *)msg->data;
 
-                DEBUG_CAN("Incorrect CAN packet length!", &msg);
+                DEBUG_CAN("Incorrect CAN packet length!", *msg);
                 return NULL;
             }
     private:
@@ -1,6 +1,9 @@
 #include "CMUControl.hpp"
 #include "CRC15.hpp"
 #include "Debug.hpp"
+#include "Trace.hpp"
+
+constexpr Log::Level LOG_LEVEL = Config::LOG_LEVEL_CMU;
 
 using namespace IOTemplates;
 using namespace CMUConstants;
@@ -39,6 +42,7 @@ CMUControl::CMUControl() : spi(PinDefs::CMU_SPI_MOSI, PinDefs::CMU_SPI_MISO, Pin
 }
 
 void CMUControl::doCellConversion() {
+    TRACE_SCOPE("cmu.doCellConversion");
     wakeup_sleep();
     adcv();
     wait_ms(7);
@@ -48,6 +52,7 @@ void CMUControl::doCellConversion() {
 }
 
 void CMUControl::doTempConversion() {
+    TRACE_SCOPE("cmu.doTempConversion");
 //    return;
     DEBUG("Temperature conversion!");
 	for(uint8_t i=0; i<6; ++i) { 	//i is channel number of MUX. Actual cell number need add +1
@@ -93,6 +98,7 @@ uint8_t CMUControl::TempScaling(uint16_t v_reading) {
 
 
 void CMUControl::wrcfg(uint8_t config[][6]) {
+    TRACE_SCOPE("cmu.wrcfg");
     const uint8_t BYTES_IN_REG = 6;
     const uint8_t CMD_LEN = 4+(8*NUM_CMUs);
     uint8_t *cmd;
@@ -162,6 +168,7 @@ void CMUControl::set_adc(uint8_t MD, uint8_t DCP, uint8_t CH, uint8_t CHG) {
  * 4. send broadcast adcv command to LTC6804 daisy chain
  */
 void CMUControl::adcv() {
+    TRACE_SCOPE("cmu.adcv");
     uint8_t cmd[4];
     uint16_t cmd_pec;
 
@@ -186,10 +193,11 @@ void CMUControl::adcv() {
 
 }
 
-void CMUControl::doCellBalance() {
+void CMUControl::doCellBalance(const uint16_t cells[Config::NUM_CMUs]) {
+    TRACE_SCOPE("cmu.doCellBalance");
 	uint16_t balance_command;
     for(int cmuc=0; cmuc < Config::NUM_CMUs; ++cmuc) {
-		balance_command = 0;
+		balance_command = cells[cmuc];
         for(int cell=0; cell < 12; cell++) {
 			if(cell_codes[cmuc][cell]/10 > Config::CELL_BALANCE_VOLTAGE){
 				balance_command |= (1 << cell);
@@ -219,6 +227,7 @@ void CMUControl::doCellBalance() {
  * 4. Send broadcast adax command to LTC6804 daisy chain
  */
 void CMUControl::adax() {
+    TRACE_SCOPE("cmu.adax");
     uint8_t cmd[4];
     uint16_t cmd_pec;
 
@@ -250,6 +259,7 @@ void CMUControl::adax() {
  * 2. Return pec_error flag
  */
 int8_t CMUControl::rdcv(uint8_t reg) {
+    TRACE_SCOPE("cmu.rdcv", reg);
     const uint8_t NUM_RX_BYT = 8;
     const uint8_t BYT_IN_REG = 6;
     const uint8_t CELL_IN_REG = 3;
@@ -388,6 +398,7 @@ void CMUControl::rdcv_reg(uint8_t reg, uint8_t *data) {
    2. Return pec_error flag
    */
 int8_t CMUControl::rdaux(uint8_t reg, uint16_t aux_codes[][6]) {
+    TRACE_SCOPE("cmu.rdaux", reg);
     const uint8_t NUM_RX_BYT = 8;
     const uint8_t BYT_IN_REG = 6;
     const uint8_t GPIO_IN_REG = 3;
@@ -512,6 +523,7 @@ void CMUControl::rdaux_reg(uint8_t reg, uint8_t *data) {
 }
 
 void CMUControl::adc_mux(uint8_t channel) {
+    TRACE_SCOPE("cmu.adc_mux", channel);
 	///this "channel is output port number of MUX IC (6 chanels for 0 to 5)
     uint8_t com_codes[NUM_CMUs][6];
 	for(int cmuc=0; cmuc < Config::NUM_CMUs; ++cmuc) {
@@ -532,6 +544,7 @@ void CMUControl::adc_mux(uint8_t channel) {
 }
 
 void CMUControl::wrcom(uint8_t config[][6]) {
+    TRACE_SCOPE("cmu.wrcom");
     constexpr uint8_t BYTES_IN_REG = 6;
     constexpr uint8_t CMD_LEN = 4+(8*NUM_CMUs);
     uint8_t cmd[CMD_LEN];
@@ -577,6 +590,7 @@ void CMUControl::wrcom(uint8_t config[][6]) {
 }
 
 void CMUControl::excom() {
+    TRACE_SCOPE("cmu.excom");
     uint8_t cmd[4];
     uint16_t cmd_pec;
     int loop;
@@ -608,6 +622,7 @@ void CMUControl::excom() {
 
 
 void CMUControl::wakeup_sleep() {
+    TRACE_SCOPE("cmu.wakeup_sleep");
     clearCS();
     wait_us(300); // Guarantees the LTC6804 won't be sleeping
     setCS();
@@ -94,7 +94,10 @@ class CMUControl {
 
         void doCellConversion();
         void doTempConversion();
-        void doCellBalance();
+        /** Discharge cells above Config::CELL_BALANCE_VOLTAGE, plus any others requested.
+         * @param cells Bit mask per CMU of further cells to discharge
+         */
+        void doCellBalance(const uint16_t cells[Config::NUM_CMUs]);
 		uint8_t TempScaling(uint16_t v_reading);
 		
         /** Cell voltages in 1/10 mV **/
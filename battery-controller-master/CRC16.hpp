@@ -0,0 +1,23 @@
+#ifndef CRC16_HPP
+#define CRC16_HPP
+
+#include <mbed.h>
+
+/** CRC-16-CCITT (polynomial 0x1021), bitwise, for records checked at boot or when written
+ *  rather than on every message. */
+namespace CRC16 {
+    constexpr uint16_t INIT = 0xFFFF;
+
+    /** Continue a CRC over more bytes. */
+    inline uint16_t update(uint16_t crc, const void * data, uint32_t length) {
+        const uint8_t * bytes = (const uint8_t *) data;
+        for(uint32_t i = 0; i < length; ++i) {
+            crc ^= bytes[i] << 8;
+            for(uint8_t bit = 0; bit < 8; ++bit)
+                crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+        return crc;
+    }
+}
+
+#endif
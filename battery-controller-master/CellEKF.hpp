@@ -0,0 +1,196 @@
+#ifndef CELL_EKF_HPP
+#define CELL_EKF_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include "OCVTable.hpp"
+#include "FixedPoint.hpp"
+#include <mbed.h>
+
+/** Extended Kalman filter for the state of charge of one parallel cell group.
+ *
+ * Equivalent circuit model: open circuit voltage (OCV::TABLE) in series with an ohmic resistance
+ * and one RC pair.  The state is SOC (%) and the RC voltage (mV); the measurement is the cell
+ * terminal voltage,
+ *
+ *   V = OCV(SOC) + R0 * I + V1
+ *
+ * Prediction integrates current exactly as the coulomb counter does, so the voltage correction
+ * pulls SOC back whenever counting drifts (e.g. from a current sensor offset).
+ *
+ * Templated on the number type so the same code runs as fixed point on target and as float on a
+ * host for reference.  Units are chosen so every quantity stays within +/-32768 at 1/65536
+ * resolution, which fits Fixed<16>: SOC in %, voltage in mV, covariances in %^2 and mV^2.
+ */
+template<typename T>
+class CellEKF {
+    public:
+        CellEKF() :
+            initialised(false),
+            charge_per_percent(Config::PACK_CAPACITY * 36000000LL),
+            soc(0), v1(0), p00(0), p01(0), p11(0) {}
+
+        /** True once the filter has been seeded from a voltage. */
+        bool isInitialised() {
+            return initialised;
+        }
+
+        /** Seed the state from the open circuit voltage.
+         * @param cell_code Cell voltage in 1/10 mV.
+         * @param current Pack current in mA, used to compensate for cell resistance.
+         */
+        void reset(uint16_t cell_code, current_t current) {
+            voltage_t voltage = cell_code / 10
+                - current * Config::CELL_RESISTANCE / (Config::NUM_CELLS_PARALLEL * 1000);
+
+            soc = N::ratio((int32_t) OCV::cellSOC(voltage) * 100, OCV::FULL);
+            v1 = 0;
+            p00 = N::ratio(INITIAL_SOC_VARIANCE, 1);
+            p01 = 0;
+            p11 = N::ratio(INITIAL_V1_VARIANCE, 1);
+            initialised = true;
+        }
+
+        /** Seed the state from a known state of charge, e.g. a checkpoint restored at boot.
+         * @param soc State of charge in 1/10 %.
+         */
+        void seed(uint16_t soc) {
+            this->soc = N::ratio(soc, 10);
+            v1 = 0;
+            p00 = N::ratio(SEEDED_SOC_VARIANCE, 1);
+            p01 = 0;
+            p11 = N::ratio(INITIAL_V1_VARIANCE, 1);
+            initialised = true;
+        }
+
+        /** Set the capacity of the cell group, e.g. as it fades with age.
+         * @param capacity Capacity in mAh.
+         */
+        void setCapacity(int32_t capacity) {
+            charge_per_percent = capacity * 36000000LL;
+        }
+
+        /** Advance the model by one time step and correct it against a voltage measurement.
+         * @param current Pack current in mA, positive for charge, taken at the time of the measurement.
+         * @param dt Time since the last update in us.
+         * @param cell_code Measured cell voltage in 1/10 mV.
+         */
+        void update(current_t current, uint32_t dt, uint16_t cell_code) {
+            predict(current, dt);
+            correct(current, cell_code);
+        }
+
+        /** Advance the model without a measurement, e.g. when a reading failed.
+         * @param current Pack current in mA.
+         * @param dt Time step in us, must be well below Config::CELL_TIME_CONSTANT.
+         */
+        void predict(current_t current, uint32_t dt) {
+            int64_t charge = (int64_t) current * dt; // mA us
+            T decay = N::ratio(dt, TIME_CONSTANT); // 1 - exp(-dt / tau) for dt << tau
+            T a = T(1) - decay;
+
+            // Current shares equally between the parallel cells
+            soc += N::ratio(charge, charge_per_percent);
+            v1 = v1 - v1 * decay
+                + N::ratio(charge * R1, TIME_CONSTANT * Config::NUM_CELLS_PARALLEL * 1000LL);
+
+            // P = F P F' + Q, F = diag(1, a)
+            p00 += N::ratio((int64_t) SOC_PROCESS_NOISE * dt, 1000000LL * PROCESS_NOISE_SCALE);
+            p01 = a * p01;
+            p11 = a * a * p11 + N::ratio((int64_t) V1_PROCESS_NOISE * dt, 1000000LL * PROCESS_NOISE_SCALE);
+
+            // Without corrections the variance would grow without bound
+            if(p00 > T(INITIAL_SOC_VARIANCE))
+                p00 = INITIAL_SOC_VARIANCE;
+        }
+
+        /** State of charge in 1/10 %, clamped to 0-1000. */
+        uint16_t getSOC() {
+            return N::round(soc * T(10));
+        }
+
+        /** Voltage across the RC pair in mV. */
+        int32_t getPolarisation() {
+            return N::round(v1);
+        }
+
+        /** Variance of the SOC estimate in %^2. */
+        T getSOCVariance() {
+            return p00;
+        }
+
+    private:
+        typedef Scalar<T> N;
+
+        static constexpr int64_t TIME_CONSTANT = Config::CELL_TIME_CONSTANT * 1000LL; // us
+        static constexpr int32_t R0 = Config::CELL_OHMIC_RESISTANCE; // mOhm
+        static constexpr int32_t R1 = Config::CELL_RESISTANCE - Config::CELL_OHMIC_RESISTANCE; // mOhm
+
+        static constexpr int32_t INITIAL_SOC_VARIANCE = 25; // %^2
+        static constexpr int32_t INITIAL_V1_VARIANCE = 25; // mV^2
+        static constexpr int32_t SEEDED_SOC_VARIANCE = 1; // %^2: Counted charge is trusted over the voltage
+        static constexpr int32_t MEASUREMENT_NOISE = 100; // mV^2: Reading noise plus model error
+
+        // Process noise per second, scaled by PROCESS_NOISE_SCALE
+        static constexpr int32_t PROCESS_NOISE_SCALE = 1000;
+        static constexpr int32_t SOC_PROCESS_NOISE = 4; // %^2
+        static constexpr int32_t V1_PROCESS_NOISE = 1000; // mV^2
+
+        // OCV slope in mV/% is clamped so the innovation variance can't overflow at the steep
+        // ends of the curve
+        static constexpr int32_t MIN_SLOPE = 1; // mV/%
+        static constexpr int32_t MAX_SLOPE = 20; // mV/%
+
+        /** Measurement update. */
+        void correct(current_t current, uint16_t cell_code) {
+            // Scaled in two steps, FULL itself is out of range for Fixed<16>
+            uint16_t table_soc = clamp(N::round(soc * N::ratio(OCV::FULL, 400)) * 4, 0, OCV::FULL);
+
+            int32_t slope;
+            voltage_t ocv = OCV::cellVoltage(table_soc, &slope);
+            T h0 = N::ratio(clamp(slope, MIN_SLOPE * 100, MAX_SLOPE * 100), 100); // dV/dSOC
+
+            T predicted = T(ocv) + v1
+                + N::ratio((int64_t) current * R0, Config::NUM_CELLS_PARALLEL * 1000);
+            T innovation = N::ratio(cell_code, 10) - predicted;
+
+            // H = [h0 1], S = H P H' + R, K = P H' / S
+            T ph0 = p00 * h0 + p01;
+            T ph1 = p01 * h0 + p11;
+            T s = h0 * ph0 + ph1 + N::ratio(MEASUREMENT_NOISE, 1);
+            T k0 = ph0 / s;
+            T k1 = ph1 / s;
+
+            soc += k0 * innovation;
+            v1 += k1 * innovation;
+
+            // P = (I - K H) P
+            p00 -= k0 * ph0;
+            p01 -= k0 * ph1;
+            p11 -= k1 * ph1;
+
+            // Rounding must not leave a negative variance
+            if(p00 < T(0))
+                p00 = 0;
+            if(p11 < T(0))
+                p11 = 0;
+
+            if(soc < T(0))
+                soc = 0;
+            if(soc > T(100))
+                soc = 100;
+        }
+
+        static int32_t clamp(int32_t value, int32_t min, int32_t max) {
+            return value < min ? min : value > max ? max : value;
+        }
+
+        bool initialised;
+        int64_t charge_per_percent; // mA us
+
+        T soc; // %
+        T v1; // mV
+        T p00, p01, p11; // Covariance, symmetric
+};
+
+#endif
@@ -0,0 +1,337 @@
+#include "CellHistory.hpp"
+#include "CRC16.hpp"
+#include "CycleCounter.hpp"
+#include "hal/us_ticker_api.h"
+#include <string.h>
+
+namespace {
+    static_assert(Config::HISTORY_FIRST_SECTOR >= 16
+            && Config::HISTORY_FIRST_SECTOR + Config::HISTORY_SECTORS <= Config::STORE_FIRST_SECTOR,
+            "History must be in the 32 KB flash sectors below the store!");
+
+    constexpr uint32_t SECTOR_SIZE = IAP::sectorSize(Config::HISTORY_FIRST_SECTOR);
+    constexpr uint32_t BLOCK_WORDS = Config::HISTORY_BLOCK / 4;
+
+    // Not loaded or zeroed by the startup code, so only trusted once filled
+    uint32_t blocks[Config::HISTORY_RAM_BLOCKS][BLOCK_WORDS] __attribute__((section("AHBSRAM0")));
+
+    CellHistory::BlockHeader & header(uint8_t block) {
+        return *(CellHistory::BlockHeader *) blocks[block];
+    }
+
+    uint8_t * data(uint8_t block) {
+        return (uint8_t *) blocks[block] + sizeof(CellHistory::BlockHeader);
+    }
+
+    uint8_t * putVarint(uint8_t * out, uint32_t value) {
+        while(value >= 0x80) {
+            *out++ = value | 0x80;
+            value >>= 7;
+        }
+        *out++ = value;
+        return out;
+    }
+
+    /** Small magnitudes of either sign to small unsigned values: 0, -1, 1, -2... to 0, 1, 2, 3... */
+    uint32_t zigzag(int32_t value) {
+        return (value << 1) ^ (value >> 31);
+    }
+
+    /** Zig-zag values packed at the width of the largest, after a byte giving the width. */
+    uint8_t * putPacked(uint8_t * out, const int32_t * values, uint8_t n) {
+        uint32_t all = 0;
+        for(uint8_t i = 0; i < n; ++i)
+            all |= zigzag(values[i]);
+        uint8_t width = 32 - __builtin_clz(all | 1) - (all == 0);
+        *out++ = width;
+
+        uint32_t bits = 0;
+        uint8_t count = 0;
+        for(uint8_t i = 0; width && i < n; ++i) {
+            bits |= zigzag(values[i]) << count;
+            count += width;
+            while(count >= 8) {
+                *out++ = bits;
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+        if(count)
+            *out++ = bits;
+        return out;
+    }
+
+    /** Zig-zag varints, each zero followed by the count of zeros after it. */
+    uint8_t * putRuns(uint8_t * out, const int32_t * values, uint8_t n) {
+        for(uint8_t i = 0; i < n;) {
+            uint32_t value = zigzag(values[i++]);
+            out = putVarint(out, value);
+            if(value == 0) {
+                uint8_t run = 0;
+                while(i < n && values[i] == 0) {
+                    ++run;
+                    ++i;
+                }
+                out = putVarint(out, run);
+            }
+        }
+        return out;
+    }
+}
+
+CellHistory::CellHistory() : last_ticker(us_ticker_read()), now(0), last_scan(0),
+    fill(0), filling(false), oldest(0), waiting(0), flushing(false),
+    next_slot(0), sequence(0), read_only(IAP::imageEnd() > slotAddress(0)), writable(false), dropped(0),
+    encode_cycles(0), raw_bytes(0), encoded_bytes(0), thread(osPriorityLow, 512) {
+    // Writing carries on after the newest intact block
+    bool found = false;
+    for(uint32_t slot = 0; slot < SLOTS; ++slot) {
+        const BlockHeader * block = (const BlockHeader *) IAP::read(slotAddress(slot));
+        if(block->length > Config::HISTORY_BLOCK - sizeof(BlockHeader)
+                || block->crc != crc(*block, IAP::read(slotAddress(slot)) + sizeof(BlockHeader)))
+            continue;
+        if(!found || (int32_t) (block->sequence - sequence) >= 0) {
+            sequence = block->sequence + 1;
+            next_slot = (slot + 1) % SLOTS;
+            found = true;
+        }
+    }
+
+    thread.start(callback(this, &CellHistory::flusher));
+}
+
+void CellHistory::add(const uint16_t cell_codes[Config::NUM_CMUs][12], const uint8_t temperatures[Config::NUM_CMUs][12]) {
+    timestamp_t ticker = us_ticker_read();
+    uint32_t elapsed = (ticker - last_ticker) / 1000;
+    now += elapsed;
+    last_ticker += elapsed * 1000;
+
+    if(raw_bytes && now - last_scan < Config::HISTORY_PERIOD)
+        return;
+
+    uint32_t start = CycleCounter::read();
+
+    int32_t voltages[CELLS];
+    for(uint8_t i = 0; i < CELLS; ++i)
+        voltages[i] = cell_codes[i / 12][i % 12] / 10;
+    const uint8_t * temperature = &temperatures[0][0];
+
+    uint8_t scan[MAX_SCAN];
+    uint8_t * end = scan;
+    if(filling) {
+        end = encode(scan, voltages, temperature, now - last_scan, false);
+        if(header(fill).length + (uint32_t) (end - scan) > Config::HISTORY_BLOCK - sizeof(BlockHeader))
+            closeBlock();
+    }
+    if(!filling) {
+        if(!openBlock()) {
+            ++dropped;
+            return;
+        }
+        end = encode(scan, voltages, temperature, 0, true);
+    }
+
+    BlockHeader & block = header(fill);
+    memcpy(data(fill) + block.length, scan, end - scan);
+    block.length += end - scan;
+    ++block.scans;
+
+    memcpy(last_voltages, voltages, sizeof(last_voltages));
+    memcpy(last_temperatures, temperature, sizeof(last_temperatures));
+    last_scan = now;
+
+    raw_bytes += CELLS * 3;
+    encoded_bytes += end - scan;
+    encode_cycles = CycleCounter::read() - start;
+}
+
+void CellHistory::setWritable(bool writable) {
+    if(read_only)
+        return;
+
+    // The block being filled goes to flash with the rest once the contactors open, rather than
+    // waiting to fill
+    if(writable && !this->writable && filling)
+        closeBlock();
+
+    // Waits for an operation already started, as FlashStore does
+    if(!writable)
+        flash.lock();
+    this->writable = writable;
+    if(!writable)
+        flash.unlock();
+}
+
+bool CellHistory::isReadOnly() {
+    return read_only;
+}
+
+uint32_t CellHistory::getDropped() {
+    return dropped;
+}
+
+uint32_t CellHistory::getEncodeCycles() {
+    return encode_cycles;
+}
+
+uint32_t CellHistory::getRawBytes() {
+    return raw_bytes;
+}
+
+uint32_t CellHistory::getEncodedBytes() {
+    return encoded_bytes;
+}
+
+uint32_t CellHistory::slotAddress(uint32_t slot) {
+    return IAP::sectorAddress(Config::HISTORY_FIRST_SECTOR) + slot * Config::HISTORY_BLOCK;
+}
+
+bool CellHistory::isBlank(uint32_t address, uint32_t length) {
+    const uint32_t * words = (const uint32_t *) IAP::read(address);
+    for(uint32_t i = 0; i < length / 4; ++i)
+        if(words[i] != 0xFFFFFFFF)
+            return false;
+    return true;
+}
+
+uint16_t CellHistory::crc(const BlockHeader & header, const uint8_t * data) {
+    uint16_t crc = CRC16::update(CRC16::INIT, &header, offsetof(BlockHeader, crc));
+    return CRC16::update(crc, data, header.length);
+}
+
+uint8_t * CellHistory::encode(uint8_t * out, const int32_t voltages[CELLS], const uint8_t temperatures[CELLS],
+        time_t elapsed, bool key) {
+    if(key) {
+        for(uint8_t i = 0; i < CELLS; ++i)
+            out = putVarint(out, voltages[i]);
+        memcpy(out, temperatures, CELLS);
+        return out + CELLS;
+    }
+
+    int32_t deltas[CELLS];
+    int32_t sum = 0;
+    for(uint8_t i = 0; i < CELLS; ++i) {
+        deltas[i] = voltages[i] - last_voltages[i];
+        sum += deltas[i];
+    }
+    // Rounded to nearest, so residuals are centred on zero
+    int32_t mean = (sum >= 0 ? sum + CELLS / 2 : sum - CELLS / 2) / CELLS;
+    for(uint8_t i = 0; i < CELLS; ++i)
+        deltas[i] -= mean;
+
+    out = putVarint(out, elapsed);
+    out = putVarint(out, zigzag(mean));
+    out = putPacked(out, deltas, CELLS);
+
+    // Modulo 256, so a sensor going to or from 255 (off the table) stays one byte
+    for(uint8_t i = 0; i < CELLS; ++i)
+        deltas[i] = (int8_t) (temperatures[i] - last_temperatures[i]);
+    return putRuns(out, deltas, CELLS);
+}
+
+bool CellHistory::openBlock() {
+    core_util_critical_section_enter();
+    if(waiting == Config::HISTORY_RAM_BLOCKS) {
+        // Full: drop the oldest, unless it is being written
+        if(flushing) {
+            core_util_critical_section_exit();
+            return false;
+        }
+        dropped += header(oldest).scans;
+        oldest = (oldest + 1) % Config::HISTORY_RAM_BLOCKS;
+        --waiting;
+    }
+    core_util_critical_section_exit();
+
+    BlockHeader & block = header(fill);
+    block.sequence = 0;
+    block.time = now;
+    block.length = 0;
+    block.scans = 0;
+    block.crc = 0;
+    block.reserved = 0xFFFF;
+    filling = true;
+    return true;
+}
+
+void CellHistory::closeBlock() {
+    filling = false;
+    core_util_critical_section_enter();
+    ++waiting;
+    fill = (fill + 1) % Config::HISTORY_RAM_BLOCKS;
+    core_util_critical_section_exit();
+}
+
+void CellHistory::flusher() {
+    while(true) {
+        Thread::wait(Config::STORE_POLL_PERIOD);
+
+        while(writable && waiting) {
+            core_util_critical_section_enter();
+            flushing = true;
+            uint8_t block = oldest;
+            core_util_critical_section_exit();
+
+            bool written = program(block);
+
+            core_util_critical_section_enter();
+            flushing = false;
+            if(written) {
+                oldest = (oldest + 1) % Config::HISTORY_RAM_BLOCKS;
+                --waiting;
+            }
+            core_util_critical_section_exit();
+
+            if(!written)
+                break;
+        }
+    }
+}
+
+bool CellHistory::program(uint8_t block) {
+    if(!prepareSlot())
+        return false;
+
+    BlockHeader & head = header(block);
+    head.sequence = sequence;
+    head.crc = crc(head, data(block));
+    // Past the data, the block is left erased
+    memset(data(block) + head.length, 0xFF, Config::HISTORY_BLOCK - sizeof(BlockHeader) - head.length);
+
+    uint32_t address = slotAddress(next_slot);
+    for(uint32_t offset = 0; offset < Config::HISTORY_BLOCK; offset += IAP::PAGE_SIZE) {
+        flash.lock();
+        bool ok = writable && IAP::program(address + offset, blocks[block] + offset / 4) == IAP::CMD_SUCCESS;
+        flash.unlock();
+        if(!ok) {
+            // Skipped if torn, and this block goes in the next slot
+            if(offset)
+                next_slot = (next_slot + 1) % SLOTS;
+            return false;
+        }
+    }
+
+    next_slot = (next_slot + 1) % SLOTS;
+    if(memcmp(IAP::read(address), blocks[block], Config::HISTORY_BLOCK) != 0)
+        return false;
+    ++sequence;
+    return true;
+}
+
+bool CellHistory::prepareSlot() {
+    for(uint32_t tries = 0; tries < SLOTS; ++tries) {
+        uint32_t address = slotAddress(next_slot);
+        if(address % SECTOR_SIZE == 0 && !isBlank(address, SECTOR_SIZE)) {
+            flash.lock();
+            bool ok = writable && IAP::erase(Config::HISTORY_FIRST_SECTOR + next_slot * Config::HISTORY_BLOCK / SECTOR_SIZE)
+                    == IAP::CMD_SUCCESS;
+            flash.unlock();
+            if(!ok)
+                return false;
+        }
+        if(isBlank(address, Config::HISTORY_BLOCK))
+            return true;
+        next_slot = (next_slot + 1) % SLOTS;
+    }
+    return false;
+}
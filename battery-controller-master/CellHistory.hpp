@@ -0,0 +1,125 @@
+#ifndef CELL_HISTORY_HPP
+#define CELL_HISTORY_HPP
+
+#include "BCConfig.hpp"
+#include "IAP.hpp"
+#include <mbed.h>
+
+/** Compressed record of every cell's voltage and temperature, kept in flash.
+ *
+ * A scan is recorded every Config::HISTORY_PERIOD into Config::HISTORY_BLOCK byte blocks, each
+ * decodable on its own.  A block starts with a key scan: absolute cell voltages in mV as
+ * varints and raw CMU temperatures.  Every later scan in the block is the time since the
+ * previous one and the mean voltage change as varints, then each cell's change less the mean,
+ * zig-zag coded and bit packed at the width of the largest, then each temperature change as
+ * zig-zag varints with a zero followed by the count of zeros after it.  The cells of a pack
+ * move together and temperatures move slowly, so a scan is mostly a few bits of noise a cell.
+ *
+ * Blocks wait in a RAM ring in AHB SRAM bank 0 until a low priority thread writes them to a ring
+ * of Config::HISTORY_SECTORS flash sectors, only while setWritable() allows it, as FlashStore
+ * does.  If the RAM ring fills first the oldest block waiting is dropped.  Each block in flash
+ * has a sequence number and a CRC-16, so a block torn by a power cut is skipped; a sector is
+ * erased when writing reaches it, dropping the oldest blocks.  tools/historydecode.py decodes a
+ * dump of the flash.
+ */
+class CellHistory {
+    public:
+        /** Find where writing left off in flash. */
+        CellHistory();
+
+        /** Record a scan, if Config::HISTORY_PERIOD has passed since the last.
+         * @param cell_codes Cell voltages in 1/10 mV
+         * @param temperatures CMUControl::temp_scaled
+         */
+        void add(const uint16_t cell_codes[Config::NUM_CMUs][12], const uint8_t temperatures[Config::NUM_CMUs][12]);
+
+        /** Allow or stop flash operations, see FlashStore::setWritable().  Allowing them also
+         *  closes the block being filled, so it is written without waiting to fill. */
+        void setWritable(bool writable);
+
+        /** True if the program image reaches into the history sectors, which are then never
+         *  written. */
+        bool isReadOnly();
+
+        /** Scans dropped since power up, with their block or for want of one. */
+        uint32_t getDropped();
+
+        /** Cycles taken to encode the latest scan. */
+        uint32_t getEncodeCycles();
+
+        /** Scans recorded since power up, at 3 bytes a cell uncompressed. */
+        uint32_t getRawBytes();
+
+        /** The same scans compressed. */
+        uint32_t getEncodedBytes();
+
+        struct BlockHeader {
+            uint32_t sequence; // Of the block in flash, from 0
+            uint32_t time; // ms since boot of the key scan
+            uint16_t length; // bytes: Scan data after the header
+            uint16_t scans;
+            uint16_t crc; // CRC-16 of the rest of the header and the scan data
+            uint16_t reserved;
+        };
+
+    private:
+        static constexpr uint8_t CELLS = Config::NUM_CMUs * 12;
+        static constexpr uint16_t MAX_SCAN = 5 + 5 + 1 + CELLS * 2 + CELLS * 2; // bytes: Encoded, worst case
+        static constexpr uint32_t SLOTS = Config::HISTORY_SECTORS
+            * (IAP::sectorSize(Config::HISTORY_FIRST_SECTOR) / Config::HISTORY_BLOCK);
+
+        static_assert(Config::HISTORY_BLOCK % IAP::PAGE_SIZE == 0, "History blocks must be whole pages!");
+        static_assert(sizeof(BlockHeader) + MAX_SCAN <= Config::HISTORY_BLOCK, "History scans must fit in a block!");
+
+        static uint32_t slotAddress(uint32_t slot);
+        static bool isBlank(uint32_t address, uint32_t length);
+        static uint16_t crc(const BlockHeader & header, const uint8_t * data);
+
+        /** Encode a scan against the previous one, or as a key scan. */
+        uint8_t * encode(uint8_t * out, const int32_t voltages[CELLS], const uint8_t temperatures[CELLS],
+                time_t elapsed, bool key);
+
+        /** Find a RAM block to fill, dropping the oldest waiting if need be. */
+        bool openBlock();
+        void closeBlock();
+
+        /** Flush thread: write waiting blocks while flash is writable. */
+        void flusher();
+
+        /** Write one RAM block to the next flash slot. */
+        bool program(uint8_t block);
+
+        /** Make the next flash slot blank, erasing its sector or skipping a torn slot. */
+        bool prepareSlot();
+
+        // Clock
+        timestamp_t last_ticker; // us
+        time_t now; // ms
+        time_t last_scan; // ms
+
+        // Scan the next is encoded against
+        int32_t last_voltages[CELLS]; // mV
+        uint8_t last_temperatures[CELLS];
+
+        // RAM ring
+        uint8_t fill; // Block being filled
+        bool filling; // Has its key scan
+        uint8_t oldest; // Oldest block waiting for flash
+        volatile uint8_t waiting; // Complete blocks waiting
+        volatile bool flushing; // The oldest is being written
+
+        // Flash ring
+        uint32_t next_slot;
+        uint32_t sequence; // Of the next block
+
+        Mutex flash; // Held across each flash operation and by setWritable(false)
+        bool read_only;
+        volatile bool writable;
+        volatile uint32_t dropped;
+        uint32_t encode_cycles;
+        uint32_t raw_bytes;
+        uint32_t encoded_bytes;
+        Thread thread;
+};
+
+#endif
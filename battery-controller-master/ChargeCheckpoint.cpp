@@ -0,0 +1,87 @@
+#include "ChargeCheckpoint.hpp"
+#include <stdlib.h>
+#include <string.h>
+
+ChargeCheckpoint::ChargeCheckpoint(FlashStore & store) : store(store), age(-1), pending(true), rest_voltage(0) {
+    have_state = store.read(StoreRecords::CHARGE_STATE, &state, sizeof(state));
+    have_cells = store.read(StoreRecords::CELL_CHARGE, &cells, sizeof(cells));
+    if(!have_state)
+        memset(&state, 0, sizeof(state));
+    rest_voltage = state.restVoltage;
+
+    // Cleared by writing a one, and the RTC restarted from zero, so the next boot can trust it
+    if(LPC_RTC->RTC_AUX & RTC_OSCF) {
+        LPC_RTC->RTC_AUX = RTC_OSCF;
+        set_time(0);
+    } else if(have_state) {
+        // Set back since, so no better than lost
+        uint32_t now = time(NULL);
+        if(now >= state.time)
+            age = now - state.time < INT32_MAX ? now - state.time : INT32_MAX;
+    }
+}
+
+bool ChargeCheckpoint::isPending() {
+    return pending;
+}
+
+ChargeCheckpoint::Result ChargeCheckpoint::restore(const uint16_t cell_codes[Config::NUM_CMUs][12],
+        current_t current, CoulombCounter & coulombs, SOCEstimator & model) {
+    voltage_t voltage = 0;
+    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+        uint16_t code = cell_codes[cell / 12][cell % 12];
+        if(code == 0 || code == UINT16_MAX)
+            return WAITING;
+        voltage += code / 10;
+    }
+    pending = false;
+
+    if(!have_state) {
+        if(have_cells)
+            model.restore(cells, false, coulombs.getNetCharge());
+        return NONE;
+    }
+
+    Result result = RESTORED;
+    if(age > (int32_t) Config::CHARGE_CHECKPOINT_MAX_AGE)
+        result = TOO_OLD;
+    else if(state.atRest && state.restVoltage > 0 && abs(current) < Config::REST_CURRENT
+            && abs(voltage - state.restVoltage) > Config::CHARGE_CHECKPOINT_REST_TOLERANCE * Config::NUM_CELLS_SERIES)
+        result = CHANGED;
+
+    if(result == RESTORED)
+        coulombs.setCharge(state.charge);
+    // Capacities hold whatever happened while off, the rest only with the charge it was counted from
+    if(have_cells)
+        model.restore(cells, result == RESTORED && cells.sequence == state.sequence, coulombs.getNetCharge());
+    if(result != RESTORED)
+        rest_voltage = 0;
+    return result;
+}
+
+int32_t ChargeCheckpoint::getAge() {
+    return age;
+}
+
+void ChargeCheckpoint::setRestVoltage(voltage_t voltage) {
+    rest_voltage = voltage;
+}
+
+void ChargeCheckpoint::save(CoulombCounter & coulombs, SOCEstimator & model, bool urgent) {
+    // Until then the stored checkpoint is the only good one
+    if(pending || !coulombs.isInitialised())
+        return;
+
+    ++state.sequence;
+    state.time = time(NULL);
+    state.charge = coulombs.getCharge();
+    state.restVoltage = rest_voltage;
+    state.atRest = coulombs.isAtRest();
+    store.write(StoreRecords::CHARGE_STATE, &state, sizeof(state), urgent);
+
+    if(model.isInitialised()) {
+        model.save(cells, coulombs.getNetCharge());
+        cells.sequence = state.sequence;
+        store.write(StoreRecords::CELL_CHARGE, &cells, sizeof(cells), urgent);
+    }
+}
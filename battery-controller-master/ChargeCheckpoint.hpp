@@ -0,0 +1,72 @@
+#ifndef CHARGE_CHECKPOINT_HPP
+#define CHARGE_CHECKPOINT_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include "BCStoreRecords.hpp"
+#include "FlashStore.hpp"
+#include "CoulombCounter.hpp"
+#include "SOCEstimator.hpp"
+#include <mbed.h>
+
+/** Checkpoints of the counted charge and cell model in the FlashStore, so state of charge is
+ *  right from boot rather than taken from a pack voltage still pulled down by load.
+ *
+ * The checkpoint is restored on the first full cell scan, unless it is older than
+ * Config::CHARGE_CHECKPOINT_MAX_AGE, when the pack has long settled and its voltage is better,
+ * or it was taken at rest and the pack voltage has since moved by more than
+ * Config::CHARGE_CHECKPOINT_REST_TOLERANCE a cell, when the pack was charged or swapped while
+ * off.  Cell capacities are restored either way.
+ *
+ * Age comes from the RTC, which only keeps time through power off with a backup battery.  When
+ * its oscillator fail flag shows it lost power the age is unknown, and the checkpoint is trusted
+ * as the pack resting for Config::REST_PERIOD corrects it anyway.
+ */
+class ChargeCheckpoint {
+    public:
+        enum Result {
+            WAITING, // For a scan with every cell valid
+            NONE, // No checkpoint
+            RESTORED,
+            TOO_OLD,
+            CHANGED // Rest voltage moved while off
+        };
+
+        /** Load the checkpoint and check whether the RTC kept time. */
+        ChargeCheckpoint(FlashStore & store);
+
+        /** True until restore() has decided. */
+        bool isPending();
+
+        /** Restore the checkpoint if it still holds, once.
+         * @param cell_codes Cell voltages in 1/10 mV, from the pack at rest unless current says otherwise.
+         * @param current Pack current in mA.
+         */
+        Result restore(const uint16_t cell_codes[Config::NUM_CMUs][12], current_t current,
+                CoulombCounter & coulombs, SOCEstimator & model);
+
+        /** Age of the checkpoint at boot in s, or -1 if unknown or there is none. */
+        int32_t getAge();
+
+        /** Note the pack voltage while at rest, to check against at the next boot. */
+        void setRestVoltage(voltage_t voltage);
+
+        /** Queue a checkpoint for the store, once restore() has decided.
+         * @param urgent Commit as soon as flash is writable.
+         */
+        void save(CoulombCounter & coulombs, SOCEstimator & model, bool urgent);
+
+    private:
+        static constexpr uint8_t RTC_OSCF = 1 << 4; // RTC_AUX: Oscillator stopped, or RTC power lost
+
+        FlashStore & store;
+        StoreRecords::ChargeState state;
+        StoreRecords::CellCharge cells;
+        bool have_state;
+        bool have_cells;
+        int32_t age; // s, -1 if unknown
+        bool pending;
+        voltage_t rest_voltage; // mV
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include "CoulombCounter.hpp"
+
+constexpr int64_t CoulombCounter::MA_US_PER_MAH;
+
+CoulombCounter::CoulombCounter() :
+    charge(0), charged(0), discharged(0),
+    last_current(0), last_timestamp(0),
+    have_sample(false), initialised(false),
+    rest_time(0) {
+    }
+
+void CoulombCounter::addSample(current_t current, timestamp_t timestamp) {
+    if(have_sample) {
+        uint32_t dt = timestamp - last_timestamp; // Unsigned subtraction handles ticker wrap
+        int64_t delta = (int64_t)(current + last_current) * dt / 2;
+
+        charge += delta;
+        if(delta > 0)
+            charged += delta;
+        else
+            discharged -= delta;
+
+        if(abs(current) < Config::REST_CURRENT) {
+            if(rest_time < UINT32_MAX - dt)
+                rest_time += dt;
+        } else {
+            rest_time = 0;
+        }
+    }
+
+    last_current = current;
+    last_timestamp = timestamp;
+    have_sample = true;
+}
+
+void CoulombCounter::setCharge(int32_t charge) {
+    this->charge = charge * MA_US_PER_MAH;
+    initialised = true;
+}
+
+bool CoulombCounter::isInitialised() {
+    return initialised;
+}
+
+bool CoulombCounter::isAtRest() {
+    return rest_time / 1000 >= (uint32_t) Config::REST_PERIOD;
+}
+
+int32_t CoulombCounter::getCharge() {
+    return charge / MA_US_PER_MAH;
+}
+
+uint16_t CoulombCounter::getSOC() {
+    int32_t soc = getCharge() * 1000 / Config::PACK_CAPACITY;
+
+    if(soc < 0)
+        return 0;
+    if(soc > 1000)
+        return 1000;
+    return soc;
+}
+
+uint32_t CoulombCounter::getCharged() {
+    return charged / MA_US_PER_MAH;
+}
+
+uint32_t CoulombCounter::getDischarged() {
+    return discharged / MA_US_PER_MAH;
+}
+
+int32_t CoulombCounter::getNetCharge() {
+    return ((int64_t) charged - (int64_t) discharged) / MA_US_PER_MAH;
+}
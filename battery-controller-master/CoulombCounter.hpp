@@ -0,0 +1,66 @@
+#ifndef COULOMB_COUNTER_HPP
+#define COULOMB_COUNTER_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include <mbed.h>
+
+/** Integer coulomb counter for pack state of charge.
+ *
+ * Every current sample is integrated against its timestamp (trapezoidal rule) into a 64 bit
+ * charge in mA us, so nothing is lost to rounding between samples.  Charge is only set from the
+ * open circuit voltage before counting has started or once the pack has rested for
+ * Config::REST_PERIOD, since the terminal voltage under load doesn't reflect charge.
+ */
+class CoulombCounter {
+    public:
+        CoulombCounter();
+
+        /** Integrate a current sample.
+         * @param current Pack current, positive for charge.
+         * @param timestamp Time the sample was taken in us.
+         */
+        void addSample(current_t current, timestamp_t timestamp);
+
+        /** Set remaining charge, e.g. from open circuit voltage.
+         * @param charge Remaining charge in mAh.
+         */
+        void setCharge(int32_t charge);
+
+        /** True once setCharge() has been called. */
+        bool isInitialised();
+
+        /** True if current has stayed below Config::REST_CURRENT for Config::REST_PERIOD. */
+        bool isAtRest();
+
+        /** Remaining charge in mAh. */
+        int32_t getCharge();
+
+        /** State of charge in 1/10 %, clamped to 0-1000. */
+        uint16_t getSOC();
+
+        /** Charge counted into the pack in mAh. */
+        uint32_t getCharged();
+
+        /** Charge counted out of the pack in mAh. */
+        uint32_t getDischarged();
+
+        /** Net charge counted since boot in mAh, unaffected by setCharge(). */
+        int32_t getNetCharge();
+
+    private:
+        static constexpr int64_t MA_US_PER_MAH = 3600000000LL;
+
+        int64_t charge; // mA us
+        uint64_t charged; // mA us
+        uint64_t discharged; // mA us
+
+        current_t last_current;
+        timestamp_t last_timestamp;
+        bool have_sample;
+        bool initialised;
+
+        uint32_t rest_time; // us, saturates
+};
+
+#endif
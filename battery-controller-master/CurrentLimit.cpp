@@ -0,0 +1,71 @@
+#include "CurrentLimit.hpp"
+
+namespace {
+    constexpr int32_t FULL = 1000; // Derating factors are in 1/1000
+
+    /** Linear derating factor - FULL at or before start, 0 at or beyond end. */
+    int32_t derate(int32_t value, int32_t start, int32_t end) {
+        if(start < end) {
+            if(value <= start)
+                return FULL;
+            if(value >= end)
+                return 0;
+            return (end - value) * FULL / (end - start);
+        }
+
+        if(value >= start)
+            return FULL;
+        if(value <= end)
+            return 0;
+        return (value - end) * FULL / (start - end);
+    }
+
+    /** Factor shared by charge and discharge. */
+    int32_t temperatureFactor(temperature_t temperature_min, temperature_t temperature_max) {
+        int32_t hot = derate(temperature_max,
+                Config::MAX_CELL_TEMPERATURE - Config::DERATE_TEMPERATURE_BAND, Config::MAX_CELL_TEMPERATURE);
+        int32_t cold = derate(temperature_min,
+                Config::MIN_CELL_TEMPERATURE + Config::DERATE_TEMPERATURE_BAND, Config::MIN_CELL_TEMPERATURE);
+        return hot < cold ? hot : cold;
+    }
+
+    int32_t min(int32_t a, int32_t b) {
+        return a < b ? a : b;
+    }
+}
+
+current_t CurrentLimit::charge(voltage_t cell_max, temperature_t temperature_min,
+        temperature_t temperature_max, uint16_t soc) {
+    int32_t factor = derate(cell_max, Config::CHARGE_DERATE_CELL_VOLTAGE, Config::MAX_CELL_VOLTAGE);
+    factor = min(factor, temperatureFactor(temperature_min, temperature_max));
+    factor = min(factor, derate(soc, Config::CHARGE_DERATE_SOC, 1000));
+
+    return Config::MAX_CHARGE_CURRENT / FULL * factor;
+}
+
+current_t CurrentLimit::discharge(voltage_t cell_min, temperature_t temperature_min,
+        temperature_t temperature_max, uint16_t soc) {
+    int32_t factor = derate(cell_min, Config::DISCHARGE_DERATE_CELL_VOLTAGE, Config::UNDER_CELL_VOLTAGE);
+    factor = min(factor, temperatureFactor(temperature_min, temperature_max));
+    factor = min(factor, derate(soc, Config::DISCHARGE_DERATE_SOC, 0));
+
+    return Config::MAX_DISCHARGE_CURRENT / FULL * factor;
+}
+
+current_t CurrentLimit::predicted(voltage_t ocv, voltage_t limit, int32_t resistance) {
+    int64_t headroom = limit - ocv; // mV
+
+    if(resistance <= 0) {
+        if(headroom == 0)
+            return 0;
+        return headroom > 0 ? Config::MAX_CHARGE_CURRENT : Config::MAX_DISCHARGE_CURRENT;
+    }
+
+    // mV / uOhm is kA, so scale to mA
+    int64_t current = headroom * 1000000 / resistance;
+    if(current > Config::MAX_CHARGE_CURRENT)
+        return Config::MAX_CHARGE_CURRENT;
+    if(current < Config::MAX_DISCHARGE_CURRENT)
+        return Config::MAX_DISCHARGE_CURRENT;
+    return current;
+}
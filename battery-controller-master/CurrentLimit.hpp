@@ -0,0 +1,44 @@
+#ifndef CURRENT_LIMIT_HPP
+#define CURRENT_LIMIT_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include <mbed.h>
+
+/** Continuously allowed charge and discharge current.
+ *
+ * Starts from Config::MAX_CHARGE_CURRENT/MAX_DISCHARGE_CURRENT and derates by cell voltage, cell
+ * temperature and state of charge, taking the most restrictive factor.  Broadcasting these lets the
+ * motor controller and MPPTs throttle back before the fault monitor has to open the contactors.
+ */
+namespace CurrentLimit {
+    /** Allowed charge current.
+     * @param cell_max Highest cell voltage.
+     * @param temperature_min Lowest cell temperature.
+     * @param temperature_max Highest cell temperature.
+     * @param soc State of charge in 1/10 %.
+     * @return Current in mA, positive.
+     */
+    current_t charge(voltage_t cell_max, temperature_t temperature_min,
+            temperature_t temperature_max, uint16_t soc);
+
+    /** Allowed discharge current.
+     * @param cell_min Lowest cell voltage.
+     * @param temperature_min Lowest cell temperature.
+     * @param temperature_max Highest cell temperature.
+     * @param soc State of charge in 1/10 %.
+     * @return Current in mA, negative.
+     */
+    current_t discharge(voltage_t cell_min, temperature_t temperature_min,
+            temperature_t temperature_max, uint16_t soc);
+
+    /** Current that takes a cell group from its open circuit voltage to a voltage limit.
+     * @param ocv Open circuit voltage of the group.
+     * @param limit Voltage limit.
+     * @param resistance Resistance of the group in uOhm.
+     * @return Current in mA, positive (charge) if the limit is above ocv.
+     */
+    current_t predicted(voltage_t ocv, voltage_t limit, int32_t resistance);
+}
+
+#endif
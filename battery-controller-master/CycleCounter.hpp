@@ -0,0 +1,24 @@
+#ifndef CYCLE_COUNTER_HPP
+#define CYCLE_COUNTER_HPP
+
+#include <mbed.h>
+
+/** Core clock cycle counter (DWT CYCCNT) for timing code on target.
+ *
+ * Counts at SystemCoreClock and wraps every ~45 s at 96 MHz, so take differences of read() with
+ * unsigned arithmetic.
+ */
+namespace CycleCounter {
+    /** Start the counter.  Safe to call more than once. */
+    inline void enable() {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+
+    /** Current cycle count. */
+    inline uint32_t read() {
+        return DWT->CYCCNT;
+    }
+}
+
+#endif
@@ -1,18 +1,25 @@
 #include "Debug.hpp"
+#include "hal/us_ticker_api.h"
 
 Debug CONSOLE;
 
-Debug::Debug() : Serial(USBTX, USBRX) {
+Debug::Debug() : Serial(USBTX, USBRX), dropped(0), reported(0), tx_dropped(0), tx_reported(0),
+        drainer(osPriorityLow, 1024) {
     baud(460800);
+    attach(callback(this, &Debug::sendQueued), TxIrq);
     lock();
     this->printf("\n\n Build: " __DATE__ __TIME__ "\n");
     unlock();
+
+#ifndef NDEBUG
+    drainer.start(callback(this, &Debug::drain));
+#endif
 }
 
 int Debug::debug(const char * function, uint32_t line, const char * level, const char * format, ...) {
     lock();
     int r = this->printf("[%s - %s():%u] ", level, function, line);
-    
+
     std::va_list arg;
     va_start(arg, format);
     r += this->vprintf(format, arg);
@@ -34,3 +41,145 @@ void Debug::debug_can(const char * function, uint32_t line, const char * msg, co
 
     unlock();
 }
+
+void Debug::log_can(uint32_t id, uint16_t line, const CANMessage & can) {
+    Record record(id, line);
+    put(record, can.id);
+    record.append(&can.len, 1);
+    record.append(can.data, can.len);
+    push(record);
+}
+
+uint32_t Debug::getDropped() {
+    return dropped;
+}
+
+uint32_t Debug::getTxDropped() {
+    return tx_dropped;
+}
+
+Debug::Record::Record(uint32_t id, uint16_t line) : length(0) {
+    timestamp_t timestamp = us_ticker_read();
+    append(&id, sizeof(id));
+    append(&timestamp, sizeof(timestamp));
+    append(&line, sizeof(line));
+}
+
+void Debug::Record::append(const void * bytes, uint8_t count) {
+    if(count > sizeof(data) - length)
+        count = sizeof(data) - length;
+    memcpy(data + length, bytes, count);
+    length += count;
+}
+
+void Debug::put(Record & record, const char * string) {
+    uint8_t length = 0;
+    while(length < Config::LOG_MAX_STRING - 1 && string[length])
+        ++length;
+
+    const uint8_t terminator = 0;
+    record.append(string, length);
+    record.append(&terminator, 1);
+}
+
+void Debug::push(const Record & record) {
+    // Producers can be any thread or interrupt, so they take turns; the drain thread reads
+    // without locking
+    core_util_critical_section_enter();
+    if(Config::LOG_BUFFER_SIZE - buffer.size() < record.length + 1u) {
+        ++dropped;
+    } else {
+        buffer.push(record.length);
+        for(uint8_t i = 0; i < record.length; ++i)
+            buffer.push(record.data[i]);
+    }
+    core_util_critical_section_exit();
+}
+
+void Debug::drain() {
+    for(;;) {
+        uint8_t length;
+        while(buffer.pop(length)) {
+            uint8_t data[Config::LOG_MAX_RECORD];
+            for(uint8_t i = 0; i < length; ++i)
+                buffer.pop(data[i]);
+            writeFrame(data, length);
+        }
+
+        uint32_t total = dropped;
+        uint32_t tx_total = tx_dropped;
+        if(total != reported || tx_total != tx_reported) {
+            Record record(Log::DROPPED, 0);
+            put(record, total - reported);
+            put(record, tx_total - tx_reported);
+            writeFrame(record.data, record.length);
+            reported = total;
+            tx_reported = tx_total;
+        }
+
+        Thread::wait(Config::LOG_DRAIN_PERIOD);
+    }
+}
+
+void Debug::writeFrame(const uint8_t * data, uint8_t length) {
+    // COBS: each zero is replaced by the distance to the next, so the frame holds no zeros
+    uint8_t encoded[Config::LOG_MAX_RECORD + 2];
+    uint8_t out = 1;
+    uint8_t code = 0;
+    for(uint8_t i = 0; i < length; ++i) {
+        if(data[i] == 0) {
+            encoded[code] = out - code;
+            code = out++;
+        } else {
+            encoded[out++] = data[i];
+        }
+    }
+    encoded[code] = out - code;
+
+    // This thread can wait, so a frame is never cut short by a full TX ring
+    while(Config::CONSOLE_TX_BUFFER - tx.size() < out + 2u)
+        Thread::wait(1);
+
+    lock();
+    send(0);
+    for(uint8_t i = 0; i < out; ++i)
+        send(encoded[i]);
+    send(0);
+    unlock();
+}
+
+int Debug::_putc(int c) {
+    while(!send(c)) {
+        // Only wait where the TX interrupt can make room
+        if(Config::CONSOLE_OVERFLOW == Log::OVERFLOW_DROP || __get_IPSR() != 0 || __get_PRIMASK() != 0) {
+            core_util_critical_section_enter();
+            ++tx_dropped;
+            core_util_critical_section_exit();
+            break;
+        }
+    }
+    return c;
+}
+
+bool Debug::send(uint8_t c) {
+    // Anything straight into the FIFO must not overtake queued characters.  The HAL calls are
+    // used directly as SerialBase would take its mutex.
+    core_util_critical_section_enter();
+    bool sent = true;
+    if(tx.empty() && serial_writable(&_serial))
+        serial_putc(&_serial, c);
+    else
+        sent = tx.push(c);
+    core_util_critical_section_exit();
+    return sent;
+}
+
+void Debug::sendQueued() {
+    // The TX interrupt, like serial_writable(), only comes once the FIFO is empty, so fill all of
+    // it rather than sending one character an interrupt
+    if(!serial_writable(&_serial))
+        return;
+    uint8_t c;
+    for(uint8_t i = 0; i < UART_FIFO && tx.pop(c); ++i)
+        _serial.uart->THR = c;
+}
@@ -1,8 +1,50 @@
 #ifndef DEBUG_HPP
 #define DEBUG_HPP
 
+#include "BCConfig.hpp"
+#include "RingBuffer.hpp"
 #include <mbed.h>
-
+#include <type_traits>
+
+/** Message IDs for deferred logging.
+ *
+ * A call site is identified by a hash of its level and format string, worked out by the
+ * compiler, so only the ID and the raw arguments are stored.  tools/logdecode.py finds the same
+ * strings in the source to turn records back into text.
+ */
+namespace Log {
+    /** 32 bit FNV-1a hash of a string, continuing from hash. */
+    constexpr uint32_t fnv1a(const char * s, uint32_t hash = 2166136261u) {
+        return *s ? fnv1a(s + 1, (hash ^ (uint8_t) *s) * 16777619u) : hash;
+    }
+
+    /** Message ID of level ":" text extra. */
+    constexpr uint32_t id(const char * level, const char * text, const char * extra = "") {
+        return fnv1a(extra, fnv1a(text, fnv1a(":", fnv1a(level))));
+    }
+
+    // Reserved ID of the record reporting how many records a full buffer has lost
+    constexpr uint32_t DROPPED = 0;
+
+    // Reserved IDs of a trace dump: TRACE_START(clock Hz, events), then TRACE(cycles, id, arg,
+    // flags) per event
+    constexpr uint32_t TRACE_START = 1;
+    constexpr uint32_t TRACE = 2;
+}
+
+/** Console on the USB serial port, with deferred binary logging.
+ *
+ * The log macros don't format or touch the UART.  They copy a message ID, timestamp, line and
+ * raw arguments into a ring buffer with interrupts held off for the copy, so they are cheap
+ * and safe anywhere, including interrupt handlers.  A low priority thread drains the buffer to
+ * the UART as COBS frames between zero bytes, which plain text output never contains.  A
+ * record that doesn't fit in the buffer is dropped and counted.
+ *
+ * Output never waits for the UART either: characters go into a TX ring emptied into the UART
+ * FIFO by its TX interrupt.  The drain thread waits for room for a whole frame, so log records
+ * are never cut short, while direct output (printf, debug() etc.) follows
+ * Config::CONSOLE_OVERFLOW when the ring is full.
+ */
 class Debug : public Serial {
     public:
         Debug();
@@ -27,6 +69,115 @@ class Debug : public Serial {
 
                 unlock();
             }
+
+        /** Queue a log record.  Arguments are stored as 32 bit words (64 bit for long long),
+         *  floats as single precision and strings copied up to Config::LOG_MAX_STRING.
+         */
+        template<typename... Args>
+            void log(uint32_t id, uint16_t line, Args... args) {
+                Record record(id, line);
+                putAll(record, args...);
+                push(record);
+            }
+
+        /** Queue an array of values, decoded with one format per element. */
+        template<typename T>
+            void log_array(uint32_t id, uint16_t line, const T * array, uint32_t len) {
+                Record record(id, line);
+                for(uint32_t i = 0; i < len; ++i)
+                    put(record, array[i]);
+                push(record);
+            }
+
+        /** Queue a CAN message. */
+        void log_can(uint32_t id, uint16_t line, const CANMessage & can);
+
+        /** Records lost to a full buffer since power up. */
+        uint32_t getDropped();
+
+        /** Direct output characters lost to a full TX ring since power up. */
+        uint32_t getTxDropped();
+
+        /** Never called, only lets the compiler check log arguments against their format. */
+        static void check(const char * format, ...) __attribute__((format(printf, 1, 2))) {}
+
+    protected:
+        /** Queue a character for the TX interrupt, or write it straight to the UART FIFO if
+         *  nothing is queued ahead of it.  Never waits, unless Config::CONSOLE_OVERFLOW says to.
+         */
+        virtual int _putc(int c);
+
+    private:
+        struct Record {
+            Record(uint32_t id, uint16_t line);
+
+            /** Append bytes, truncating at Config::LOG_MAX_RECORD. */
+            void append(const void * bytes, uint8_t count);
+
+            uint8_t data[Config::LOG_MAX_RECORD];
+            uint8_t length;
+        };
+
+        template<typename T>
+            static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+            put(Record & record, T value) {
+                if(sizeof(T) > 4) {
+                    uint64_t word = (uint64_t) value;
+                    record.append(&word, sizeof(word));
+                } else {
+                    uint32_t word = (uint32_t) value;
+                    record.append(&word, sizeof(word));
+                }
+            }
+
+        template<typename T>
+            static typename std::enable_if<std::is_floating_point<T>::value>::type
+            put(Record & record, T value) {
+                float word = value;
+                record.append(&word, sizeof(word));
+            }
+
+        template<typename T>
+            static void put(Record & record, const T * pointer) {
+                uint32_t word = (uint32_t) pointer;
+                record.append(&word, sizeof(word));
+            }
+
+        static void put(Record & record, const char * string);
+
+        static void putAll(Record & record) {}
+
+        template<typename T, typename... Rest>
+            static void putAll(Record & record, T first, Rest... rest) {
+                put(record, first);
+                putAll(record, rest...);
+            }
+
+        void push(const Record & record);
+
+        /** Drain thread: write queued records to the UART. */
+        void drain();
+
+        /** Write one record as a COBS frame, once the TX ring has room for all of it. */
+        void writeFrame(const uint8_t * data, uint8_t length);
+
+        /** Queue a character, or write it to the UART FIFO if nothing is queued ahead.
+         * @return False if the TX ring is full.
+         */
+        bool send(uint8_t c);
+
+        /** TX interrupt: refill the UART FIFO from the TX ring. */
+        void sendQueued();
+
+        static constexpr uint8_t UART_FIFO = 16; // bytes: LPC1768 UART TX FIFO
+
+        RingBuffer<uint8_t, Config::LOG_BUFFER_SIZE> buffer;
+        volatile uint32_t dropped;
+        uint32_t reported; // Dropped count already sent
+        RingBuffer<uint8_t, Config::CONSOLE_TX_BUFFER> tx;
+        volatile uint32_t tx_dropped;
+        uint32_t tx_reported; // TX dropped count already sent
+        Thread drainer;
 };
 
 extern Debug CONSOLE;
@@ -43,12 +194,28 @@ extern Debug CONSOLE;
 
 #else
 
-#define DEBUG(...) CONSOLE.debug(__FUNCTION__, __LINE__, "DEBUG", __VA_ARGS__)
-#define INFO(...) CONSOLE.debug(__FUNCTION__, __LINE__, " INFO", __VA_ARGS__)
-#define WARN(...) CONSOLE.debug(__FUNCTION__, __LINE__, " WARN", __VA_ARGS__)
-#define ERROR(...) CONSOLE.debug(__FUNCTION__, __LINE__, "ERROR", __VA_ARGS__)
-#define DEBUG_CAN(msg, can) CONSOLE.debug_can(__FUNCTION__, __LINE__, msg, can)
-#define DEBUG_ARRAY(msg, fmt, array, len) CONSOLE.debug_array(__FUNCTION__, __LINE__, msg, fmt, array, len)
+/* Log levels are per module: each source file that logs declares
+ *
+ *   constexpr Log::Level LOG_LEVEL = Config::LOG_LEVEL_<module>;
+ *
+ * after its includes, and a class in a header declares it as a static member, which ordinary
+ * name lookup then finds for every call site.  A call above the module's level is a constant
+ * false condition, which the compiler drops even at -O0, so its arguments are never evaluated.
+ */
+#define LOG_IF_(level, ...) (LOG_LEVEL >= Log::level ? (__VA_ARGS__) : (void) 0)
+
+// The format check is never evaluated, and the message ID is a compile time constant
+#define LOG_(level, format, ...) (false ? Debug::check(format, ##__VA_ARGS__) \
+        : CONSOLE.log(std::integral_constant<uint32_t, Log::id(level, format)>::value, __LINE__, ##__VA_ARGS__))
+
+#define DEBUG(format, ...) LOG_IF_(LEVEL_DEBUG, LOG_("DEBUG", format, ##__VA_ARGS__))
+#define INFO(format, ...) LOG_IF_(LEVEL_INFO, LOG_("INFO", format, ##__VA_ARGS__))
+#define WARN(format, ...) LOG_IF_(LEVEL_WARN, LOG_("WARN", format, ##__VA_ARGS__))
+#define ERROR(format, ...) LOG_IF_(LEVEL_ERROR, LOG_("ERROR", format, ##__VA_ARGS__))
+#define DEBUG_CAN(msg, can) LOG_IF_(LEVEL_DEBUG, \
+        CONSOLE.log_can(std::integral_constant<uint32_t, Log::id("CAN", msg)>::value, __LINE__, can))
+#define DEBUG_ARRAY(msg, fmt, array, len) LOG_IF_(LEVEL_DEBUG, \
+        CONSOLE.log_array(std::integral_constant<uint32_t, Log::id("ARRAY", msg, fmt)>::value, __LINE__, array, len))
 
 #endif
 
@@ -0,0 +1,107 @@
+#include "FanControl.hpp"
+
+static_assert(sizeof(Config::FAN_CURVE_TEMPERATURE) / sizeof(Config::FAN_CURVE_TEMPERATURE[0])
+        == sizeof(Config::FAN_CURVE_SPEED) / sizeof(Config::FAN_CURVE_SPEED[0]),
+        "Fan curve temperatures and speeds must pair up!");
+
+FanControl::FanControl() :
+#ifdef FAN1
+    tach1_in(PinDefs::FAN1_SENSE),
+#endif
+    tach2_in(PinDefs::FAN2_SENSE),
+    last_measure(0), stalled(0), speed(UINT8_MAX), spinning_since(0) {
+    for(uint8_t i = 0; i < NUM_FANS; ++i) {
+        pulses[i] = 0;
+        last_pulses[i] = 0;
+        rpm[i] = 0;
+    }
+
+    // Tach outputs are open collector
+#ifdef FAN1
+    tach1_in.mode(PullUp);
+    tach1_in.fall(callback(this, &FanControl::tach1));
+#endif
+    tach2_in.mode(PullUp);
+    tach2_in.fall(callback(this, &FanControl::tach2));
+}
+
+uint8_t FanControl::setTemperature(temperature_t temperature, time_t now) {
+    uint8_t up = curve(temperature);
+    uint8_t down = curve(temperature + Config::FAN_HYSTERESIS);
+
+    if(up > speed)
+        setSpeed(up, now);
+    else if(down < speed)
+        setSpeed(down, now);
+
+    return speed;
+}
+
+void FanControl::measure(time_t now) {
+    time_t dt = now - last_measure;
+    if(dt <= 0)
+        return;
+    last_measure = now;
+
+    stalled = 0;
+    for(uint8_t i = 0; i < NUM_FANS; ++i) {
+        uint32_t count = pulses[i];
+        rpm[i] = (count - last_pulses[i]) * 60000UL / (Config::FAN_TACH_PULSES * dt);
+        last_pulses[i] = count;
+
+#ifndef FAN1
+        // Fan 1 shares its drive with the charge contactor
+        if(i == FAN1)
+            continue;
+#endif
+        if(speed > 0 && now - spinning_since > Config::FAN_SPINUP && rpm[i] < Config::FAN_STALL_RPM)
+            stalled |= 1 << i;
+    }
+}
+
+uint8_t FanControl::getSpeed() {
+    return speed;
+}
+
+uint16_t FanControl::getRPM(Fan fan) {
+    return rpm[fan];
+}
+
+uint8_t FanControl::getStalled() {
+    return stalled;
+}
+
+uint8_t FanControl::curve(temperature_t temperature) {
+    constexpr uint8_t N = sizeof(Config::FAN_CURVE_SPEED) / sizeof(Config::FAN_CURVE_SPEED[0]);
+
+    if(temperature <= Config::FAN_CURVE_TEMPERATURE[0])
+        return Config::FAN_CURVE_SPEED[0];
+
+    for(uint8_t i = 1; i < N; ++i) {
+        temperature_t t0 = Config::FAN_CURVE_TEMPERATURE[i - 1];
+        temperature_t t1 = Config::FAN_CURVE_TEMPERATURE[i];
+        if(temperature < t1) {
+            int32_t s0 = Config::FAN_CURVE_SPEED[i - 1];
+            int32_t s1 = Config::FAN_CURVE_SPEED[i];
+            int32_t speed = s0 + (s1 - s0) * (temperature - t0) / (t1 - t0);
+            // A fan driven slower would read as stalled
+            return speed > 0 && speed < Config::FAN_MIN_SPEED ? Config::FAN_MIN_SPEED : speed;
+        }
+    }
+
+    return Config::FAN_CURVE_SPEED[N - 1];
+}
+
+void FanControl::tach1() {
+    ++pulses[FAN1];
+}
+
+void FanControl::tach2() {
+    ++pulses[FAN2];
+}
+
+void FanControl::setSpeed(uint8_t speed, time_t now) {
+    if(this->speed == 0 && speed > 0)
+        spinning_since = now;
+    this->speed = speed;
+}
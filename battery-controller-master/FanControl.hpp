@@ -0,0 +1,78 @@
+#ifndef FAN_CONTROL_HPP
+#define FAN_CONTROL_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include "BCPinDefs.hpp"
+#include <mbed.h>
+
+/** Pack fan speed from the hottest cell, with tachometer feedback.
+ *
+ * Speed follows Config::FAN_CURVE_TEMPERATURE/SPEED, interpolated between points, and is never
+ * between stopped and Config::FAN_MIN_SPEED, below which a fan may not turn at all.  It rises as
+ * soon as the curve asks for more, but only falls once the temperature is
+ * Config::FAN_HYSTERESIS below where the curve would give the current speed, so the fans don't
+ * hunt around a curve point.  Until the first temperature arrives the fans run flat out.
+ *
+ * Tach pulses are counted by interrupt and turned into RPM by measure().  A fan that is being
+ * driven but still turning slower than Config::FAN_STALL_RPM after Config::FAN_SPINUP is
+ * reported stalled.
+ */
+class FanControl {
+    public:
+        enum Fan {
+            FAN1,
+            FAN2,
+            NUM_FANS
+        };
+
+        FanControl();
+
+        /** Update the speed from the hottest cell temperature.
+         * @param temperature Hottest cell in 1/10 C.
+         * @param now Time in ms.
+         * @return New fan speed, 0 for stopped, 255 for full speed.
+         */
+        uint8_t setTemperature(temperature_t temperature, time_t now);
+
+        /** Update RPM and stall detection from the tach pulses since the last call.
+         * @param now Time in ms.
+         */
+        void measure(time_t now);
+
+        /** Fan speed being driven, 0-255. */
+        uint8_t getSpeed();
+
+        /** Measured speed of a fan in rpm. */
+        uint16_t getRPM(Fan fan);
+
+        /** Fans that are driven but not turning.
+         * @return Bit mask, 1 << Fan.
+         */
+        uint8_t getStalled();
+
+    private:
+        /** Speed the curve gives at a temperature. */
+        static uint8_t curve(temperature_t temperature);
+
+        void tach1();
+        void tach2();
+
+        void setSpeed(uint8_t speed, time_t now);
+
+#ifdef FAN1
+        InterruptIn tach1_in;
+#endif
+        InterruptIn tach2_in;
+        volatile uint32_t pulses[NUM_FANS];
+
+        uint32_t last_pulses[NUM_FANS];
+        time_t last_measure; // ms
+        uint16_t rpm[NUM_FANS];
+        uint8_t stalled;
+
+        uint8_t speed;
+        time_t spinning_since; // ms: When the speed last rose from zero
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "FaultMonitor.hpp"
+
+using namespace BCCANPackets;
+
+constexpr uint32_t FaultMonitor::TRIP_FAULTS;
+constexpr uint32_t FaultMonitor::MONITORED_FAULTS;
+
+const FaultMonitor::Limit FaultMonitor::LIMITS[NUM_LIMITS] = {
+    { TX::Issue::OVER_CHARGE_CURRENT, CURRENT,
+        Config::MAX_CHARGE_CURRENT, Config::MAX_CHARGE_CURRENT - Config::CURRENT_HYSTERESIS,
+        true, true, Config::CURRENT_FAULT_N, Config::CURRENT_FAULT_M },
+    { TX::Issue::OVER_DISCHARGE_CURRENT, CURRENT,
+        Config::MAX_DISCHARGE_CURRENT, Config::MAX_DISCHARGE_CURRENT + Config::CURRENT_HYSTERESIS,
+        false, true, Config::CURRENT_FAULT_N, Config::CURRENT_FAULT_M },
+    { TX::Issue::OVER_VOLTAGE_LOCKOUT, CELL_VOLTAGE_MAX,
+        Config::OVER_CELL_VOLTAGE, Config::OVER_CELL_VOLTAGE - Config::CELL_VOLTAGE_HYSTERESIS,
+        true, true, Config::CELL_VOLTAGE_FAULT_N, Config::CELL_VOLTAGE_FAULT_M },
+    // Releases at the charge cut-in voltage so charging resumes with the same hysteresis as before
+    { TX::Issue::OVERVOLTAGE, CELL_VOLTAGE_MAX,
+        Config::MAX_CELL_VOLTAGE, Config::CHARGE_CUTIN_CELL_VOLTAGE,
+        true, false, Config::CELL_VOLTAGE_FAULT_N, Config::CELL_VOLTAGE_FAULT_M },
+    { TX::Issue::UNDER_VOLTAGE_LOCKOUT, CELL_VOLTAGE_MIN,
+        Config::UNDER_CELL_VOLTAGE, Config::UNDER_CELL_VOLTAGE + Config::CELL_VOLTAGE_HYSTERESIS,
+        false, true, Config::CELL_VOLTAGE_FAULT_N, Config::CELL_VOLTAGE_FAULT_M },
+    { TX::Issue::UNDERVOLTAGE, CELL_VOLTAGE_MIN,
+        Config::MIN_CELL_VOLTAGE, Config::MIN_CELL_VOLTAGE + Config::CELL_VOLTAGE_HYSTERESIS,
+        false, false, Config::CELL_VOLTAGE_FAULT_N, Config::CELL_VOLTAGE_FAULT_M },
+    { TX::Issue::OVER_TEMPERATURE, TEMPERATURE_MAX,
+        Config::MAX_CELL_TEMPERATURE, Config::MAX_CELL_TEMPERATURE - Config::TEMPERATURE_HYSTERESIS,
+        true, true, Config::TEMPERATURE_FAULT_N, Config::TEMPERATURE_FAULT_M },
+    { TX::Issue::UNDER_TEMPERATURE, TEMPERATURE_MIN,
+        Config::MIN_CELL_TEMPERATURE, Config::MIN_CELL_TEMPERATURE + Config::TEMPERATURE_HYSTERESIS,
+        false, false, Config::TEMPERATURE_FAULT_N, Config::TEMPERATURE_FAULT_M },
+};
+
+FaultMonitor::FaultMonitor() : fresh(0), active(0) {
+    memset(inputs, 0, sizeof(inputs));
+    memset(history, 0, sizeof(history));
+}
+
+void FaultMonitor::update(Input input, int32_t value) {
+    inputs[input] = value;
+    fresh |= 1 << input;
+}
+
+void FaultMonitor::setCurrent(current_t current) {
+    inputs[CURRENT] = current;
+    check(1 << CURRENT);
+}
+
+void FaultMonitor::setCellVoltages(voltage_t voltage_min, voltage_t voltage_max) {
+    update(CELL_VOLTAGE_MIN, voltage_min);
+    update(CELL_VOLTAGE_MAX, voltage_max);
+}
+
+void FaultMonitor::setCellTemperatures(temperature_t temperature_min, temperature_t temperature_max) {
+    update(TEMPERATURE_MIN, temperature_min);
+    update(TEMPERATURE_MAX, temperature_max);
+}
+
+uint32_t FaultMonitor::evaluate() {
+    check(fresh);
+    fresh = 0;
+    return active;
+}
+
+void FaultMonitor::check(uint8_t mask) {
+    for(uint8_t i = 0; i < NUM_LIMITS; ++i) {
+        const Limit & limit = LIMITS[i];
+
+        if(!(mask & (1 << limit.input)))
+            continue;
+
+        bool set = active & limit.fault;
+        int32_t value = inputs[limit.input];
+        int32_t threshold = set ? limit.release : limit.trip;
+        bool outside = limit.upper ? value > threshold : value < threshold;
+
+        uint32_t window = (1u << limit.m) - 1;
+        history[i] = ((history[i] << 1) | outside) & window;
+        uint8_t count = __builtin_popcount(history[i]);
+
+        if(!set && count >= limit.n) {
+            active |= limit.fault;
+            history[i] = window;
+        } else if(set && !limit.latch && limit.m - count >= limit.n) {
+            active &= ~limit.fault;
+            history[i] = 0;
+        }
+    }
+}
+
+void FaultMonitor::clearLatched() {
+    for(uint8_t i = 0; i < NUM_LIMITS; ++i) {
+        if(LIMITS[i].latch) {
+            active &= ~LIMITS[i].fault;
+            history[i] = 0;
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef FAULT_MONITOR_HPP
+#define FAULT_MONITOR_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include "BCCANPackets.hpp"
+#include <mbed.h>
+
+/** Debounced evaluation of every protection limit in Config.
+ *
+ * Each limit keeps a bit history of its last M samples and only changes state once N of them
+ * agree, so a single noisy reading can neither trip nor release a fault.  Once set, a fault
+ * releases at a threshold moved back inside the limit (hysteresis).  Lockout faults are latched
+ * and stay set until clearLatched() is called.
+ *
+ * Inputs only count as a new sample when they are updated, so limits on slowly sampled inputs
+ * (temperatures) are not debounced against repeats of the same reading.  Current limits are
+ * checked as each sample arrives, as many arrive between evaluate() calls, the rest by evaluate().
+ */
+class FaultMonitor {
+    public:
+        FaultMonitor();
+
+        /** Update pack current and check the current limits against it. */
+        void setCurrent(current_t current);
+
+        /** Update lowest and highest cell voltage from a CMU scan. */
+        void setCellVoltages(voltage_t voltage_min, voltage_t voltage_max);
+
+        /** Update lowest and highest cell temperature from a CMU scan. */
+        void setCellTemperatures(temperature_t temperature_min, temperature_t temperature_max);
+
+        /** Check all limits against any new samples in a single pass.
+         * @return Active faults as BCCANPackets::TX::Issue flags.
+         */
+        uint32_t evaluate();
+
+        /** Release latched faults.  They will set again if the condition persists. */
+        void clearLatched();
+
+        /** Faults that must open the contactors. */
+        static constexpr uint32_t TRIP_FAULTS =
+            BCCANPackets::TX::Issue::OVER_CHARGE_CURRENT
+            | BCCANPackets::TX::Issue::OVER_DISCHARGE_CURRENT
+            | BCCANPackets::TX::Issue::OVER_VOLTAGE_LOCKOUT
+            | BCCANPackets::TX::Issue::UNDER_VOLTAGE_LOCKOUT
+            | BCCANPackets::TX::Issue::OVER_TEMPERATURE;
+
+        /** All faults owned by the monitor. */
+        static constexpr uint32_t MONITORED_FAULTS = TRIP_FAULTS
+            | BCCANPackets::TX::Issue::OVERVOLTAGE
+            | BCCANPackets::TX::Issue::UNDERVOLTAGE
+            | BCCANPackets::TX::Issue::UNDER_TEMPERATURE;
+
+    private:
+        enum Input {
+            CURRENT,
+            CELL_VOLTAGE_MIN,
+            CELL_VOLTAGE_MAX,
+            TEMPERATURE_MIN,
+            TEMPERATURE_MAX,
+            NUM_INPUTS
+        };
+
+        struct Limit {
+            uint32_t fault; // Issue flag
+            Input input;
+            int32_t trip; // Fault sets beyond this value
+            int32_t release; // Fault releases inside this value
+            bool upper; // True if the limit is a maximum
+            bool latch;
+            uint8_t n; // Samples out of m required to change state
+            uint8_t m;
+        };
+
+        static constexpr uint8_t NUM_LIMITS = 8;
+        static const Limit LIMITS[NUM_LIMITS];
+
+        void update(Input input, int32_t value);
+
+        /** Check the limits on the given inputs, a bit set for each. */
+        void check(uint8_t mask);
+
+        int32_t inputs[NUM_INPUTS];
+        uint8_t fresh; // Bit set for each input with a sample not yet evaluated
+
+        uint32_t history[NUM_LIMITS]; // Newest sample in bit 0, set if outside the threshold
+        uint32_t active;
+};
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef FILTERS_HPP
+#define FILTERS_HPP
+
+#include <mbed.h>
+#include <type_traits>
+
+/** Integer sample filters, templated on sample type and length so they cost no more than the
+ *  hand written loop and need no floating point. */
+namespace Filters {
+    /** Median of the last N samples, to reject single sample spikes without smearing steps.
+     * @tparam T Sample type.
+     * @tparam N Window length, odd.
+     */
+    template<typename T, uint8_t N>
+    class Median {
+        public:
+            static_assert(N % 2 == 1, "Median window must be odd!");
+
+            Median() : count(0), next(0) {}
+
+            /** Add a sample.
+             * @return Median of the window, or of the samples so far until it fills.
+             */
+            T add(T sample) {
+                window[next] = sample;
+                next = (next + 1) % N;
+                if(count < N)
+                    ++count;
+
+                // Insertion sort of a copy - N is small
+                T sorted[N];
+                for(uint8_t i = 0; i < count; ++i) {
+                    uint8_t j = i;
+                    for(; j > 0 && sorted[j - 1] > window[i]; --j)
+                        sorted[j] = sorted[j - 1];
+                    sorted[j] = window[i];
+                }
+
+                return sorted[count / 2];
+            }
+
+        private:
+            T window[N];
+            uint8_t count;
+            uint8_t next;
+    };
+
+    /** First order low pass (exponential average), y += (x - y) / 2^SHIFT.
+     *
+     * The state is kept scaled by 2^SHIFT so small steps aren't lost to rounding.  The first
+     * sample initialises the output so there is no start up ramp from zero.
+     *
+     * @tparam T Sample type.
+     * @tparam Acc State type, must hold the largest sample times 2^SHIFT.
+     * @tparam SHIFT Time constant of 2^SHIFT samples.
+     */
+    template<typename T, typename Acc, uint8_t SHIFT>
+    class IIR {
+        public:
+            static_assert(SHIFT > 0, "IIR shift must be at least one!");
+
+            IIR() : state(0), initialised(false) {}
+
+            /** Add a sample.
+             * @return New output.
+             */
+            T add(T sample) {
+                if(!initialised) {
+                    state = (Acc) sample * ((Acc) 1 << SHIFT);
+                    initialised = true;
+                } else {
+                    state += sample - (state >> SHIFT);
+                }
+                return get();
+            }
+
+            /** Latest output, rounded. */
+            T get() const {
+                return (state + ((Acc) 1 << (SHIFT - 1))) >> SHIFT;
+            }
+
+            /** Restart from a known output. */
+            void reset(T value) {
+                state = (Acc) value * ((Acc) 1 << SHIFT);
+                initialised = true;
+            }
+
+        private:
+            Acc state;
+            bool initialised;
+    };
+
+    /** Cascaded integrator comb decimator: the mean of R samples, filtered ORDER times, output once
+     *  every R samples.
+     *
+     * Integrators are left to wrap - modular arithmetic makes the comb differences exact anyway,
+     * as long as Acc holds the largest sample times R^ORDER.
+     *
+     * @tparam T Sample type.
+     * @tparam Acc Accumulator type, signed.
+     * @tparam ORDER Number of integrator/comb stages.
+     * @tparam R Decimation ratio.
+     */
+    template<typename T, typename Acc, uint8_t ORDER, uint16_t R>
+    class CIC {
+        public:
+            static_assert(ORDER > 0 && R > 0, "CIC order and ratio must be non-zero!");
+
+            CIC() : count(0), output(0) {
+                memset(integrators, 0, sizeof(integrators));
+                memset(combs, 0, sizeof(combs));
+            }
+
+            /** Add a sample.
+             * @return True if a new output is ready.
+             */
+            bool add(T sample) {
+                U x = (U) (Acc) sample;
+                for(uint8_t i = 0; i < ORDER; ++i) {
+                    integrators[i] += x;
+                    x = integrators[i];
+                }
+
+                if(++count < R)
+                    return false;
+                count = 0;
+
+                for(uint8_t i = 0; i < ORDER; ++i) {
+                    U y = x - combs[i];
+                    combs[i] = x;
+                    x = y;
+                }
+
+                output = (Acc) x / gain();
+                return true;
+            }
+
+            /** Latest output. */
+            T get() const {
+                return output;
+            }
+
+        private:
+            typedef typename std::make_unsigned<Acc>::type U;
+
+            static constexpr Acc gain(uint8_t order = ORDER) {
+                return order == 0 ? 1 : R * gain(order - 1);
+            }
+
+            U integrators[ORDER];
+            U combs[ORDER];
+            uint16_t count;
+            T output;
+    };
+
+    /** Mean of every R samples, output once every R samples. */
+    template<typename T, typename Acc, uint16_t R>
+    using Boxcar = CIC<T, Acc, 1, R>;
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef FIXED_POINT_HPP
+#define FIXED_POINT_HPP
+
+#include <mbed.h>
+
+/** Signed Q-format fixed point number.
+ *
+ * Cortex-M3 has no FPU, so every float operation is a library call.  This stores value * 2^FRAC
+ * in an integer and does multiplies and divides in a wider type, which compiles to a handful of
+ * integer instructions (a multiply is a single SMULL for the default 32/64 bit types).  Products
+ * and quotients are rounded to nearest.
+ *
+ * @tparam FRAC Number of fractional bits.
+ * @tparam S Storage type.
+ * @tparam W Intermediate type for multiplication and division, at least twice the width of S.
+ */
+template<uint8_t FRAC, typename S = int32_t, typename W = int64_t>
+class Fixed {
+    public:
+        static_assert(sizeof(W) >= 2 * sizeof(S), "Intermediate type too narrow!");
+        static_assert(FRAC < 8 * sizeof(S), "Too many fractional bits!");
+
+        constexpr Fixed() : raw(0) {}
+
+        /** Integer value. */
+        constexpr Fixed(int32_t value) : raw(value * ((S) 1 << FRAC)) {}
+
+        /** Construct from a raw scaled value. */
+        static constexpr Fixed fromRaw(S raw) {
+            return Fixed(raw, RawTag());
+        }
+
+        /** Closest value to a constant, e.g. a calibration scale factor.
+         *
+         * Only for initialising constexpr values, where the compiler does the double arithmetic
+         * and nothing but the raw integer reaches the target.
+         */
+        static constexpr Fixed fromConstant(double value) {
+            return fromRaw((S) (value * ((W) 1 << FRAC) + (value < 0 ? -0.5 : 0.5)));
+        }
+
+        /** Closest value to num / den. */
+        static Fixed fromRatio(W num, W den) {
+            return fromRaw(divide(num * ((W) 1 << FRAC), den));
+        }
+
+        /** Raw scaled value. */
+        constexpr S getRaw() const {
+            return raw;
+        }
+
+        /** Closest integer, halves away from zero as Scalar<float>::round(). */
+        int32_t round() const {
+            if(raw < 0)
+                return -((-raw + ((S) 1 << (FRAC - 1))) >> FRAC);
+            return (raw + ((S) 1 << (FRAC - 1))) >> FRAC;
+        }
+
+        /** Closest integer to value / 2^shift times this, e.g. ADC counts to mV.
+         *
+         * The product is taken in W, so any 32 bit value can be scaled without the result having
+         * to fit in this format.
+         */
+        constexpr int32_t scale(int32_t value, uint8_t shift = 0) const {
+            return ((W) raw * value + ((W) 1 << (FRAC + shift - 1))) >> (FRAC + shift);
+        }
+
+        Fixed operator+(Fixed other) const { return fromRaw(raw + other.raw); }
+        Fixed operator-(Fixed other) const { return fromRaw(raw - other.raw); }
+        Fixed operator-() const { return fromRaw(-raw); }
+
+        Fixed operator*(Fixed other) const {
+            return fromRaw(((W) raw * other.raw + ((W) 1 << (FRAC - 1))) >> FRAC);
+        }
+
+        Fixed operator/(Fixed other) const {
+            return fromRaw(divide((W) raw * ((W) 1 << FRAC), other.raw));
+        }
+
+        Fixed & operator+=(Fixed other) { raw += other.raw; return *this; }
+        Fixed & operator-=(Fixed other) { raw -= other.raw; return *this; }
+        Fixed & operator*=(Fixed other) { return *this = *this * other; }
+        Fixed & operator/=(Fixed other) { return *this = *this / other; }
+
+        bool operator<(Fixed other) const { return raw < other.raw; }
+        bool operator>(Fixed other) const { return raw > other.raw; }
+        bool operator<=(Fixed other) const { return raw <= other.raw; }
+        bool operator>=(Fixed other) const { return raw >= other.raw; }
+        bool operator==(Fixed other) const { return raw == other.raw; }
+        bool operator!=(Fixed other) const { return raw != other.raw; }
+
+    private:
+        struct RawTag {};
+        constexpr Fixed(S raw, RawTag) : raw(raw) {}
+
+        /** Divide rounding to nearest. */
+        static S divide(W num, W den) {
+            if((num < 0) != (den < 0))
+                return (num - den / 2) / den;
+            return (num + den / 2) / den;
+        }
+
+        S raw;
+};
+
+/** Conversions shared by float and Fixed, so numeric code can be templated on either.
+ *
+ * Values enter as integer ratios (e.g. a reading in mV over 1000) rather than floats, so the
+ * fixed point instantiation never touches the float library.
+ */
+template<typename T>
+struct Scalar {
+    /** Closest value to num / den. */
+    static T ratio(int64_t num, int64_t den) {
+        return (T) num / (T) den;
+    }
+
+    /** Closest integer. */
+    static int32_t round(T value) {
+        return value < 0 ? (int32_t) (value - 0.5f) : (int32_t) (value + 0.5f);
+    }
+};
+
+template<uint8_t FRAC, typename S, typename W>
+struct Scalar<Fixed<FRAC, S, W> > {
+    static Fixed<FRAC, S, W> ratio(int64_t num, int64_t den) {
+        return Fixed<FRAC, S, W>::fromRatio(num, den);
+    }
+
+    static int32_t round(Fixed<FRAC, S, W> value) {
+        return value.round();
+    }
+};
+
+#endif
@@ -0,0 +1,396 @@
+#include "FlashStore.hpp"
+#include "CRC16.hpp"
+#include <string.h>
+
+namespace {
+    static_assert(Config::STORE_FIRST_SECTOR >= 16 && Config::STORE_FIRST_SECTOR + Config::STORE_SECTORS <= 30,
+            "Store must be in the 32 KB flash sectors!");
+    static_assert(Config::STORE_SECTORS >= 2, "Store needs a spare sector!");
+
+    constexpr uint32_t SECTOR_SIZE = IAP::sectorSize(Config::STORE_FIRST_SECTOR);
+}
+
+FlashStore::FlashStore() : head(0), sequence(1), page_fill(0), page_records(0), pending_length(0),
+        read_only(IAP::imageEnd() > sectorAddress(0)),
+        writable(false), urgent(false), dropped(0), erases(0), thread(osPriorityLow, 1024) {
+    memset(latest, 0, sizeof(latest));
+
+    // The head is the sector with the newest header.  Blank or torn sectors are skipped, and
+    // erased before they are written.
+    bool used[Config::STORE_SECTORS];
+    bool found = false;
+    for(uint8_t s = 0; s < Config::STORE_SECTORS; ++s) {
+        const SectorHeader * header = (const SectorHeader *) IAP::read(sectorAddress(s));
+        used[s] = header->magic == MAGIC && header->check == ~header->sequence;
+        if(used[s] && (!found || (int32_t) (header->sequence - sequence) > 0)) {
+            head = s;
+            sequence = header->sequence;
+            found = true;
+        }
+    }
+
+    next_page = sectorAddress(head);
+    if(found) {
+        // Oldest first, so newer records of a key replace older ones
+        for(uint8_t i = 1; i <= Config::STORE_SECTORS; ++i) {
+            uint8_t s = (head + i) % Config::STORE_SECTORS;
+            if(used[s])
+                next_page = scan(s);
+        }
+    }
+
+    thread.start(callback(this, &FlashStore::flusher));
+}
+
+bool FlashStore::read(uint8_t key, void * data, uint8_t length) {
+    return fetch(key, data, length) == length;
+}
+
+int16_t FlashStore::read(uint8_t key, void * data) {
+    return fetch(key, data, -1);
+}
+
+bool FlashStore::write(uint8_t key, const void * data, uint8_t length, bool urgent) {
+    if(key >= Config::STORE_KEYS || length > Config::STORE_MAX_RECORD) {
+        ++dropped;
+        return false;
+    }
+
+    core_util_critical_section_enter();
+    bool queued = queue(key, data, length, true);
+    if(queued && urgent)
+        this->urgent = true;
+    core_util_critical_section_exit();
+    return queued;
+}
+
+void FlashStore::setWritable(bool writable) {
+    if(writable) {
+        this->writable = !read_only;
+        return;
+    }
+
+    flash.lock();
+    this->writable = false;
+    flash.unlock();
+}
+
+bool FlashStore::isReadOnly() {
+    return read_only;
+}
+
+uint16_t FlashStore::getWaiting() {
+    return pending_length;
+}
+
+uint32_t FlashStore::getDropped() {
+    return dropped;
+}
+
+uint32_t FlashStore::getErases() {
+    return erases;
+}
+
+uint16_t FlashStore::crc(const RecordHeader & header, const uint8_t * data) {
+    uint16_t crc = CRC16::update(CRC16::INIT, &header, offsetof(RecordHeader, crc));
+    return CRC16::update(crc, data, header.length);
+}
+
+uint32_t FlashStore::sectorAddress(uint8_t sector) {
+    return IAP::sectorAddress(Config::STORE_FIRST_SECTOR + sector);
+}
+
+bool FlashStore::isBlank(uint32_t address, uint32_t length) {
+    const uint32_t * words = (const uint32_t *) IAP::read(address);
+    for(uint32_t i = 0; i < length / 4; ++i)
+        if(words[i] != 0xFFFFFFFF)
+            return false;
+    return true;
+}
+
+int16_t FlashStore::fetch(uint8_t key, void * data, int16_t length) {
+    if(key >= Config::STORE_KEYS)
+        return -1;
+
+    // A value still waiting for flash is newer than the committed one
+    int16_t found = -2;
+    core_util_critical_section_enter();
+    for(uint16_t i = 0; i < pending_length; i += 2 + pending[i + 1]) {
+        if(pending[i] == key) {
+            found = -1;
+            if(length < 0 || pending[i + 1] == length) {
+                found = pending[i + 1];
+                memcpy(data, pending + i + 2, found);
+            }
+            break;
+        }
+    }
+    core_util_critical_section_exit();
+    if(found != -2)
+        return found;
+
+    uint32_t address = find(key);
+    if(!address)
+        return -1;
+    const RecordHeader * header = (const RecordHeader *) IAP::read(address);
+    if(length >= 0 && header->length != length)
+        return -1;
+    memcpy(data, IAP::read(address) + sizeof(RecordHeader), header->length);
+    return header->length;
+}
+
+uint32_t FlashStore::find(uint8_t key) {
+    uint32_t address = latest[key];
+    if(!address)
+        return 0;
+
+    const RecordHeader * header = (const RecordHeader *) IAP::read(address);
+    if(header->key != key || header->crc != crc(*header, IAP::read(address) + sizeof(RecordHeader)))
+        return 0;
+    return address;
+}
+
+uint32_t FlashStore::scan(uint8_t sector) {
+    uint32_t start = sectorAddress(sector);
+    uint32_t end = start + IAP::PAGE_SIZE; // The header page is always written
+
+    for(uint32_t page = start; page < start + SECTOR_SIZE; page += IAP::PAGE_SIZE) {
+        // Pages are written in order, so the first blank one ends the sector
+        if(page != start && isBlank(page, IAP::PAGE_SIZE))
+            break;
+        end = page + IAP::PAGE_SIZE;
+
+        // Records until the end of the page's data, or one that is torn
+        uint16_t offset = page == start ? sizeof(SectorHeader) : 0;
+        while(offset + sizeof(RecordHeader) <= IAP::PAGE_SIZE) {
+            const RecordHeader * header = (const RecordHeader *) IAP::read(page + offset);
+            if(header->key >= Config::STORE_KEYS || header->length > Config::STORE_MAX_RECORD
+                    || offset + sizeof(RecordHeader) + header->length > IAP::PAGE_SIZE
+                    || header->crc != crc(*header, IAP::read(page + offset) + sizeof(RecordHeader)))
+                break;
+            latest[header->key] = page + offset;
+            offset += sizeof(RecordHeader) + header->length;
+        }
+    }
+
+    return end;
+}
+
+void FlashStore::flusher() {
+    time_t waited = 0;
+    while(true) {
+        Thread::wait(Config::STORE_POLL_PERIOD);
+        if(waited < Config::STORE_FLUSH_PERIOD)
+            waited += Config::STORE_POLL_PERIOD;
+
+        if(!writable || !pending_length || (!urgent && waited < Config::STORE_FLUSH_PERIOD))
+            continue;
+
+        flush();
+        waited = 0;
+    }
+}
+
+void FlashStore::flush() {
+    urgent = false;
+
+    // Finish moving on from the oldest sector if a reset interrupted it
+    retire((head + 1) % Config::STORE_SECTORS);
+
+    // One record at a time, so write() is only held off for a short copy
+    while(writable) {
+        core_util_critical_section_enter();
+        if(!pending_length) {
+            core_util_critical_section_exit();
+            break;
+        }
+        uint8_t key = pending[0];
+        uint8_t length = pending[1];
+        memcpy(record, pending + 2, length);
+        pending_length -= 2 + length;
+        memmove(pending, pending + 2 + length, pending_length);
+        core_util_critical_section_exit();
+
+        if(!append(key, record, length)) {
+            core_util_critical_section_enter();
+            if(writable)
+                ++dropped;
+            else
+                queue(key, record, length, false);
+            core_util_critical_section_exit();
+        }
+    }
+
+    // A page is only programmed once, so a partial page is programmed now rather than kept
+    programPage();
+}
+
+void FlashStore::requeue() {
+    const uint8_t * bytes = (const uint8_t *) page;
+    core_util_critical_section_enter();
+    for(uint8_t r = 0; r < page_records; ++r) {
+        const RecordHeader * header = (const RecordHeader *) (bytes + page_offsets[r]);
+        queue(header->key, bytes + page_offsets[r] + sizeof(RecordHeader), header->length, false);
+    }
+    core_util_critical_section_exit();
+
+    page_fill = 0;
+    page_records = 0;
+}
+
+bool FlashStore::queue(uint8_t key, const void * data, uint8_t length, bool replace) {
+    for(uint16_t i = 0; i < pending_length; i += 2 + pending[i + 1]) {
+        if(pending[i] != key)
+            continue;
+        if(!replace)
+            return true;
+
+        if(pending[i + 1] == length) {
+            memcpy(pending + i + 2, data, length);
+            return true;
+        }
+
+        // Length changed, so it moves to the end
+        uint16_t size = 2 + pending[i + 1];
+        memmove(pending + i, pending + i + size, pending_length - i - size);
+        pending_length -= size;
+        break;
+    }
+
+    if(pending_length + 2 + length > Config::STORE_BUFFER) {
+        ++dropped;
+        return false;
+    }
+
+    pending[pending_length] = key;
+    pending[pending_length + 1] = length;
+    memcpy(pending + pending_length + 2, data, length);
+    pending_length += 2 + length;
+    return true;
+}
+
+bool FlashStore::append(uint8_t key, const uint8_t * data, uint8_t length) {
+    if(page_fill + sizeof(RecordHeader) + length > IAP::PAGE_SIZE && !programPage())
+        return false;
+
+    if(!page_fill) {
+        if(next_page == sectorAddress(head) + SECTOR_SIZE && !advance())
+            return false;
+
+        if(next_page == sectorAddress(head)) {
+            SectorHeader header = { MAGIC, sequence, ~sequence };
+            memcpy(page, &header, sizeof(header));
+            page_fill = sizeof(header);
+        }
+    }
+
+    RecordHeader header = { key, length, 0 };
+    header.crc = crc(header, data);
+
+    uint8_t * bytes = (uint8_t *) page;
+    memcpy(bytes + page_fill, &header, sizeof(header));
+    memcpy(bytes + page_fill + sizeof(header), data, length);
+    page_keys[page_records] = key;
+    page_offsets[page_records] = page_fill;
+    ++page_records;
+    page_fill += sizeof(header) + length;
+    return true;
+}
+
+bool FlashStore::programPage() {
+    if(!page_fill)
+        return true;
+
+    if(!writable) {
+        requeue();
+        return false;
+    }
+
+    // A head sector left torn by a reset mid-erase is erased before its first page
+    bool ok = true;
+    uint32_t address = next_page;
+    if(address == sectorAddress(head) && !isBlank(address, SECTOR_SIZE))
+        ok = erase(head);
+
+    if(ok) {
+        memset((uint8_t *) page + page_fill, END, IAP::PAGE_SIZE - page_fill);
+        ok = program(address, page);
+    }
+
+    // Stopped since the check above, so the page was never programmed
+    if(!ok && !writable) {
+        requeue();
+        return false;
+    }
+
+    if(ok) {
+        ok = memcmp(IAP::read(address), page, IAP::PAGE_SIZE) == 0;
+        // Even a failed page may be partly programmed, so it isn't used again
+        next_page += IAP::PAGE_SIZE;
+    }
+
+    if(ok) {
+        for(uint8_t r = 0; r < page_records; ++r)
+            latest[page_keys[r]] = address + page_offsets[r];
+    } else {
+        dropped += page_records;
+    }
+
+    page_fill = 0;
+    page_records = 0;
+    return ok;
+}
+
+bool FlashStore::advance() {
+    // retire() keeps the sector after the head erased, so this only erases one it failed on
+    uint8_t target = (head + 1) % Config::STORE_SECTORS;
+    if(!isBlank(sectorAddress(target), SECTOR_SIZE) && !erase(target))
+        return false;
+
+    head = target;
+    ++sequence;
+    next_page = sectorAddress(head);
+
+    // The sector after the new head is the oldest, unless the ring hasn't wrapped yet
+    return retire((head + 1) % Config::STORE_SECTORS);
+}
+
+bool FlashStore::retire(uint8_t sector) {
+    uint32_t start = sectorAddress(sector);
+    if(isBlank(start, SECTOR_SIZE))
+        return true;
+
+    // Live records are committed in the head before the old copies are erased
+    for(uint8_t key = 0; key < Config::STORE_KEYS; ++key) {
+        uint32_t address = latest[key];
+        if(address < start || address >= start + SECTOR_SIZE)
+            continue;
+        const RecordHeader * header = (const RecordHeader *) IAP::read(address);
+        if(!append(key, IAP::read(address) + sizeof(RecordHeader), header->length))
+            return false;
+    }
+    if(!programPage())
+        return false;
+
+    return erase(sector);
+}
+
+bool FlashStore::erase(uint8_t sector) {
+    // Checked under the lock, so setWritable(false) can't slip in between
+    flash.lock();
+    bool ok = writable;
+    if(ok) {
+        ++erases;
+        ok = IAP::erase(Config::STORE_FIRST_SECTOR + sector) == IAP::CMD_SUCCESS;
+    }
+    flash.unlock();
+
+    return ok && isBlank(sectorAddress(sector), SECTOR_SIZE);
+}
+
+bool FlashStore::program(uint32_t address, const uint32_t * data) {
+    flash.lock();
+    bool ok = writable && IAP::program(address, data) == IAP::CMD_SUCCESS;
+    flash.unlock();
+    return ok;
+}
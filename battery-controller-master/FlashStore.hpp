@@ -0,0 +1,165 @@
+#ifndef FLASH_STORE_HPP
+#define FLASH_STORE_HPP
+
+#include "BCConfig.hpp"
+#include "IAP.hpp"
+#include <mbed.h>
+
+/** Persistent key/value records in spare flash sectors, written as an append-only log.
+ *
+ * write() only copies the record into a RAM buffer, replacing any value of the same key still
+ * waiting there, so it is cheap enough for the control loop.  A low priority thread commits
+ * the buffer to flash, but only while setWritable() allows it (contactors open), as flash
+ * operations hold off interrupts, and at most every Config::STORE_FLUSH_PERIOD unless a
+ * record is urgent.
+ *
+ * Flash layout: Config::STORE_SECTORS sectors used in turn as a ring.  A sector in use starts
+ * with a header holding its sequence number, followed by records packed into 256 byte pages,
+ * each page programmed once.  A record is a key, length and CRC-16 followed by its data; the
+ * latest record of a key is its value.  When the head sector fills, writing moves to the next
+ * sector, which is always kept erased, and the live records of the oldest sector are copied
+ * forward before it is erased to become the next spare.  Every sector is erased in turn, which
+ * spreads the wear.
+ *
+ * Power can fail at any point: a torn header, page or record fails its check and is ignored, older
+ * records are never touched until their live copies have been committed, and a sector torn by
+ * an interrupted erase is erased again.  A value that was still in RAM is lost.
+ */
+class FlashStore {
+    public:
+        /** Find the latest committed record of every key. */
+        FlashStore();
+
+        /** Read the latest value of a key, waiting in RAM or committed.
+         * @param length Expected length, a record of any other length is ignored.
+         * @return False if there is no such record.
+         */
+        bool read(uint8_t key, void * data, uint8_t length);
+
+        /** Read the latest value of a key, whatever its length.
+         * @param data Room for Config::STORE_MAX_RECORD bytes.
+         * @return Length of the value, or -1 if there is no such record.
+         */
+        int16_t read(uint8_t key, void * data);
+
+        /** Queue a value for flash.
+         * @param key Below Config::STORE_KEYS.
+         * @param length Up to Config::STORE_MAX_RECORD bytes.
+         * @param urgent Commit as soon as flash is writable rather than at the next flush period.
+         * @return False if the RAM buffer is full and the record was dropped.
+         */
+        bool write(uint8_t key, const void * data, uint8_t length, bool urgent = false);
+
+        /** Allow or stop flash operations, which hold off interrupts for up to ~100 ms.  Stopping
+         *  waits for an operation already started to finish, so none runs once this returns. */
+        void setWritable(bool writable);
+
+        /** True if the program image reaches into the store's sectors, which are then never
+         *  written. */
+        bool isReadOnly();
+
+        /** Bytes of records waiting in the RAM buffer, with their overhead. */
+        uint16_t getWaiting();
+
+        /** Records dropped since power up for a full buffer or a failed flash operation. */
+        uint32_t getDropped();
+
+        /** Sector erases since power up. */
+        uint32_t getErases();
+
+    private:
+        static constexpr uint32_t MAGIC = 0x42435331; // "BCS1"
+        static constexpr uint8_t END = 0xFF; // Key of erased flash, ends a page
+
+        struct SectorHeader {
+            uint32_t magic;
+            uint32_t sequence;
+            uint32_t check; // ~sequence: Programming only clears bits, so a torn header can't match
+        };
+
+        struct RecordHeader {
+            uint8_t key;
+            uint8_t length;
+            uint16_t crc; // Of key, length and data
+        };
+
+        static_assert(Config::STORE_KEYS <= END, "Store key space overlaps erased flash!");
+        static_assert(sizeof(SectorHeader) + sizeof(RecordHeader) + Config::STORE_MAX_RECORD <= IAP::PAGE_SIZE,
+                "Store records must fit in a page!");
+
+        static uint16_t crc(const RecordHeader & header, const uint8_t * data);
+        static uint32_t sectorAddress(uint8_t sector);
+        static bool isBlank(uint32_t address, uint32_t length);
+
+        /** Read the latest value of a key, of any length if length is negative. */
+        int16_t fetch(uint8_t key, void * data, int16_t length);
+
+        /** Address of the latest valid record of a key, or 0. */
+        uint32_t find(uint8_t key);
+
+        /** Index the records of one sector, returning the end of its last written page. */
+        uint32_t scan(uint8_t sector);
+
+        /** Flush thread: commit the RAM buffer while flash is writable. */
+        void flusher();
+
+        /** Commit the RAM buffer, stopping early if flash stops being writable. */
+        void flush();
+
+        /** Put the records of the page being built back in the RAM buffer, behind any newer
+         *  values of their keys, and empty the page. */
+        void requeue();
+
+        /** Queue a record.  Interrupts must be disabled.
+         * @param replace Replace a waiting value of the same key, rather than keep it.
+         */
+        bool queue(uint8_t key, const void * data, uint8_t length, bool replace);
+
+        /** Add a record to the page being built, programming pages and moving sector as needed. */
+        bool append(uint8_t key, const uint8_t * data, uint8_t length);
+
+        /** Program the page being built, then index its records.  If flash isn't writable the
+         *  records are requeued instead. */
+        bool programPage();
+
+        /** Move to the spare sector, then retire the oldest. */
+        bool advance();
+
+        /** Copy the live records of a sector to the head, then erase it. */
+        bool retire(uint8_t sector);
+
+        bool erase(uint8_t sector);
+
+        /** Program one page if flash is writable, holding off setWritable(false) meanwhile. */
+        bool program(uint32_t address, const uint32_t * data);
+
+        // Latest committed record of every key, 0 for none
+        uint32_t latest[Config::STORE_KEYS];
+
+        // Head of the log
+        uint8_t head; // Sector index in the ring
+        uint32_t sequence; // Of the head sector
+        uint32_t next_page; // Address
+
+        // Page being built by the flush thread
+        uint32_t page[IAP::PAGE_SIZE / 4];
+        uint16_t page_fill;
+        uint8_t page_keys[IAP::PAGE_SIZE / sizeof(RecordHeader)];
+        uint8_t page_offsets[IAP::PAGE_SIZE / sizeof(RecordHeader)];
+        uint8_t page_records;
+
+        // Records waiting for flash: key, length, data
+        uint8_t pending[Config::STORE_BUFFER];
+        uint16_t pending_length;
+        uint8_t record[Config::STORE_MAX_RECORD]; // Being moved from pending to the page
+
+        Mutex flash; // Held across each flash operation and by setWritable(false)
+        bool read_only;
+        volatile bool writable;
+        volatile bool urgent;
+        volatile uint32_t dropped;
+        uint32_t erases;
+        Thread thread;
+};
+
+#endif
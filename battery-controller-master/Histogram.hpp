@@ -0,0 +1,72 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <mbed.h>
+
+/** Counts of values in N equal width bins, the last bin also counting everything above it.
+ *
+ * Counts are 16 bit.  Rather than saturate, every bin is halved when one would overflow, so the
+ * shape keeps following recent values.  add() may be called from an interrupt handler, readers
+ * in thread context can see a count one add() out of date.
+ *
+ * @tparam BIN Bin width.
+ * @tparam N Number of bins.
+ */
+template<uint32_t BIN, uint8_t N>
+class Histogram {
+    public:
+        static_assert(BIN > 0 && N > 0, "Histogram must have bins!");
+
+        Histogram() {
+            for(uint8_t i = 0; i < N; ++i)
+                bins[i] = 0;
+        }
+
+        /** Count a value. */
+        void add(uint32_t value) {
+            uint32_t bin = value / BIN;
+            if(bin >= N)
+                bin = N - 1;
+
+            if(bins[bin] == UINT16_MAX)
+                for(uint8_t i = 0; i < N; ++i)
+                    bins[i] >>= 1;
+            ++bins[bin];
+        }
+
+        /** Count in one bin, which covers [bin * BIN, (bin + 1) * BIN). */
+        uint16_t get(uint8_t bin) const {
+            return bins[bin];
+        }
+
+        /** Sum of all bins. */
+        uint32_t total() const {
+            uint32_t sum = 0;
+            for(uint8_t i = 0; i < N; ++i)
+                sum += bins[i];
+            return sum;
+        }
+
+        /** Upper edge of the bin holding a percentile, or 0 if nothing has been counted.
+         * @param percent Percentile, 0-100.
+         */
+        uint32_t percentile(uint8_t percent) const {
+            uint32_t count = total();
+            if(count == 0)
+                return 0;
+
+            uint32_t target = (count * percent + 99) / 100;
+            uint32_t sum = 0;
+            for(uint8_t i = 0; i < N; ++i) {
+                sum += bins[i];
+                if(sum >= target && sum > 0)
+                    return (i + 1) * BIN;
+            }
+            return N * BIN;
+        }
+
+    private:
+        volatile uint16_t bins[N];
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "IAP.hpp"
+
+#if defined(__ARMCC_VERSION)
+extern "C" char Load$$LR$$LR_IROM1$$Limit[];
+#elif defined(__GNUC__)
+extern "C" char __etext[], __data_start__[], __data_end__[];
+#else
+#error "Program image end not known for this toolchain!"
+#endif
+
+namespace IAP {
+    namespace {
+        enum Command {
+            PREPARE = 50,
+            COPY_RAM_TO_FLASH = 51,
+            ERASE = 52
+        };
+
+        typedef void (*Entry)(uint32_t command[], uint32_t result[]);
+        const Entry iap = (Entry) 0x1FFF1FF1; // Thumb entry point in the boot ROM
+
+        uint32_t call(uint32_t command[5]) {
+            uint32_t result[5];
+            iap(command, result);
+            return result[0];
+        }
+
+        /** Unlock a sector for the next erase or program. */
+        uint32_t prepare(uint8_t sector) {
+            uint32_t command[5] = { PREPARE, sector, sector };
+            return call(command);
+        }
+
+        uint8_t sectorOf(uint32_t address) {
+            return address < 0x10000UL ? address / 0x1000UL : 16 + (address - 0x10000UL) / 0x8000UL;
+        }
+    }
+
+    // Prepared and used with interrupts disabled throughout, so another thread can't take the
+    // prepare in between
+
+    uint32_t erase(uint8_t sector) {
+        if(sectorAddress(sector) < imageEnd())
+            return INVALID_SECTOR;
+
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        uint32_t status = prepare(sector);
+        if(status == CMD_SUCCESS) {
+            uint32_t command[5] = { ERASE, sector, sector, SystemCoreClock / 1000 };
+            status = call(command);
+        }
+        __set_PRIMASK(primask);
+        return status;
+    }
+
+    uint32_t program(uint32_t address, const uint32_t * data) {
+        if(sectorAddress(sectorOf(address)) < imageEnd())
+            return INVALID_SECTOR;
+
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        uint32_t status = prepare(sectorOf(address));
+        if(status == CMD_SUCCESS) {
+            uint32_t command[5] = { COPY_RAM_TO_FLASH, address, (uint32_t) data, PAGE_SIZE, SystemCoreClock / 1000 };
+            status = call(command);
+        }
+        __set_PRIMASK(primask);
+        return status;
+    }
+
+    const uint8_t * read(uint32_t address) {
+        return (const uint8_t *) address;
+    }
+
+    uint32_t imageEnd() {
+#if defined(__ARMCC_VERSION)
+        return (uint32_t) Load$$LR$$LR_IROM1$$Limit;
+#else
+        // Initial values of .data are loaded from just after the code
+        return (uint32_t) __etext + (__data_end__ - __data_start__);
+#endif
+    }
+}
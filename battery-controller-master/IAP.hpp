@@ -0,0 +1,47 @@
+#ifndef IAP_HPP
+#define IAP_HPP
+
+#include <mbed.h>
+
+/** Flash programming through the LPC1768 boot ROM's in-application programming calls.
+ *
+ * Flash can't be read while it is being written or erased, and the vector table and handlers
+ * are in flash, so interrupts are disabled for each call: about 1 ms to program a page and
+ * 100 ms to erase a 32 KB sector.  Only erased bytes can be programmed, and a page is only
+ * programmed once between erases.  Calls may come from more than one thread.
+ */
+namespace IAP {
+    enum Status {
+        CMD_SUCCESS = 0,
+        INVALID_SECTOR = 7, // Also returned here for a sector holding the program image
+        // Anything else is a boot ROM error code
+    };
+
+    constexpr uint32_t PAGE_SIZE = 256; // bytes: Smallest write
+
+    /** Start address of a sector: 16 4 KB sectors, then 32 KB sectors. */
+    constexpr uint32_t sectorAddress(uint8_t sector) {
+        return sector < 16 ? sector * 0x1000UL : 0x10000UL + (sector - 16) * 0x8000UL;
+    }
+
+    constexpr uint32_t sectorSize(uint8_t sector) {
+        return sector < 16 ? 0x1000UL : 0x8000UL;
+    }
+
+    /** Erase a sector, unless it holds part of the program image. */
+    uint32_t erase(uint8_t sector);
+
+    /** Program one page, unless its sector holds part of the program image.
+     * @param address Flash address, PAGE_SIZE aligned.
+     * @param data PAGE_SIZE bytes in RAM, word aligned.
+     */
+    uint32_t program(uint32_t address, const uint32_t * data);
+
+    /** Flash contents at an address. */
+    const uint8_t * read(uint32_t address);
+
+    /** End of the program image in flash, code and initialised data, from the linker. */
+    uint32_t imageEnd();
+}
+
+#endif
@@ -23,6 +23,11 @@ namespace {
         return 3 << ((((uint32_t)pin - (uint32_t)P0_0) & 0xF) << 1);
     }
 
+    template<PinName pin>
+    __attribute__((always_inline)) inline constexpr uint32_t getConfShift() {
+        return (((uint32_t)pin - (uint32_t)P0_0) & 0xF) << 1;
+    }
+
     template<PinName pin>
     __attribute__((always_inline)) inline constexpr uint32_t getConfPortIndex() {
         return ((uint32_t)pin - (uint32_t)P0_0) >> 4;
@@ -80,6 +85,55 @@ namespace IOTemplates {
         getPort<pin>()->FIODIR &= ~getBit<pin>();
     }
 
+    /** Select a pin function, e.g. 0 for GPIO.  Interrupts are held off for the
+     *  read-modify-write, so it is safe against the same from an interrupt handler.
+     *
+     * @tparam pin Pin number (LED1-LED4 or 5-30)
+     */
+    template<PinName pin>
+    __attribute__((always_inline)) inline void setFunction(uint8_t function) {
+        static_assert(pin != NC, "Invalid pin number!");
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        volatile uint32_t & pinsel = PINCONARRAY->PINSEL[getConfPortIndex<pin>()];
+        pinsel = (pinsel & ~getConfPin<pin>()) | ((uint32_t) function << getConfShift<pin>());
+        __set_PRIMASK(primask);
+    }
+
+    /** PWM1 channel of a pin (function 1 of P2.0-P2.5, p21-p26), or 0 if it has none.
+     *
+     * @tparam pin Pin number (LED1-LED4 or 5-30)
+     */
+    template<PinName pin>
+    __attribute__((always_inline)) inline constexpr uint8_t pwmChannel() {
+        return pin >= P2_0 && pin <= P2_5 ? pin - P2_0 + 1 : 0;
+    }
+
+    /** Drive a pin from its PWM1 channel at a fraction of the PWM1 period, which must already be
+     *  running (e.g. set up by a PwmOut).  setFunction<pin>(0) hands it back to GPIO.
+     *
+     * @tparam pin Pin number (p21-p26)
+     * @param duty Duty cycle in %.
+     */
+    template<PinName pin>
+    __attribute__((always_inline)) inline void startPWM(uint8_t duty) {
+        constexpr uint8_t channel = pwmChannel<pin>();
+        static_assert(channel != 0, "Pin has no PWM!");
+
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        uint32_t match = (uint64_t) LPC_PWM1->MR0 * duty / 100;
+        if(channel <= 3)
+            (&LPC_PWM1->MR1)[channel - 1] = match;
+        else
+            (&LPC_PWM1->MR4)[channel - 4] = match;
+        LPC_PWM1->LER |= 1 << channel;
+        LPC_PWM1->PCR |= 1 << (8 + channel);
+        __set_PRIMASK(primask);
+
+        setFunction<pin>(1);
+    }
+
     /** Set output pin to high value.
      *
      * @tparam pin Pin number (LED1-LED4 or 5-30)
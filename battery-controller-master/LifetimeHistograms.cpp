@@ -0,0 +1,135 @@
+#include "LifetimeHistograms.hpp"
+#include <string.h>
+
+namespace {
+    constexpr uint8_t CELLS = Config::NUM_CMUs * 12;
+
+    // Not loaded or zeroed by the startup code, so filled in by the constructor
+    uint32_t voltage_seconds[CELLS][Config::HISTOGRAM_CELL_VOLTAGE_BANDS] __attribute__((section("AHBSRAM1")));
+    uint16_t voltage_ms[CELLS][Config::HISTOGRAM_CELL_VOLTAGE_BANDS] __attribute__((section("AHBSRAM1")));
+    uint8_t voltage_band[CELLS] __attribute__((section("AHBSRAM1"))); // Of the last scan
+    uint32_t temperature_seconds[CELLS][Config::HISTOGRAM_TEMPERATURE_BANDS] __attribute__((section("AHBSRAM1")));
+    uint16_t temperature_ms[CELLS][Config::HISTOGRAM_TEMPERATURE_BANDS] __attribute__((section("AHBSRAM1")));
+    uint8_t temperature_band[CELLS] __attribute__((section("AHBSRAM1")));
+
+    /** Band of a value: below first, then each width wide, the last also counting everything above. */
+    uint8_t band(int32_t value, int32_t first, int32_t width, uint8_t bands) {
+        if(value < first)
+            return 0;
+        int32_t b = (value - first) / width + 1;
+        return b < bands ? b : bands - 1;
+    }
+
+    void addTime(uint32_t & seconds, uint16_t & ms, uint32_t elapsed) {
+        ms += elapsed;
+        if(ms >= 1000) {
+            seconds += ms / 1000;
+            ms %= 1000;
+        }
+    }
+
+    void load(FlashStore & store, uint8_t key, void * data, uint8_t length) {
+        if(!store.read(key, data, length))
+            memset(data, 0, length);
+    }
+}
+
+LifetimeHistograms::LifetimeHistograms(FlashStore & store) : store(store),
+    current_band(0), current_timestamp(0), have_current(false),
+    cells_timestamp(0), have_cells(false), temperatures_timestamp(0), have_temperatures(false),
+    next_record(RECORDS) {
+    load(store, StoreRecords::CURRENT_TIME, current_seconds, sizeof(current_seconds));
+    memset(current_us, 0, sizeof(current_us));
+
+    for(uint8_t i = 0; i < StoreRecords::TIME_KEYS; ++i) {
+        uint8_t cell = i * StoreRecords::TIME_CELLS;
+        load(store, StoreRecords::CELL_VOLTAGE_TIME + i, voltage_seconds[cell],
+                sizeof(voltage_seconds[0]) * StoreRecords::TIME_CELLS);
+        load(store, StoreRecords::CELL_TEMPERATURE_TIME + i, temperature_seconds[cell],
+                sizeof(temperature_seconds[0]) * StoreRecords::TIME_CELLS);
+    }
+    memset(voltage_ms, 0, sizeof(voltage_ms));
+    memset(temperature_ms, 0, sizeof(temperature_ms));
+}
+
+void LifetimeHistograms::addCurrent(current_t current, timestamp_t timestamp) {
+    if(have_current) {
+        uint32_t & us = current_us[current_band];
+        us += timestamp - current_timestamp;
+        if(us >= 1000000) {
+            current_seconds[current_band] += us / 1000000;
+            us %= 1000000;
+        }
+    }
+
+    current_band = band(current, Config::HISTOGRAM_CURRENT_FIRST, Config::HISTOGRAM_CURRENT_BAND,
+            Config::HISTOGRAM_CURRENT_BANDS);
+    current_timestamp = timestamp;
+    have_current = true;
+}
+
+void LifetimeHistograms::addCells(const uint16_t cell_codes[Config::NUM_CMUs][12], timestamp_t timestamp) {
+    uint32_t elapsed = elapsedMs(cells_timestamp, timestamp);
+
+    for(uint8_t i = 0; i < CELLS; ++i) {
+        if(have_cells)
+            addTime(voltage_seconds[i][voltage_band[i]], voltage_ms[i][voltage_band[i]], elapsed);
+        voltage_band[i] = band(cell_codes[i / 12][i % 12] / 10, Config::HISTOGRAM_CELL_VOLTAGE_FIRST,
+                Config::HISTOGRAM_CELL_VOLTAGE_BAND, Config::HISTOGRAM_CELL_VOLTAGE_BANDS);
+    }
+    have_cells = true;
+}
+
+void LifetimeHistograms::addTemperatures(const uint8_t temperatures[Config::NUM_CMUs][12], timestamp_t timestamp) {
+    uint32_t elapsed = elapsedMs(temperatures_timestamp, timestamp);
+
+    for(uint8_t i = 0; i < CELLS; ++i) {
+        if(have_temperatures)
+            addTime(temperature_seconds[i][temperature_band[i]], temperature_ms[i][temperature_band[i]], elapsed);
+        // 255 is returned below the thermistor table, i.e. colder than 0 C
+        uint8_t raw = temperatures[i / 12][i % 12];
+        temperature_band[i] = band(raw == 255 ? 0 : raw * 10, Config::HISTOGRAM_TEMPERATURE_FIRST,
+                Config::HISTOGRAM_TEMPERATURE_BAND, Config::HISTOGRAM_TEMPERATURE_BANDS);
+    }
+    have_temperatures = true;
+}
+
+void LifetimeHistograms::save() {
+    next_record = 0;
+}
+
+void LifetimeHistograms::saveNext() {
+    if(next_record >= RECORDS)
+        return;
+
+    const void * data;
+    uint8_t key;
+    uint8_t length;
+    if(next_record == 0) {
+        key = StoreRecords::CURRENT_TIME;
+        data = current_seconds;
+        length = sizeof(current_seconds);
+    } else if(next_record <= StoreRecords::TIME_KEYS) {
+        uint8_t i = next_record - 1;
+        key = StoreRecords::CELL_VOLTAGE_TIME + i;
+        data = voltage_seconds[i * StoreRecords::TIME_CELLS];
+        length = sizeof(voltage_seconds[0]) * StoreRecords::TIME_CELLS;
+    } else {
+        uint8_t i = next_record - 1 - StoreRecords::TIME_KEYS;
+        key = StoreRecords::CELL_TEMPERATURE_TIME + i;
+        data = temperature_seconds[i * StoreRecords::TIME_CELLS];
+        length = sizeof(temperature_seconds[0]) * StoreRecords::TIME_CELLS;
+    }
+
+    // The other half of the buffer is left for faults
+    if(store.getWaiting() + 2 + length > Config::STORE_BUFFER / 2)
+        return;
+    if(store.write(key, data, length, true))
+        ++next_record;
+}
+
+uint32_t LifetimeHistograms::elapsedMs(timestamp_t & last, timestamp_t timestamp) {
+    uint32_t elapsed = (timestamp - last) / 1000;
+    last += elapsed * 1000;
+    return elapsed < MAX_ELAPSED ? elapsed : MAX_ELAPSED;
+}
@@ -0,0 +1,82 @@
+#ifndef LIFETIME_HISTOGRAMS_HPP
+#define LIFETIME_HISTOGRAMS_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include "BCStoreRecords.hpp"
+#include "FlashStore.hpp"
+#include <mbed.h>
+
+/** Time over the life of the pack spent in each band of cell voltage and cell temperature, per
+ *  cell, and of pack current, kept in the FlashStore for ageing analysis.
+ *
+ * Each sample holds until the next, so its band is credited with the time between them.  Time
+ * is carried from a ms (us for current) remainder into whole seconds, so updates are a band
+ * lookup and an add, and nothing is lost to rounding.  The counts are in AHB SRAM bank 1 with
+ * the black box, loaded from the store at boot.
+ *
+ * save() marks every record to be saved, and saveNext() queues them one at a time while flash
+ * is writable, only while the store's RAM buffer is under half full, so fault records always
+ * have room.  A power cut loses the time since the last save.
+ */
+class LifetimeHistograms {
+    public:
+        /** Load the counts, starting from zero for any record missing. */
+        LifetimeHistograms(FlashStore & store);
+
+        /** Count the time since the last current sample at its band.
+         * @param current Pack current, positive for charge.
+         * @param timestamp Time the sample was taken in us.
+         */
+        void addCurrent(current_t current, timestamp_t timestamp);
+
+        /** Count the time since the last cell scan at each cell's voltage band.
+         * @param cell_codes Cell voltages in 1/10 mV
+         * @param timestamp Time of the scan in us.
+         */
+        void addCells(const uint16_t cell_codes[Config::NUM_CMUs][12], timestamp_t timestamp);
+
+        /** Count the time since the last temperature scan at each cell's temperature band.
+         * @param temperatures CMUControl::temp_scaled
+         * @param timestamp Time of the scan in us.
+         */
+        void addTemperatures(const uint8_t temperatures[Config::NUM_CMUs][12], timestamp_t timestamp);
+
+        /** Save every record, as saveNext() allows. */
+        void save();
+
+        /** Queue the next record waiting to be saved, if the store has room to spare.  Call
+         *  regularly while flash is writable. */
+        void saveNext();
+
+    private:
+        static constexpr uint8_t RECORDS = 1 + 2 * StoreRecords::TIME_KEYS;
+        static constexpr uint32_t MAX_ELAPSED = 60000; // ms: Longer gaps between scans, from a stalled loop, count as this
+
+        static_assert(sizeof(uint32_t) * StoreRecords::TIME_CELLS * Config::HISTOGRAM_CELL_VOLTAGE_BANDS
+                <= Config::STORE_MAX_RECORD
+                && sizeof(uint32_t) * StoreRecords::TIME_CELLS * Config::HISTOGRAM_TEMPERATURE_BANDS
+                <= Config::STORE_MAX_RECORD
+                && sizeof(uint32_t) * Config::HISTOGRAM_CURRENT_BANDS <= Config::STORE_MAX_RECORD,
+                "Histogram records must fit in the store!");
+
+        /** Whole ms since a timestamp, which is moved on by them. */
+        static uint32_t elapsedMs(timestamp_t & last, timestamp_t timestamp);
+
+        FlashStore & store;
+
+        uint32_t current_seconds[Config::HISTOGRAM_CURRENT_BANDS];
+        uint32_t current_us[Config::HISTOGRAM_CURRENT_BANDS];
+        uint8_t current_band; // Of the last sample
+        timestamp_t current_timestamp;
+        bool have_current;
+
+        timestamp_t cells_timestamp;
+        bool have_cells;
+        timestamp_t temperatures_timestamp;
+        bool have_temperatures;
+
+        uint8_t next_record; // To save, RECORDS once all are queued
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include "LifetimeStats.hpp"
+#include "BCOutputInterface.hpp"
+#include <limits.h>
+#include <string.h>
+
+static_assert(BCOutputInterface::NUM_CONTACTORS == 4, "Lifetime record holds four contactors!");
+
+LifetimeStats::LifetimeStats(FlashStore & store) : store(store),
+    energy_in(0), energy_out(0), last_power(0), last_timestamp(0), have_sample(false) {
+    if(!store.read(StoreRecords::LIFETIME, &base, sizeof(base))) {
+        memset(&base, 0, sizeof(base));
+        base.cellMin = INT_MAX;
+        base.cellMax = INT_MIN;
+        base.temperatureMin = UINT16_MAX;
+        base.temperatureMax = 0;
+    }
+    ++base.boots;
+    total = base;
+}
+
+void LifetimeStats::addSample(current_t current, voltage_t voltage, timestamp_t timestamp) {
+    if(have_sample) {
+        // Each sample's power holds until the next, so the counts stay monotonic
+        uint64_t energy = (uint64_t) (last_power < 0 ? -last_power : last_power) * (timestamp - last_timestamp);
+        if(last_power > 0)
+            energy_in += energy;
+        else
+            energy_out += energy;
+    }
+
+    last_power = (int64_t) current * voltage / 1000;
+    last_timestamp = timestamp;
+    have_sample = true;
+}
+
+void LifetimeStats::setCells(voltage_t cell_min, voltage_t cell_max) {
+    if(cell_min < total.cellMin)
+        total.cellMin = cell_min;
+    if(cell_max > total.cellMax)
+        total.cellMax = cell_max;
+}
+
+void LifetimeStats::setTemperatures(temperature_t temperature_min, temperature_t temperature_max) {
+    if(temperature_min < total.temperatureMin)
+        total.temperatureMin = temperature_min;
+    if(temperature_max > total.temperatureMax)
+        total.temperatureMax = temperature_max;
+}
+
+uint32_t LifetimeStats::addFault() {
+    return total.faults++;
+}
+
+void LifetimeStats::save(time_t uptime, uint32_t charged, uint32_t discharged, const uint32_t closes[4], bool urgent) {
+    total.charged = base.charged + charged;
+    total.discharged = base.discharged + discharged;
+    total.energyIn = base.energyIn + energy_in / MW_US_PER_WH;
+    total.energyOut = base.energyOut + energy_out / MW_US_PER_WH;
+    for(uint8_t i = 0; i < 4; ++i)
+        total.contactorCloses[i] = base.contactorCloses[i] + closes[i];
+    total.uptime = base.uptime + uptime / 1000;
+
+    store.write(StoreRecords::LIFETIME, &total, sizeof(total), urgent);
+}
+
+const StoreRecords::Lifetime & LifetimeStats::get() {
+    return total;
+}
@@ -0,0 +1,66 @@
+#ifndef LIFETIME_STATS_HPP
+#define LIFETIME_STATS_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include "BCStoreRecords.hpp"
+#include "FlashStore.hpp"
+#include <mbed.h>
+
+/** Totals over the life of the pack, kept in the FlashStore.
+ *
+ * The totals loaded at boot are the base, and everything counted since boot is added to them
+ * when they are saved, so a save that is lost to a power cut only loses the time since the last
+ * one.  Energy is integrated from every current sample at the latest pack voltage, in mW us, so
+ * nothing is lost to rounding between samples.
+ */
+class LifetimeStats {
+    public:
+        /** Load the totals and count this boot. */
+        LifetimeStats(FlashStore & store);
+
+        /** Integrate a current sample into the energy totals.
+         * @param current Pack current, positive for charge.
+         * @param voltage Pack voltage in mV.
+         * @param timestamp Time the sample was taken in us.
+         */
+        void addSample(current_t current, voltage_t voltage, timestamp_t timestamp);
+
+        /** Track the cell voltage extremes, once a scan has given them. */
+        void setCells(voltage_t cell_min, voltage_t cell_max);
+
+        /** Track the cell temperature extremes. */
+        void setTemperatures(temperature_t temperature_min, temperature_t temperature_max);
+
+        /** Count a fault record.
+         * @return Its number, for StoreRecords::Fault::number.
+         */
+        uint32_t addFault();
+
+        /** Queue the totals for the store.
+         * @param uptime Time since boot in ms.
+         * @param charged Charge counted into the pack since boot in mAh.
+         * @param discharged Charge counted out of the pack since boot in mAh.
+         * @param closes Contactor closes since boot, by BCOutputInterface::Contactor.
+         * @param urgent Commit as soon as flash is writable.
+         */
+        void save(time_t uptime, uint32_t charged, uint32_t discharged, const uint32_t closes[4], bool urgent);
+
+        /** Totals as last saved. */
+        const StoreRecords::Lifetime & get();
+
+    private:
+        static constexpr uint64_t MW_US_PER_WH = 3600000000000ULL;
+
+        FlashStore & store;
+        StoreRecords::Lifetime base; // As loaded at boot, plus this boot
+        StoreRecords::Lifetime total;
+
+        uint64_t energy_in; // mW us
+        uint64_t energy_out; // mW us
+        int64_t last_power; // mW
+        timestamp_t last_timestamp;
+        bool have_sample;
+};
+
+#endif
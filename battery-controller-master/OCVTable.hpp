@@ -0,0 +1,127 @@
+#ifndef OCV_TABLE_HPP
+#define OCV_TABLE_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include <mbed.h>
+
+/* Cell open circuit voltage curve, as state of charge (0-65535 = empty-full) every 10 mV from
+ *  3000 mV to 4200 mV.
+ *
+ * Generated from the piecewise linear fit (in Ah of a 3.2 Ah cell) previously used to compute
+ *  SOC, clamped to 0-full and made monotonic so it can be searched in both directions:
+ *
+ * #!/usr/bin/env python
+ *
+ * SEGMENTS = [(4.17, 4.2303, 0.437), (4.14, 4.197, 0.206), (4.12, 4.183, 0.149),
+ *             (4.09, 4.216, 0.229), (3.5, 4.215, 0.262), (3.485, 4.021, 0.195),
+ *             (3.32, 5.28, 0.653), (3.0, 6.516, 1.065)]
+ *
+ * def capacity(v):
+ *     if v >= 4.2:
+ *         return 3.2
+ *     for low, offset, slope in SEGMENTS:
+ *         if v > low:
+ *             return 3.2 + (v - offset) / slope
+ *     return 0
+ *
+ * table = []
+ * for mv in range(3000, 4201, 10):
+ *     soc = round(capacity(mv / 1000.0) / 3.2 * 65535)
+ *     table.append(min(max(soc, table[-1] if table else 0), 65535))
+ *
+ * for i in range(0, len(table), 8):
+ *     print("    " + " ".join("%5d," % t for t in table[i:i+8]))
+ */
+namespace OCV {
+    constexpr voltage_t TABLE_MIN = 3000; // mV
+    constexpr voltage_t TABLE_STEP = 10; // mV
+    constexpr uint16_t FULL = 65535;
+
+    constexpr uint16_t TABLE[] = {
+        0,     0,     0,     0,     0,     0,     0,     0,
+        0,     0,     0,    38,   231,   423,   615,   808,
+     1000,  1192,  1385,  1577,  1769,  1961,  2154,  2346,
+     2538,  2731,  2923,  3115,  3308,  3500,  3692,  3884,
+     4077,  4378,  4692,  5005,  5319,  5633,  5946,  6260,
+     6574,  6887,  7201,  7514,  7828,  8142,  8455,  8769,
+     9083,  9767, 10817, 10817, 11209, 11991, 12772, 13554,
+    14336, 15117, 15899, 16681, 17462, 18244, 19026, 19807,
+    20589, 21371, 22152, 22934, 23716, 24497, 25279, 26061,
+    26842, 27624, 28406, 29187, 29969, 30751, 31532, 32314,
+    33096, 33877, 34659, 35441, 36222, 37004, 37786, 38567,
+    39349, 40131, 40912, 41694, 42476, 43257, 44039, 44821,
+    45602, 46384, 47166, 47947, 48729, 49511, 50292, 51074,
+    51856, 52637, 53419, 54201, 54982, 55764, 55764, 56055,
+    56950, 58250, 59625, 60862, 61857, 62851, 63178, 63646,
+    65535
+    };
+
+    constexpr uint16_t TABLE_LEN = sizeof(TABLE) / sizeof(TABLE[0]);
+
+    /** Cell state of charge at an open circuit voltage.
+     *
+     * Uniform index into the table with integer linear interpolation.
+     *
+     * @param cell_voltage Cell voltage in mV.
+     * @return State of charge, 0-FULL.
+     */
+    inline uint16_t cellSOC(voltage_t cell_voltage) {
+        if(cell_voltage <= TABLE_MIN)
+            return TABLE[0];
+
+        uint32_t offset = cell_voltage - TABLE_MIN;
+        uint32_t i = offset / TABLE_STEP;
+        if(i >= TABLE_LEN - 1u)
+            return TABLE[TABLE_LEN - 1];
+
+        uint32_t fraction = offset % TABLE_STEP;
+        return TABLE[i] + (TABLE[i + 1] - TABLE[i]) * fraction / TABLE_STEP;
+    }
+
+    /** Cell open circuit voltage at a state of charge, the inverse of cellSOC().
+     *
+     * Binary search for the table segment, then integer linear interpolation.  Flat segments
+     * (repeated entries) are skipped, so the slope is always finite.
+     *
+     * @param soc State of charge, 0-FULL.
+     * @param[out] slope If not NULL, set to the slope of the segment in mV per FULL.
+     * @return Cell voltage in mV.
+     */
+    inline voltage_t cellVoltage(uint16_t soc, int32_t * slope = NULL) {
+        // Last entry at or below soc, and the next (larger) entry
+        uint16_t lo = 0;
+        uint16_t hi = TABLE_LEN - 1;
+        if(soc >= TABLE[hi])
+            lo = hi - 1;
+        while(hi - lo > 1) {
+            uint16_t mid = (lo + hi) / 2;
+            if(TABLE[mid] <= soc)
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        uint32_t span = TABLE[hi] - TABLE[lo];
+        if(slope)
+            *slope = (int32_t) TABLE_STEP * FULL / span;
+
+        uint32_t fraction = soc < TABLE[hi] ? soc - TABLE[lo] : span;
+        return TABLE_MIN + lo * TABLE_STEP + (voltage_t) (TABLE_STEP * fraction / span);
+    }
+
+    /** Remaining pack charge estimated from pack voltage.
+     *
+     * @param pack_voltage Pack voltage in mV.
+     * @param current Pack current in mA, used to compensate for cell resistance.
+     * @return Remaining charge in mAh.
+     */
+    inline int32_t packCharge(voltage_t pack_voltage, current_t current) {
+        voltage_t cell_voltage = pack_voltage / Config::NUM_CELLS_SERIES
+            - current * Config::CELL_RESISTANCE / (Config::NUM_CELLS_PARALLEL * 1000);
+
+        return (uint32_t) cellSOC(cell_voltage) * Config::PACK_CAPACITY / FULL;
+    }
+}
+
+#endif
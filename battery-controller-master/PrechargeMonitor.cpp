@@ -0,0 +1,128 @@
+#include "PrechargeMonitor.hpp"
+#include <math.h>
+
+PrechargeMonitor::PrechargeMonitor() {
+    start(0, 0);
+}
+
+void PrechargeMonitor::start(timestamp_t timestamp, voltage_t pack_voltage) {
+    start_time = timestamp;
+    last_time = timestamp;
+    this->pack_voltage = pack_voltage;
+    last_voltage = 0;
+    have_sample = false;
+
+    n = 0;
+    sum_x = 0;
+    sum_y = 0;
+    sum_xx = 0;
+    sum_xy = 0;
+    sum_yy = 0;
+
+    tau = 0;
+    final_voltage = 0;
+    final_error = 0;
+    predicted = 0;
+}
+
+PrechargeMonitor::Status PrechargeMonitor::update(timestamp_t timestamp, voltage_t car_voltage, current_t current) {
+    // Queued from before the precharge contactor closed
+    if((int32_t) (timestamp - start_time) < 0)
+        return IN_PROGRESS;
+
+    uint32_t dt = timestamp - last_time; // us
+
+    if(have_sample && dt > 0) {
+        // Slope between consecutive samples, taken at the midpoint voltage
+        float x = (car_voltage + last_voltage) / 2.0f;
+        float y = (car_voltage - last_voltage) * 1000.0f / dt;
+
+        ++n;
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+        sum_yy += y * y;
+    }
+
+    have_sample = true;
+    last_time = timestamp;
+    last_voltage = car_voltage;
+
+    float threshold = Config::PRECHARGE_COMPLETE_PERCENTAGE * pack_voltage;
+    float margin = Config::PRECHARGE_FIT_MARGIN * pack_voltage;
+    bool fitted = fit();
+
+    if(car_voltage > threshold) {
+        if(fitted && final_voltage > threshold + margin)
+            return COMPLETE;
+
+        // With negligible bus capacitance there is no curve to fit, so fall back to a fixed time
+        return elapsed() > Config::PRECHARGE_MIN_PERIOD ? COMPLETE : IN_PROGRESS;
+    }
+
+    // Give the fit enough samples that noise can't fail precharge
+    if(elapsed() < Config::PRECHARGE_OPEN_PERIOD)
+        return IN_PROGRESS;
+
+    if(car_voltage < Config::PRECHARGE_MIN_RISE * pack_voltage)
+        return abs(current) > Config::PRECHARGE_SHORT_CURRENT ? SHORT_CIRCUIT : OPEN_CIRCUIT;
+
+    if(fitted && 2 * final_error < margin) {
+        if(final_voltage < threshold - margin)
+            return SHORT_CIRCUIT;
+
+        if(predicted > Config::PRECHARGE_ERROR_PERIOD)
+            return TOO_SLOW;
+    }
+
+    return IN_PROGRESS;
+}
+
+bool PrechargeMonitor::fit() {
+    if(n < Config::PRECHARGE_MIN_SAMPLES)
+        return false;
+
+    float mean_x = sum_x / n;
+    float mean_y = sum_y / n;
+    float var_x = sum_xx / n - mean_x * mean_x;
+
+    // Voltage hasn't moved far enough to separate the slope from ADC noise
+    float min_spread = Config::PRECHARGE_MIN_RISE * pack_voltage;
+    if(16 * var_x < min_spread * min_spread)
+        return false;
+
+    // dV/dt = (Vf - V) / tau, so the slope of the fit is -1 / tau
+    float slope = (sum_xy / n - mean_x * mean_y) / var_x;
+    if(slope >= 0)
+        return false;
+
+    tau = -1 / slope;
+    final_voltage = mean_x + mean_y * tau;
+
+    // Final voltage is mean_x - mean_y / slope, so its error is mostly the slope's
+    float var_y = sum_yy / n - mean_y * mean_y;
+    float residual = n > 2 ? (var_y - slope * slope * var_x) * n / (n - 2) : 0;
+    float slope_error = residual > 0 ? sqrtf(residual / (n * var_x)) : 0;
+    final_error = fabsf(mean_y) * tau * tau * slope_error;
+
+    float threshold = Config::PRECHARGE_COMPLETE_PERCENTAGE * pack_voltage;
+    if(final_voltage > threshold && last_voltage < threshold)
+        predicted = elapsed() + tau * logf((final_voltage - last_voltage) / (final_voltage - threshold));
+    else
+        predicted = 0;
+
+    return true;
+}
+
+uint32_t PrechargeMonitor::elapsed() {
+    return (last_time - start_time) / 1000;
+}
+
+uint32_t PrechargeMonitor::predictedCompletion() {
+    return predicted;
+}
+
+voltage_t PrechargeMonitor::finalVoltage() {
+    return final_voltage;
+}
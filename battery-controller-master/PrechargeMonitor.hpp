@@ -0,0 +1,82 @@
+#ifndef PRECHARGE_MONITOR_HPP
+#define PRECHARGE_MONITOR_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include <mbed.h>
+
+/** Tracks car bus voltage during precharge against the expected RC charging curve.
+ *
+ * The bus charges through the precharge resistor as V(t) = Vf - (Vf - V0) * exp(-t / tau), so
+ * dV/dt = (Vf - V) / tau is linear in V.  Each new sample adds a point to a running least squares
+ * fit of dV/dt against V, giving the time constant and final voltage without waiting for them.
+ *
+ * Precharge is complete once the car voltage has crossed the threshold and the fitted final
+ * voltage shows it will stay there.  It fails early if the fitted final voltage is below the
+ * threshold (load or short on the bus), if the predicted completion is past the precharge
+ * timeout, or if the voltage never starts rising.  The fit only fails precharge once its final
+ * voltage is known to within the margin, as a few ADC counts of noise on a slow curve can put it
+ * anywhere early on.
+ */
+class PrechargeMonitor {
+    public:
+        enum Status {
+            IN_PROGRESS,
+            COMPLETE,
+            SHORT_CIRCUIT, // Bus settling below threshold, or precharge current with no rise
+            OPEN_CIRCUIT, // No rise and no precharge current
+            TOO_SLOW // Predicted to complete after Config::PRECHARGE_ERROR_PERIOD
+        };
+
+        PrechargeMonitor();
+
+        /** Begin monitoring once the precharge contactor has closed.
+         * @param timestamp Time in us.
+         * @param pack_voltage Voltage the bus is charging towards.
+         */
+        void start(timestamp_t timestamp, voltage_t pack_voltage);
+
+        /** Add a car voltage sample.  Samples taken before start() are ignored.
+         * @param timestamp Time of sample in us.
+         * @param car_voltage Car bus voltage.
+         * @param current Pack current at the time of the sample.
+         * @return Precharge status after this sample.
+         */
+        Status update(timestamp_t timestamp, voltage_t car_voltage, current_t current);
+
+        /** Time since start() in ms. */
+        uint32_t elapsed();
+
+        /** Predicted time from start() to completion in ms, or 0 if not yet known. */
+        uint32_t predictedCompletion();
+
+        /** Fitted final car voltage, or 0 if not yet known. */
+        voltage_t finalVoltage();
+
+    private:
+        /** Update tau and final voltage from the running sums.
+         * @return True if the fit is usable.
+         */
+        bool fit();
+
+        timestamp_t start_time;
+        timestamp_t last_time;
+        voltage_t pack_voltage;
+        voltage_t last_voltage;
+        bool have_sample;
+
+        // Least squares sums of x = V (mV), y = dV/dt (mV/ms)
+        uint16_t n;
+        float sum_x;
+        float sum_y;
+        float sum_xx;
+        float sum_xy;
+        float sum_yy;
+
+        float tau; // ms
+        float final_voltage; // mV
+        float final_error; // mV, standard error
+        uint32_t predicted; // ms
+};
+
+#endif
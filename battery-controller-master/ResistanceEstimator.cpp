@@ -0,0 +1,129 @@
+#include "ResistanceEstimator.hpp"
+#include "CurrentLimit.hpp"
+
+constexpr uint16_t ResistanceEstimator::DEFAULT_RESISTANCE;
+
+ResistanceEstimator::ResistanceEstimator() :
+    last_current(0),
+    last_timestamp(0),
+    have_scan(false),
+    sum_xx(0),
+    steps(0),
+    max_resistance(DEFAULT_RESISTANCE),
+    mean_resistance(DEFAULT_RESISTANCE),
+    max_cell(0),
+    charge_limit(Config::MAX_CHARGE_CURRENT),
+    discharge_limit(Config::MAX_DISCHARGE_CURRENT) {
+        memset(last_codes, 0, sizeof(last_codes));
+        memset(sum_xy, 0, sizeof(sum_xy));
+        for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell)
+            resistance[cell] = DEFAULT_RESISTANCE;
+    }
+
+void ResistanceEstimator::update(const uint16_t cell_codes[Config::NUM_CMUs][12], current_t current,
+        timestamp_t current_timestamp, timestamp_t scan_timestamp) {
+    // Unsigned subtraction handles ticker wrap, the current is always sampled before the scan
+    bool paired = (scan_timestamp - current_timestamp) / 1000 <= (uint32_t) Config::RESISTANCE_MAX_SKEW;
+    bool close = (scan_timestamp - last_timestamp) / 1000 <= (uint32_t) Config::RESISTANCE_MAX_INTERVAL;
+    current_t step = current - last_current;
+
+    bool valid = paired;
+    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+        uint16_t code = cell_codes[cell / 12][cell % 12];
+        valid = valid && code != 0 && code != UINT16_MAX;
+    }
+
+    if(valid && have_scan && close && abs(step) >= Config::RESISTANCE_MIN_STEP) {
+        sum_xx += (int64_t) step * step - (sum_xx >> Config::RESISTANCE_FORGET_SHIFT);
+
+        for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+            int32_t dv = (int32_t) cell_codes[cell / 12][cell % 12] - last_codes[cell];
+            sum_xy[cell] += (int64_t) dv * step - (sum_xy[cell] >> Config::RESISTANCE_FORGET_SHIFT);
+        }
+
+        if(steps < UINT16_MAX)
+            ++steps;
+        fit();
+    }
+
+    // A failed scan breaks the chain of steps
+    have_scan = valid;
+    if(valid) {
+        for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell)
+            last_codes[cell] = cell_codes[cell / 12][cell % 12];
+        last_current = current;
+        last_timestamp = scan_timestamp;
+    }
+
+    if(!valid)
+        return;
+
+    // The fit only sees the ohmic part of the resistance, polarisation adds the rest over seconds
+    charge_limit = Config::MAX_CHARGE_CURRENT;
+    discharge_limit = Config::MAX_DISCHARGE_CURRENT;
+    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+        int32_t ohmic = resistance[cell];
+        int32_t total = ohmic * Config::CELL_RESISTANCE / Config::CELL_OHMIC_RESISTANCE;
+        voltage_t ocv = last_codes[cell] / 10 - (int64_t) current * ohmic / 1000000;
+
+        // Already past a limit means no current that way at all
+        current_t charge = CurrentLimit::predicted(ocv, Config::MAX_CELL_VOLTAGE, total);
+        current_t discharge = CurrentLimit::predicted(ocv, Config::MIN_CELL_VOLTAGE, total);
+        charge = charge < 0 ? 0 : charge;
+        discharge = discharge > 0 ? 0 : discharge;
+        if(charge < charge_limit)
+            charge_limit = charge;
+        if(discharge > discharge_limit)
+            discharge_limit = discharge;
+    }
+}
+
+void ResistanceEstimator::fit() {
+    if(steps < Config::RESISTANCE_MIN_STEPS)
+        return;
+
+    uint32_t sum = 0;
+    max_resistance = 0;
+
+    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+        // 1/10 mV per mA is 100000 uOhm
+        int64_t r = sum_xy[cell] * 100000 / sum_xx;
+        resistance[cell] = r < 0 ? 0 : r > UINT16_MAX ? UINT16_MAX : r;
+
+        sum += resistance[cell];
+        if(resistance[cell] > max_resistance) {
+            max_resistance = resistance[cell];
+            max_cell = cell;
+        }
+    }
+
+    mean_resistance = sum / Config::NUM_CELLS_SERIES;
+}
+
+bool ResistanceEstimator::isValid() {
+    return steps >= Config::RESISTANCE_MIN_STEPS;
+}
+
+uint16_t ResistanceEstimator::getResistance(uint8_t cell) {
+    return resistance[cell];
+}
+
+uint16_t ResistanceEstimator::getMaxResistance() {
+    return max_resistance;
+}
+
+uint16_t ResistanceEstimator::getMeanResistance() {
+    return mean_resistance;
+}
+
+uint8_t ResistanceEstimator::getMaxCell() {
+    return max_cell;
+}
+
+current_t ResistanceEstimator::getChargeLimit() {
+    return charge_limit;
+}
+
+current_t ResistanceEstimator::getDischargeLimit() {
+    return discharge_limit;
+}
@@ -0,0 +1,77 @@
+#ifndef RESISTANCE_ESTIMATOR_HPP
+#define RESISTANCE_ESTIMATOR_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include <mbed.h>
+
+/** Online DC internal resistance of every series cell group.
+ *
+ * Between two consecutive CMU scans, a step in pack current (e.g. a change in motor demand)
+ * moves every cell voltage by dV = R * dI.  Steps are only used if the scans are close together,
+ * so the RC polarisation hasn't had time to move, and if the current was sampled right before
+ * each scan.  Each group keeps a running least squares fit of dV against dI through the origin,
+ * R = sum(dV dI) / sum(dI^2), with exponential forgetting so the estimate follows ageing and
+ * temperature.  dI is the same for every group, so sum(dI^2) is shared.
+ */
+class ResistanceEstimator {
+    public:
+        ResistanceEstimator();
+
+        /** Add a CMU scan.
+         * @param cell_codes Cell voltages in 1/10 mV as read by CMUControl.
+         * @param current Pack current in mA.
+         * @param current_timestamp Time the current was sampled in us.
+         * @param scan_timestamp Time the cells were scanned in us.
+         */
+        void update(const uint16_t cell_codes[Config::NUM_CMUs][12], current_t current,
+                timestamp_t current_timestamp, timestamp_t scan_timestamp);
+
+        /** True once enough current steps have been seen for the fit to mean anything. */
+        bool isValid();
+
+        /** Resistance of one cell group in uOhm, or the configured value until isValid(). */
+        uint16_t getResistance(uint8_t cell);
+
+        /** Highest and mean cell group resistance in uOhm. */
+        uint16_t getMaxResistance();
+        uint16_t getMeanResistance();
+
+        /** Index of the cell group with the highest resistance. */
+        uint8_t getMaxCell();
+
+        /** Predicted charge current that takes the first cell group to Config::MAX_CELL_VOLTAGE.
+         * @return Current in mA, positive.
+         */
+        current_t getChargeLimit();
+
+        /** Predicted discharge current that takes the first cell group to Config::MIN_CELL_VOLTAGE.
+         * @return Current in mA, negative.
+         */
+        current_t getDischargeLimit();
+
+    private:
+        static constexpr uint16_t DEFAULT_RESISTANCE =
+            Config::CELL_OHMIC_RESISTANCE * 1000 / Config::NUM_CELLS_PARALLEL; // uOhm
+
+        void fit();
+
+        uint16_t last_codes[Config::NUM_CELLS_SERIES];
+        current_t last_current;
+        timestamp_t last_timestamp;
+        bool have_scan;
+
+        int64_t sum_xx; // mA^2
+        int64_t sum_xy[Config::NUM_CELLS_SERIES]; // 1/10 mV mA
+        uint16_t steps; // Saturates
+
+        uint16_t resistance[Config::NUM_CELLS_SERIES]; // uOhm
+        uint16_t max_resistance;
+        uint16_t mean_resistance;
+        uint8_t max_cell;
+
+        current_t charge_limit;
+        current_t discharge_limit;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <mbed.h>
+
+/** Fixed size FIFO for one producer and one consumer, without locking.
+ *
+ * The producer only writes head and the consumer only writes tail, so push() and pop() may run
+ * concurrently from different threads or an interrupt.  Indices run freely and are masked on
+ * access, which is why the size must be a power of two.
+ *
+ * @tparam T Item type.
+ * @tparam N Capacity.
+ */
+template<typename T, uint32_t N>
+class RingBuffer {
+    public:
+        static_assert(N > 0 && (N & (N - 1)) == 0, "Ring buffer size must be a power of two!");
+
+        RingBuffer() : head(0), tail(0) {}
+
+        /** Add an item.
+         * @return False if the buffer was full and the item was dropped.
+         */
+        bool push(const T & item) {
+            uint32_t h = head;
+            if(h - tail == N)
+                return false;
+
+            buffer[h & (N - 1)] = item;
+            __DMB(); // Item must be written before it is published
+            head = h + 1;
+            return true;
+        }
+
+        /** Remove the oldest item.
+         * @return False if the buffer was empty.
+         */
+        bool pop(T & item) {
+            uint32_t t = tail;
+            if(head == t)
+                return false;
+
+            item = buffer[t & (N - 1)];
+            __DMB(); // Item must be read before its slot is released
+            tail = t + 1;
+            return true;
+        }
+
+        /** Number of items waiting. */
+        uint32_t size() const {
+            return head - tail;
+        }
+
+        bool empty() const {
+            return head == tail;
+        }
+
+    private:
+        T buffer[N];
+        volatile uint32_t head;
+        volatile uint32_t tail;
+};
+
+#endif
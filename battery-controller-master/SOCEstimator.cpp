@@ -0,0 +1,229 @@
+#include "SOCEstimator.hpp"
+#include "CycleCounter.hpp"
+
+SOCEstimator::SOCEstimator() :
+    have_rest(false),
+    rest_charge(0),
+    last_timestamp(0),
+    have_sample(false),
+    min_soc(0),
+    max_soc(0),
+    mean_soc(0),
+    min_cell(0),
+    max_cell(0),
+    usable(0),
+    headroom(0),
+    cycles(0) {
+        for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+            state[cell].capacity = Config::PACK_CAPACITY;
+            state[cell].rest_soc = 0;
+        }
+
+        CycleCounter::enable();
+    }
+
+void SOCEstimator::update(const uint16_t cell_codes[Config::NUM_CMUs][12], current_t current, timestamp_t timestamp) {
+    uint32_t start = CycleCounter::read();
+
+    uint32_t dt = have_sample ? timestamp - last_timestamp : 0;
+    last_timestamp = timestamp;
+    have_sample = true;
+
+    // Long gaps (blocking contactor waits) are split so the RC decay stays linear
+    uint32_t step = dt % MAX_STEP;
+
+    uint32_t sum = 0;
+    min_soc = UINT16_MAX;
+    max_soc = 0;
+    usable = UINT16_MAX;
+    headroom = UINT16_MAX;
+
+    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+        uint16_t code = cell_codes[cell / 12][cell % 12];
+        // 0xFFFF is what the LTC6804 returns before a conversion or after a failed read
+        bool valid = code != 0 && code != UINT16_MAX;
+
+        CellEKF<Number> & ekf = cells[cell];
+        if(!ekf.isInitialised()) {
+            if(valid)
+                ekf.reset(code, current);
+        } else {
+            for(uint32_t t = step; t < dt; t += MAX_STEP)
+                ekf.predict(current, MAX_STEP);
+
+            if(valid)
+                ekf.update(current, step, code);
+            else
+                ekf.predict(current, step);
+        }
+
+        uint16_t soc = ekf.getSOC();
+        sum += soc;
+        if(soc < min_soc) {
+            min_soc = soc;
+            min_cell = cell;
+        }
+        if(soc > max_soc) {
+            max_soc = soc;
+            max_cell = cell;
+        }
+
+        uint16_t remaining = getRemaining(cell);
+        if(remaining < usable)
+            usable = remaining;
+        if(state[cell].capacity - remaining < headroom)
+            headroom = state[cell].capacity - remaining;
+    }
+
+    mean_soc = sum / Config::NUM_CELLS_SERIES;
+
+    cycles = CycleCounter::read() - start;
+}
+
+void SOCEstimator::rest(const uint16_t cell_codes[Config::NUM_CMUs][12], current_t current, int32_t net_charge) {
+    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+        uint16_t code = cell_codes[cell / 12][cell % 12];
+        if(code == 0 || code == UINT16_MAX)
+            return;
+    }
+
+    int32_t counted = net_charge - rest_charge;
+    bool estimate = have_rest && abs(counted) >= Config::CAPACITY_MIN_THROUGHPUT;
+
+    // Move the reference rest along while the pack sits (it relaxes towards its true open circuit
+    // voltage), but keep it across short trips that are too small to estimate from
+    bool move = estimate || !have_rest || abs(counted) < Config::CAPACITY_MIN_THROUGHPUT / 4;
+    if(!move)
+        return;
+
+    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+        voltage_t voltage = cell_codes[cell / 12][cell % 12] / 10
+            - current * Config::CELL_RESISTANCE / (Config::NUM_CELLS_PARALLEL * 1000);
+        uint16_t soc = OCV::cellSOC(voltage);
+        CellState & s = state[cell];
+
+        if(estimate) {
+            // Flat regions of the curve can leave the SOC change too small to divide by
+            int32_t change = (int32_t) soc - s.rest_soc;
+            int32_t capacity = change != 0 ? (int64_t) counted * OCV::FULL / change : 0;
+
+            if(capacity > Config::PACK_CAPACITY / 2 && capacity < Config::PACK_CAPACITY * 5 / 4) {
+                s.capacity += (capacity - s.capacity) / Config::CAPACITY_FILTER_N;
+                cells[cell].setCapacity(s.capacity);
+            }
+        }
+
+        s.rest_soc = soc;
+    }
+
+    rest_charge = net_charge;
+    have_rest = true;
+}
+
+void SOCEstimator::save(StoreRecords::CellCharge & record, int32_t net_charge) {
+    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+        record.soc[cell] = cells[cell].getSOC();
+        record.capacity[cell] = state[cell].capacity;
+        record.restSoc[cell] = state[cell].rest_soc;
+    }
+    record.sinceRest = net_charge - rest_charge;
+    record.haveRest = have_rest;
+}
+
+void SOCEstimator::restore(const StoreRecords::CellCharge & record, bool current, int32_t net_charge) {
+    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+        CellState & s = state[cell];
+
+        // Same bounds as estimates in rest()
+        if(record.capacity[cell] > Config::PACK_CAPACITY / 2 && record.capacity[cell] < Config::PACK_CAPACITY * 5 / 4) {
+            s.capacity = record.capacity[cell];
+            cells[cell].setCapacity(s.capacity);
+        }
+
+        if(current && record.soc[cell] <= 1000) {
+            cells[cell].seed(record.soc[cell]);
+            s.rest_soc = record.restSoc[cell];
+        }
+    }
+
+    if(current && record.haveRest) {
+        rest_charge = net_charge - record.sinceRest;
+        have_rest = true;
+    }
+}
+
+bool SOCEstimator::isInitialised() {
+    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+        if(!cells[cell].isInitialised())
+            return false;
+    }
+    return true;
+}
+
+uint16_t SOCEstimator::getSOC(uint8_t cell) {
+    return cells[cell].getSOC();
+}
+
+uint16_t SOCEstimator::getCapacity(uint8_t cell) {
+    return state[cell].capacity;
+}
+
+uint16_t SOCEstimator::getSOH(uint8_t cell) {
+    return (uint32_t) state[cell].capacity * 1000 / Config::PACK_CAPACITY;
+}
+
+uint16_t SOCEstimator::getRemaining(uint8_t cell) {
+    return (uint32_t) cells[cell].getSOC() * state[cell].capacity / 1000;
+}
+
+uint16_t SOCEstimator::getMinSOC() {
+    return min_soc;
+}
+
+uint16_t SOCEstimator::getMaxSOC() {
+    return max_soc;
+}
+
+uint16_t SOCEstimator::getMeanSOC() {
+    return mean_soc;
+}
+
+uint8_t SOCEstimator::getMinCell() {
+    return min_cell;
+}
+
+uint8_t SOCEstimator::getMaxCell() {
+    return max_cell;
+}
+
+uint16_t SOCEstimator::getUsableCharge() {
+    return usable;
+}
+
+uint16_t SOCEstimator::getChargeHeadroom() {
+    return headroom;
+}
+
+void SOCEstimator::getBalanceCells(uint16_t cells[Config::NUM_CMUs]) {
+    memset(cells, 0, Config::NUM_CMUs * sizeof(cells[0]));
+
+    if(!isInitialised())
+        return;
+
+    uint8_t weakest = 0;
+    for(uint8_t cell = 1; cell < Config::NUM_CELLS_SERIES; ++cell) {
+        if(state[cell].capacity < state[weakest].capacity)
+            weakest = cell;
+    }
+
+    int32_t weakest_remaining = getRemaining(weakest);
+    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+        int32_t target = weakest_remaining + (state[cell].capacity - state[weakest].capacity) / 2;
+        if(getRemaining(cell) > target + Config::BALANCE_CHARGE_DEADBAND)
+            cells[cell / 12] |= 1 << (cell % 12);
+    }
+}
+
+uint32_t SOCEstimator::getUpdateCycles() {
+    return cycles;
+}
@@ -0,0 +1,126 @@
+#ifndef SOC_ESTIMATOR_HPP
+#define SOC_ESTIMATOR_HPP
+
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include "CellEKF.hpp"
+#include "BCStoreRecords.hpp"
+#include "FixedPoint.hpp"
+#include <mbed.h>
+
+/** Model based state of charge and capacity for every series cell group.
+ *
+ * Runs a fixed point CellEKF per cell group on each CMU voltage scan, using the pack current
+ * measured just before the scan.
+ *
+ * Capacity is estimated from rest to rest: the open circuit voltage at each rest gives every
+ * group's SOC, and the charge counted in between divided by each group's change in SOC gives its
+ * capacity.  Estimates are averaged into the stored capacity, which also feeds the group's EKF.
+ *
+ * The pack is limited by its weakest group, so usable charge and headroom are the minimum over
+ * the groups, and balancing targets are set relative to the lowest capacity group.
+ */
+class SOCEstimator {
+    public:
+        typedef Fixed<16> Number;
+
+        SOCEstimator();
+
+        /** Update every cell group from a CMU scan.
+         * @param cell_codes Cell voltages in 1/10 mV as read by CMUControl.
+         * @param current Pack current in mA.
+         * @param timestamp Time of the scan in us.
+         */
+        void update(const uint16_t cell_codes[Config::NUM_CMUs][12], current_t current, timestamp_t timestamp);
+
+        /** Take an open circuit reading while the pack is at rest, re-estimating capacity once
+         * enough charge has been counted since the previous rest.
+         * @param cell_codes Cell voltages in 1/10 mV as read by CMUControl.
+         * @param current Pack current in mA.
+         * @param net_charge Net charge counted into the pack in mAh (CoulombCounter::getNetCharge()).
+         */
+        void rest(const uint16_t cell_codes[Config::NUM_CMUs][12], current_t current, int32_t net_charge);
+
+        /** Copy the model state into a checkpoint.
+         * @param net_charge CoulombCounter::getNetCharge()
+         */
+        void save(StoreRecords::CellCharge & record, int32_t net_charge);
+
+        /** Restore from a checkpoint: capacities always, state of charge and the last rest only
+         *  while they still hold.
+         * @param current The pack hasn't been charged or discharged since the checkpoint.
+         * @param net_charge CoulombCounter::getNetCharge()
+         */
+        void restore(const StoreRecords::CellCharge & record, bool current, int32_t net_charge);
+
+        /** True once every cell group has been seeded from a valid reading. */
+        bool isInitialised();
+
+        /** State of charge of one cell group in 1/10 %. */
+        uint16_t getSOC(uint8_t cell);
+
+        /** Estimated capacity of one cell group in mAh. */
+        uint16_t getCapacity(uint8_t cell);
+
+        /** Capacity relative to new (state of health) in 1/10 %. */
+        uint16_t getSOH(uint8_t cell);
+
+        /** Charge left in one cell group in mAh. */
+        uint16_t getRemaining(uint8_t cell);
+
+        /** Lowest, highest and mean cell group state of charge in 1/10 %. */
+        uint16_t getMinSOC();
+        uint16_t getMaxSOC();
+        uint16_t getMeanSOC();
+
+        /** Index of the cell groups with the lowest and highest state of charge. */
+        uint8_t getMinCell();
+        uint8_t getMaxCell();
+
+        /** Charge the pack can deliver before its emptiest group is empty, in mAh. */
+        uint16_t getUsableCharge();
+
+        /** Charge the pack can take before its fullest group is full, in mAh. */
+        uint16_t getChargeHeadroom();
+
+        /** Cell groups holding more charge than the weakest group lets the pack use.
+         *
+         * Each group's target is centred in the range where neither end of the weakest (lowest
+         * capacity) group's range is limited by it.
+         *
+         * @param[out] cells Bit mask of cells to discharge per CMU, as for CMUControl::doCellBalance().
+         */
+        void getBalanceCells(uint16_t cells[Config::NUM_CMUs]);
+
+        /** Core cycles taken by the last update(), to keep an eye on the CPU budget. */
+        uint32_t getUpdateCycles();
+
+    private:
+        static constexpr uint32_t MAX_STEP = 1000000; // us: Longest single model time step
+
+        /** Per cell group state kept alongside the EKF. */
+        struct CellState {
+            uint16_t capacity; // mAh
+            uint16_t rest_soc; // 0-OCV::FULL, open circuit SOC at the last rest
+        };
+
+        CellEKF<Number> cells[Config::NUM_CELLS_SERIES];
+        CellState state[Config::NUM_CELLS_SERIES];
+
+        bool have_rest;
+        int32_t rest_charge; // mAh, net charge at the last rest
+
+        timestamp_t last_timestamp;
+        bool have_sample;
+
+        uint16_t min_soc;
+        uint16_t max_soc;
+        uint16_t mean_soc;
+        uint8_t min_cell;
+        uint8_t max_cell;
+        uint16_t usable;
+        uint16_t headroom;
+        uint32_t cycles;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "Trace.hpp"
+#include "CycleCounter.hpp"
+
+namespace Trace {
+    namespace {
+        static_assert((Config::TRACE_BUFFER_SIZE & (Config::TRACE_BUFFER_SIZE - 1)) == 0,
+                "Trace buffer size must be a power of two!");
+
+        // Not zeroed at startup, only events counted below are valid
+        Event events[Config::TRACE_BUFFER_SIZE] __attribute__((section("AHBSRAM0")));
+
+        uint32_t head = 0; // Next event to write
+        uint16_t count = 0; // Valid events before head
+        bool dumping = false;
+        uint32_t dump_next = 0;
+        uint32_t dump_end = 0;
+
+        osThreadId threads[15];
+
+        /** Context of the caller, see CONTEXT_MASK.  Interrupts must be disabled. */
+        uint8_t context() {
+            uint32_t exception = __get_IPSR();
+            if(exception >= 16)
+                return exception;
+            if(exception != 0)
+                return CONTEXT_MASK;
+
+            osThreadId thread = osThreadGetId();
+            for(uint8_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+                if(threads[i] == NULL)
+                    threads[i] = thread;
+                if(threads[i] == thread)
+                    return i + 1;
+            }
+            return 0;
+        }
+    }
+
+    void record(uint16_t id, Phase phase, uint8_t arg) {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+
+        // Only the dump is paused, the events either side of it still pair up
+        if(!dumping) {
+            Event & event = events[head++ & (Config::TRACE_BUFFER_SIZE - 1)];
+            event.cycles = CycleCounter::read();
+            event.id = id;
+            event.arg = arg;
+            event.flags = phase << PHASE_SHIFT | context();
+            if(count < Config::TRACE_BUFFER_SIZE)
+                ++count;
+        }
+
+        __set_PRIMASK(primask);
+    }
+
+    uint16_t startDump() {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+
+        dumping = true;
+        dump_next = head - count;
+        dump_end = head;
+        uint16_t size = count;
+
+        __set_PRIMASK(primask);
+        return size;
+    }
+
+    bool isDumping() {
+        return dumping;
+    }
+
+    bool nextDump(Event & event) {
+        if(!dumping)
+            return false;
+
+        if(dump_next == dump_end) {
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            count = 0;
+            dumping = false;
+            __set_PRIMASK(primask);
+            return false;
+        }
+
+        event = events[dump_next++ & (Config::TRACE_BUFFER_SIZE - 1)];
+        return true;
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include "BCConfig.hpp"
+#include "Debug.hpp"
+#include <mbed.h>
+#include <type_traits>
+
+/** Timeline of begin/end events, timestamped by the core cycle counter.
+ *
+ * Events go into a ring in AHB SRAM bank 0 (unused, as Ethernet is powered down), overwriting
+ * the oldest.  Recording takes a few dozen cycles with interrupts held off, so it is safe from
+ * any thread or interrupt handler.  A dump pauses recording and hands the ring out oldest first,
+ * then empties it.  tools/trace2json.py turns a dump into Chrome trace JSON for Perfetto or
+ * chrome://tracing, taking event names from the source like tools/logdecode.py.
+ */
+namespace Trace {
+    enum Phase {
+        BEGIN,
+        END,
+        INSTANT
+    };
+
+    /** One event, laid out as sent in a BCCANPackets::TX::TraceEvent. */
+    struct Event {
+        uint32_t cycles; // CycleCounter::read()
+        uint16_t id; // Trace::id() of the name
+        uint8_t arg;
+        uint8_t flags; // Phase << 6 | context
+    };
+
+    // Context of an event: thread 1-15 in order of first event, 0 for any later thread,
+    // exception number 16-50 for an interrupt handler, 63 for any other exception
+    constexpr uint8_t CONTEXT_MASK = 0x3F;
+    constexpr uint8_t PHASE_SHIFT = 6;
+
+    /** Event ID of a name: 32 bit FNV-1a hash folded to 16 bits. */
+    constexpr uint16_t id(const char * name) {
+        return (uint16_t) (Log::fnv1a(name) ^ (Log::fnv1a(name) >> 16));
+    }
+
+    /** Record an event, unless a dump is in progress. */
+    void record(uint16_t id, Phase phase, uint8_t arg = 0);
+
+    /** Begin event on construction, end event on destruction. */
+    class Scope {
+        public:
+            Scope(uint16_t id, uint8_t arg = 0) : id(id) {
+                record(id, BEGIN, arg);
+            }
+
+            ~Scope() {
+                record(id, END);
+            }
+
+        private:
+            const uint16_t id;
+    };
+
+    /** Start a dump and pause recording until it has been read out by nextDump().  Restarts a
+     *  dump already in progress.
+     * @return Number of events in the dump.
+     */
+    uint16_t startDump();
+
+    /** True from startDump() until nextDump() has returned the last event. */
+    bool isDumping();
+
+    /** Take the next event of a dump in progress.  Recording resumes with an empty ring once
+     *  the last one has been taken.
+     * @return False once the dump is finished.
+     */
+    bool nextDump(Event & event);
+}
+
+#ifdef NTRACE
+
+#define TRACE_SCOPE(...)
+#define TRACE_BEGIN(...)
+#define TRACE_END(...)
+#define TRACE_INSTANT(...)
+
+#else
+
+// Event IDs are compile time constants, so a call site costs no more than the record
+#define TRACE_ID_(name) std::integral_constant<uint16_t, Trace::id(name)>::value
+#define TRACE_CAT_(a, b) a##b
+#define TRACE_VAR_(line) TRACE_CAT_(trace_scope_, line)
+
+#define TRACE_SCOPE(name, ...) Trace::Scope TRACE_VAR_(__LINE__)(TRACE_ID_(name), ##__VA_ARGS__)
+#define TRACE_BEGIN(name, ...) Trace::record(TRACE_ID_(name), Trace::BEGIN, ##__VA_ARGS__)
+#define TRACE_END(name) Trace::record(TRACE_ID_(name), Trace::END)
+#define TRACE_INSTANT(name, ...) Trace::record(TRACE_ID_(name), Trace::INSTANT, ##__VA_ARGS__)
+
+#endif
+
+#endif
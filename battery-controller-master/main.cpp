@@ -5,7 +5,7 @@
 BatteryController bc;
 
 void disable_outputs() {
-	//bc.stateMachine.forceTransition(BCStateMachine::State::BC_ERROR);
+	bc.stateMachine.tripOverCurrent();
 }
 
 int main() {
@@ -39,12 +39,16 @@ int main() {
 //handling over current signal from comparators. 
 	InterruptIn con_en(PinDefs::CON_ENABLE);
 	con_en.fall(Callback<void()>(&disable_outputs)); 
+	// No edge if it was already tripped at power up
+	if(!con_en.read())
+		disable_outputs();
 
-//Set Fan speed maximum
-	bc.stateMachine.output.setFan2(255);
+//Shunt offset calibration, only valid with no current path
+	bc.input.calshunt(bc.stateMachine.output.allOpen());
 
-//Shunt offset calibration
-	bc.input.calshunt();
+//Continuous current and voltage acquisition (after calibration, which reads single shot)
+	if(Config::ADC_CONTINUOUS)
+		bc.input.startContinuous();
 
 //Start battery controller
 	bc.run();
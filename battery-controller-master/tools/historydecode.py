@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""Decode the battery controller cell history from a dump of its flash to CSV.
+
+Dump the history sectors (0x40000 up to the store at 0x60000) with the debugger, then decode:
+
+    (gdb) dump binary memory history.bin 0x40000 0x60000
+    tools/historydecode.py history.bin > history.csv
+
+Each row is one scan: the boot it was taken in (counted from the oldest in the dump), ms since
+that boot, then every cell voltage in mV and every raw CMU temperature.  Blocks that fail their
+CRC, torn by a power cut, are skipped.  Compression statistics go to stderr.  See CellHistory.hpp
+for the format.
+"""
+
+import argparse
+import csv
+import os
+import re
+import struct
+import sys
+
+HEADER = struct.Struct('<IIHHHH')  # CellHistory::BlockHeader
+CONSTANT = r'\b{}\s*=\s*(0x[0-9A-Fa-f]+|\d+)'
+
+
+def config(directory, name):
+    with open(os.path.join(directory, 'BCConfig.hpp')) as f:
+        match = re.search(CONSTANT.format(name), f.read())
+    if not match:
+        sys.exit('{} not found in BCConfig.hpp'.format(name))
+    return int(match.group(1), 0)
+
+
+def crc16(data, crc=0xFFFF):
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+def varint(data, pos):
+    value = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return value, pos
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def runs(data, pos, n):
+    values = []
+    while len(values) < n:
+        value, pos = varint(data, pos)
+        values.append(unzigzag(value))
+        if value == 0:
+            run, pos = varint(data, pos)
+            values.extend([0] * run)
+    if len(values) != n:
+        raise ValueError('zero run past the end of a scan')
+    return values, pos
+
+
+def packed(data, pos, n):
+    width = data[pos]
+    pos += 1
+    if not width:
+        return [0] * n, pos
+    length = (width * n + 7) // 8
+    bits = int.from_bytes(data[pos:pos + length], 'little')
+    mask = (1 << width) - 1
+    return [unzigzag((bits >> (i * width)) & mask) for i in range(n)], pos + length
+
+
+def read_blocks(dump, size):
+    blocks = []
+    for offset in range(0, len(dump) - size + 1, size):
+        sequence, time, length, scans, crc, _ = HEADER.unpack_from(dump, offset)
+        data = dump[offset + HEADER.size:offset + HEADER.size + length]
+        if length > size - HEADER.size or crc != crc16(data, crc16(dump[offset:offset + 12])):
+            continue
+        blocks.append((sequence, time, scans, data))
+    # Sequence numbers only wrap after 2^32 blocks
+    return sorted(blocks)
+
+
+def decode(data, scans, cells):
+    pos = 0
+    voltages = []
+    for _ in range(cells):
+        value, pos = varint(data, pos)
+        voltages.append(value)
+    temperatures = list(data[pos:pos + cells])
+    pos += cells
+    elapsed = 0
+    yield elapsed, voltages, temperatures
+
+    for _ in range(scans - 1):
+        step, pos = varint(data, pos)
+        elapsed += step
+        mean, pos = varint(data, pos)
+        mean = unzigzag(mean)
+        residuals, pos = packed(data, pos, cells)
+        voltages = [v + mean + r for v, r in zip(voltages, residuals)]
+        deltas, pos = runs(data, pos, cells)
+        temperatures = [(t + d) & 0xFF for t, d in zip(temperatures, deltas)]
+        yield elapsed, voltages, temperatures
+
+    if pos != len(data):
+        raise ValueError('{} bytes left over'.format(len(data) - pos))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('input', help='Binary dump of the history flash')
+    parser.add_argument('--source', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'),
+                        help='Firmware source directory, for the block size and cell count')
+    args = parser.parse_args()
+
+    size = config(args.source, 'HISTORY_BLOCK')
+    cells = config(args.source, 'NUM_CMUs') * 12
+
+    with open(args.input, 'rb') as f:
+        dump = f.read()
+    blocks = read_blocks(dump, size)
+
+    out = csv.writer(sys.stdout)
+    out.writerow(['boot', 'time'] + ['v{}'.format(i) for i in range(cells)] + ['t{}'.format(i) for i in range(cells)])
+
+    boot = 0
+    last = None
+    total_scans = total_bytes = 0
+    for sequence, time, scans, data in blocks:
+        # Time since boot only goes backwards across a reset
+        if last is not None and time < last:
+            boot += 1
+        try:
+            for elapsed, voltages, temperatures in decode(data, scans, cells):
+                last = time + elapsed
+                out.writerow([boot, last] + voltages + temperatures)
+        except (IndexError, ValueError) as e:
+            print('Block {}: {}'.format(sequence, e), file=sys.stderr)
+        total_scans += scans
+        total_bytes += len(data) + HEADER.size
+
+    raw = total_scans * cells * 3
+    print('{} blocks, {} scans, {} bytes from {} ({:.1f}:1, {:.1f} bytes per scan)'.format(
+        len(blocks), total_scans, total_bytes, raw, raw / total_bytes if total_bytes else 0,
+        total_bytes / total_scans if total_scans else 0), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,352 @@
+#include "CellEKF.hpp"
+#include "HostTest.hpp"
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+
+/* A simulated cell group, following the filter's own equivalent circuit, discharged for an hour
+ * through a current sensor reading 2 A high.  The fixed point filter must match the float one,
+ * and both must hold the true state of charge where counting alone drifts, including from a
+ * seed 10 % out.
+ *
+ * Then the replay harness, which runs a drive from CSV through the fixed point and float filters
+ * side by side and reports their state of charge against coulomb counting and the open circuit
+ * voltage at each rest.  Given a file, e.g. `build/CellEKFTest drive.csv`, it replays only that.
+ * Each row is the time in ms, the pack current in mA, then a cell voltage in 1/10 mV for up to
+ * every series cell group, as CMUReading frames carry them; lines that don't start with a number
+ * are skipped, and time going back starts a new boot.  Without one it replays a two hour drive
+ * with rests from a cell model unlike the filter's, then times an update of each filter.
+ */
+
+namespace {
+    constexpr uint32_t PERIOD = 15000; // us: CMU scan period
+    constexpr current_t CURRENT = -20000; // mA: 80 % to 23 % in the hour
+    constexpr current_t OFFSET = 2000; // mA: Current sensor error
+    constexpr double TIME_CONSTANT = Config::CELL_TIME_CONSTANT * 1000.0; // us
+    constexpr uint32_t MAX_STEP = 1000000; // us: Longest single model time step, as in SOCEstimator
+    constexpr double CHARGE_PER_PERCENT = Config::PACK_CAPACITY * 36000000.0; // mA us
+
+    /** Open circuit voltage at a state of charge in %. */
+    double ocv(double soc) {
+        return OCV::cellVoltage((uint16_t) (soc / 100 * OCV::FULL));
+    }
+
+    /** Repeatable reading noise of up to +-1 mV, in 1/10 mV */
+    int32_t noise(uint32_t i) {
+        return (int32_t) ((i * 7919) % 21) - 10;
+    }
+
+    double worse(double error, double worst) {
+        return fabs(error) > worst ? fabs(error) : worst;
+    }
+
+    /** What a replay found, state of charge differences in %. */
+    struct Replay {
+        uint32_t rows;
+        uint8_t cells;
+        uint32_t boots;
+        double hours;
+        double fixed_float; // Fixed point from float, worst
+        double counted; // From coulomb counting since the seed, worst
+        double counted_end; // From coulomb counting at the end, worst cell
+        uint32_t rests; // Long enough to trust the open circuit voltage
+        double rest_fixed; // Fixed point from the rest voltage's, worst
+        double rest_float;
+        double rest_counted; // Coulomb counting from the rest voltage's, worst
+    };
+
+    /** Run a drive through fixed point and float filters for every cell group in it. */
+    class Harness {
+        public:
+            Harness() : result(), seeded(false), last(0), rest_since(-1) {}
+
+            /** Replay every row of a CSV drive.
+             * @return False if no row could be read.
+             */
+            bool replay(FILE * file) {
+                char line[4096];
+                while(fgets(line, sizeof(line), file)) {
+                    double time;
+                    current_t current;
+                    uint16_t codes[Config::NUM_CELLS_SERIES];
+                    uint8_t cells = parse(line, time, current, codes);
+                    if(!cells)
+                        continue;
+                    // Cell groups missing from a row are taken as failed readings
+                    for(uint8_t cell = cells; cell < Config::NUM_CELLS_SERIES; ++cell)
+                        codes[cell] = UINT16_MAX;
+                    result.cells = cells > result.cells ? cells : result.cells;
+                    add(time, current, codes);
+                }
+                endRest();
+                for(uint8_t cell = 0; cell < result.cells; ++cell)
+                    result.counted_end = worse(soc(fixed[cell]) - counted[cell], result.counted_end);
+                return result.rows > 0;
+            }
+
+            Replay result;
+
+        private:
+            /** Read one row.
+             * @return Cell voltages read, 0 if it isn't a row.
+             */
+            uint8_t parse(const char * line, double & time, current_t & current, uint16_t codes[]) {
+                char * end;
+                time = strtod(line, &end);
+                if(end == line || *end != ',')
+                    return 0;
+                current = lround(strtod(end + 1, &end));
+                uint8_t cells = 0;
+                while(*end == ',' && cells < Config::NUM_CELLS_SERIES) {
+                    const char * field = end + 1;
+                    double code = strtod(field, &end);
+                    if(end == field)
+                        break;
+                    codes[cells++] = (uint16_t) lround(code);
+                }
+                return cells;
+            }
+
+            void add(double time, current_t current, const uint16_t codes[]) {
+                bool resting = abs(current) < Config::REST_CURRENT;
+                if(!resting || (seeded && time < last))
+                    endRest();
+                if(seeded && time < last) {
+                    ++result.boots;
+                    seeded = false;
+                }
+
+                if(!seeded) {
+                    for(uint8_t cell = 0; cell < Config::NUM_CELLS_SERIES; ++cell) {
+                        fixed[cell] = CellEKF<Fixed<16> >();
+                        reference[cell] = CellEKF<float>();
+                    }
+                    seeded = true;
+                    rest_since = -1;
+                } else {
+                    double ms = time - last;
+                    result.hours += ms / 3600000;
+                    uint32_t dt = (uint32_t) (ms * 1000);
+                    uint32_t step = dt % MAX_STEP;
+                    for(uint8_t cell = 0; cell < result.cells; ++cell) {
+                        counted[cell] += current * (double) dt / CHARGE_PER_PERCENT;
+                        update(fixed[cell], current, dt, step, codes[cell]);
+                        update(reference[cell], current, dt, step, codes[cell]);
+                    }
+                }
+                last = time;
+                ++result.rows;
+
+                for(uint8_t cell = 0; cell < result.cells; ++cell) {
+                    if(!fixed[cell].isInitialised() && valid(codes[cell])) {
+                        fixed[cell].reset(codes[cell], current);
+                        reference[cell].reset(codes[cell], current);
+                        counted[cell] = soc(fixed[cell]);
+                    }
+                    if(!fixed[cell].isInitialised())
+                        continue;
+                    result.fixed_float = worse(soc(fixed[cell]) - soc(reference[cell]), result.fixed_float);
+                    result.counted = worse(soc(fixed[cell]) - counted[cell], result.counted);
+                }
+
+                // The open circuit voltage is taken once a rest is long enough, at its end
+                if(resting) {
+                    if(rest_since < 0)
+                        rest_since = time;
+                    if(time - rest_since >= Config::REST_PERIOD)
+                        std::copy(codes, codes + Config::NUM_CELLS_SERIES, rest_codes);
+                }
+            }
+
+            /** Compare against the open circuit voltage of a rest just ended. */
+            void endRest() {
+                if(rest_since >= 0 && last - rest_since >= Config::REST_PERIOD) {
+                    ++result.rests;
+                    for(uint8_t cell = 0; cell < result.cells; ++cell) {
+                        if(!valid(rest_codes[cell]) || !fixed[cell].isInitialised())
+                            continue;
+                        double rest = OCV::cellSOC(rest_codes[cell] / 10) * 100.0 / OCV::FULL;
+                        result.rest_fixed = worse(soc(fixed[cell]) - rest, result.rest_fixed);
+                        result.rest_float = worse(soc(reference[cell]) - rest, result.rest_float);
+                        result.rest_counted = worse(counted[cell] - rest, result.rest_counted);
+                    }
+                }
+                rest_since = -1;
+            }
+
+            /** As SOCEstimator::update(), splitting long gaps so the RC decay stays linear. */
+            template<typename T>
+            void update(CellEKF<T> & ekf, current_t current, uint32_t dt, uint32_t step, uint16_t code) {
+                if(!ekf.isInitialised())
+                    return;
+                for(uint32_t t = step; t < dt; t += MAX_STEP)
+                    ekf.predict(current, MAX_STEP);
+                if(valid(code))
+                    ekf.update(current, step, code);
+                else
+                    ekf.predict(current, step);
+            }
+
+            template<typename T>
+            static double soc(CellEKF<T> & ekf) {
+                return ekf.getSOC() / 10.0;
+            }
+
+            static bool valid(uint16_t code) {
+                return code != 0 && code != UINT16_MAX;
+            }
+
+            CellEKF<Fixed<16> > fixed[Config::NUM_CELLS_SERIES];
+            CellEKF<float> reference[Config::NUM_CELLS_SERIES];
+            double counted[Config::NUM_CELLS_SERIES]; // %
+            uint16_t rest_codes[Config::NUM_CELLS_SERIES]; // 1/10 mV
+
+            bool seeded;
+            double last; // ms
+            double rest_since; // ms, negative unless resting
+    };
+
+    void report(const char * name, const Replay & r) {
+        printf("CellEKFTest: %s, %lu rows of %u cells over %.1f h in %lu boots\n", name,
+                (unsigned long) r.rows, r.cells, r.hours, (unsigned long) r.boots + 1);
+        printf("CellEKFTest:   fixed point within %.1f %% of float, %.1f %% of counting (%.1f %% at the end)\n",
+                r.fixed_float, r.counted, r.counted_end);
+        printf("CellEKFTest:   at %lu rests, fixed point %.1f %%, float %.1f %% and counting %.1f %% from the rest voltage\n",
+                (unsigned long) r.rests, r.rest_fixed, r.rest_float, r.rest_counted);
+    }
+
+    /** Write a drive of two hours, each 40 minutes of driving and 20 at rest, sampled every
+     *  second, from a cell model unlike the filter's: two RC pairs, a third more resistance, and
+     *  a current sensor reading 300 mA high, inside the rest current.  Three cell groups start at different charges.
+     */
+    void simulate(FILE * file) {
+        constexpr uint8_t CELLS = 3;
+        double soc[CELLS] = {90, 85, 80}; // %
+        double fast[CELLS] = {}; // mV: 10 mOhm, 2 s
+        double slow[CELLS] = {}; // mV: 25 mOhm, 60 s
+        fprintf(file, "ms,mA,cell 1,cell 2,cell 3\n");
+        for(uint32_t second = 0; second <= 7200; ++second) {
+            bool driving = second % 3600 < 2400;
+            double current = driving ? -18000 - 10000 * sin(second / 20.0) + noise(second) * 300 : 0; // mA
+            fprintf(file, "%lu,%li", (unsigned long) second * 1000, lround(current + 300));
+            for(uint8_t cell = 0; cell < CELLS; ++cell) {
+                double cell_current = current / Config::NUM_CELLS_PARALLEL / 1000; // A
+                soc[cell] += current * 1000000 / CHARGE_PER_PERCENT;
+                fast[cell] = fast[cell] * exp(-1 / 2.0) + (1 - exp(-1 / 2.0)) * 10 * cell_current;
+                slow[cell] = slow[cell] * exp(-1 / 60.0) + (1 - exp(-1 / 60.0)) * 25 * cell_current;
+                double voltage = ocv(soc[cell]) + 45 * cell_current + fast[cell] + slow[cell];
+                fprintf(file, ",%li", lround(voltage * 10 + noise(second * CELLS + cell)));
+            }
+            fprintf(file, "\n");
+        }
+    }
+
+    /** Host time of one update, in ns.  The host has an FPU where the LPC1768 doesn't, so this
+     *  understates what fixed point saves there; SOCEstimator::getUpdateCycles() measures it.
+     */
+    template<typename T>
+    double timeUpdate() {
+        constexpr uint32_t UPDATES = 1000000;
+        CellEKF<T> ekf;
+        ekf.reset((uint16_t) (ocv(80) * 10), 0);
+        uint32_t sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(uint32_t i = 0; i < UPDATES; ++i) {
+            ekf.update(CURRENT, PERIOD, (uint16_t) (ocv(80) * 10 - 8000 + noise(i)));
+            sum += ekf.getSOC();
+        }
+        auto end = std::chrono::steady_clock::now();
+        // Keeps the loop from being optimised away
+        CHECK(sum > 0, "no state of charge");
+        return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / UPDATES;
+    }
+}
+
+int main(int argc, char ** argv) {
+    if(argc > 1) {
+        FILE * file = fopen(argv[1], "r");
+        CHECK(file, "can't open %s", argv[1]);
+        if(!file)
+            return HostTest::finish("CellEKFTest");
+        Harness harness;
+        CHECK(harness.replay(file), "no rows in %s", argv[1]);
+        fclose(file);
+        report(argv[1], harness.result);
+        CHECK(harness.result.fixed_float <= 0.2, "fixed point up to %.1f %% from float", harness.result.fixed_float);
+        return HostTest::finish("CellEKFTest");
+    }
+
+    double soc = 80; // %
+    double v1 = 0; // mV
+    uint16_t code = (uint16_t) (ocv(soc) * 10);
+
+    CellEKF<Fixed<16> > fixed;
+    CellEKF<float> reference;
+    CellEKF<Fixed<16> > wrong; // Seeded 10 % low
+    fixed.reset(code, 0);
+    reference.reset(code, 0);
+    wrong.reset((uint16_t) (ocv(soc - 10) * 10), 0);
+    CHECK(abs(fixed.getSOC() - 800) <= 10 && abs(wrong.getSOC() - 700) <= 10,
+            "seeded from voltage at %u and %u", fixed.getSOC(), wrong.getSOC());
+
+    double counted = soc;
+    int32_t worst_difference = 0;
+    double worst_error = 0;
+    double wrong_error = 0;
+    const uint32_t steps = 3600000000u / PERIOD;
+    for(uint32_t i = 1; i <= steps; ++i) {
+        double cell_current = CURRENT / (double) Config::NUM_CELLS_PARALLEL; // mA
+        double decay = exp(-(double) PERIOD / TIME_CONSTANT);
+        soc += (double) CURRENT * PERIOD / CHARGE_PER_PERCENT;
+        v1 = v1 * decay + (1 - decay) * (Config::CELL_RESISTANCE - Config::CELL_OHMIC_RESISTANCE)
+                * cell_current / 1000;
+        double voltage = ocv(soc) + Config::CELL_OHMIC_RESISTANCE * cell_current / 1000 + v1;
+        uint16_t code = (uint16_t) (voltage * 10 + noise(i));
+
+        fixed.update(CURRENT + OFFSET, PERIOD, code);
+        reference.update(CURRENT + OFFSET, PERIOD, code);
+        wrong.update(CURRENT + OFFSET, PERIOD, code);
+        counted += (double) (CURRENT + OFFSET) * PERIOD / CHARGE_PER_PERCENT;
+
+        CHECK(fixed.getSOCVariance() >= Fixed<16>(0), "negative variance at %lu s",
+                (unsigned long) (i * (uint64_t) PERIOD / 1000000));
+        int32_t difference = abs(fixed.getSOC() - reference.getSOC());
+        worst_difference = difference > worst_difference ? difference : worst_difference;
+        // Allow the first minute to settle from the seed
+        if(i * (uint64_t) PERIOD >= 60000000) {
+            double error = fabs(fixed.getSOC() / 10.0 - soc);
+            worst_error = error > worst_error ? error : worst_error;
+            error = fabs(wrong.getSOC() / 10.0 - soc);
+            wrong_error = error > wrong_error ? error : wrong_error;
+        }
+    }
+
+    CHECK(worst_difference <= 2, "fixed point up to %.1f %% from float", worst_difference / 10.0);
+    CHECK(worst_error < 1.5, "fixed point up to %.1f %% from true", worst_error);
+    CHECK(wrong_error < 1.5, "seeded 10 %% low, up to %.1f %% from true after a minute", wrong_error);
+    CHECK(fabs(counted - soc) > 5, "counting alone drifted only %.1f %%", fabs(counted - soc));
+    printf("CellEKFTest: an hour at %.1f %% from true with counting %.1f %% out, fixed point within %.1f %% of float\n",
+            worst_error, fabs(counted - soc), worst_difference / 10.0);
+
+    // The harness on a drive the filter's model doesn't match, through the same CSV parsing
+    FILE * drive = tmpfile();
+    simulate(drive);
+    rewind(drive);
+    Harness harness;
+    CHECK(harness.replay(drive), "simulated drive didn't replay");
+    fclose(drive);
+    const Replay & r = harness.result;
+    report("simulated drive", r);
+    CHECK(r.rows == 7201 && r.cells == 3 && r.rests == 2, "replayed %lu rows of %u cells with %lu rests",
+            (unsigned long) r.rows, r.cells, (unsigned long) r.rests);
+    CHECK(r.fixed_float <= 0.2, "fixed point up to %.1f %% from float", r.fixed_float);
+    CHECK(r.rest_fixed < 2, "fixed point up to %.1f %% from the rest voltage", r.rest_fixed);
+    CHECK(r.rest_counted > r.rest_fixed, "counting %.1f %% from the rest voltage beat the filter", r.rest_counted);
+
+    double fixed_ns = timeUpdate<Fixed<16> >();
+    double float_ns = timeUpdate<float>();
+    printf("CellEKFTest: an update takes %.0f ns in Fixed<16> and %.0f ns in float on the host\n", fixed_ns, float_ns);
+
+    return HostTest::finish("CellEKFTest");
+}
@@ -0,0 +1,299 @@
+// The flush thread never runs here, so its work is done by flush() below
+#define private public
+#include "CellHistory.cpp"
+#undef private
+
+#include "HostTest.hpp"
+#include "IAPSim.hpp"
+#include <math.h>
+#include <chrono>
+#include <map>
+#include <new>
+#include <utility>
+#include <vector>
+
+/* A day of a simulated pack, driving with flash locked and resting with it writable,
+ * recorded and then decoded back from flash as tools/historydecode.py does.  Every scan decoded
+ * must be the scan recorded, the ring must wrap, and power is cut at a few flash operations on
+ * the way, each a reboot.  Then the compression ratio and host encode time are reported, and a
+ * pack of uncorrelated noise, the worst case for the encoding, must still round trip.
+ */
+
+namespace {
+    constexpr uint8_t CELLS = Config::NUM_CMUs * 12;
+    constexpr uint32_t HOURS = 24;
+
+    struct Scan {
+        int32_t voltages[CELLS]; // mV
+        uint8_t temperatures[CELLS];
+    };
+
+    typedef std::pair<uint32_t, uint32_t> When; // Boot, ms since it
+    typedef std::map<When, Scan> Scans;
+
+    alignas(CellHistory) uint8_t storage[sizeof(CellHistory)];
+
+    CellHistory & boot() {
+        return *new (storage) CellHistory();
+    }
+
+    /** What the flush thread does each time it wakes. */
+    void flush(CellHistory & history) {
+        while(history.writable && history.waiting) {
+            history.flushing = true;
+            bool written = history.program(history.oldest);
+            history.flushing = false;
+            if(!written)
+                break;
+            history.oldest = (history.oldest + 1) % Config::HISTORY_RAM_BLOCKS;
+            --history.waiting;
+        }
+    }
+
+    /** Repeatable pseudo-random values */
+    uint32_t noise(uint32_t i) {
+        return (i * 2654435761u) >> 8;
+    }
+
+    uint32_t varint(const uint8_t * data, uint32_t & pos) {
+        uint32_t value = 0;
+        for(uint8_t shift = 0; ; shift += 7) {
+            uint8_t b = data[pos++];
+            value |= (uint32_t) (b & 0x7F) << shift;
+            if(!(b & 0x80))
+                return value;
+        }
+    }
+
+    int32_t unzigzag(uint32_t value) {
+        return (value >> 1) ^ -(int32_t) (value & 1);
+    }
+
+    /** Decode every intact block in flash, oldest first, counting boots as historydecode.py does.
+     * @return False if a block didn't decode to exactly its length.
+     */
+    bool decode(Scans & scans, uint32_t & blocks) {
+        std::map<uint32_t, uint32_t> slots; // Sequence to slot
+        for(uint32_t slot = 0; slot < CellHistory::SLOTS; ++slot) {
+            const uint8_t * block = IAP::read(CellHistory::slotAddress(slot));
+            const CellHistory::BlockHeader & header = *(const CellHistory::BlockHeader *) block;
+            if(header.length <= Config::HISTORY_BLOCK - sizeof(header)
+                    && header.crc == CellHistory::crc(header, block + sizeof(header)))
+                slots[header.sequence] = slot;
+        }
+        blocks = slots.size();
+
+        uint32_t boot = 0;
+        uint32_t last = 0;
+        for(const auto & slot : slots) {
+            const uint8_t * block = IAP::read(CellHistory::slotAddress(slot.second));
+            const CellHistory::BlockHeader & header = *(const CellHistory::BlockHeader *) block;
+            const uint8_t * data = block + sizeof(header);
+            if(header.time < last)
+                ++boot;
+
+            Scan scan;
+            uint32_t pos = 0;
+            uint32_t time = header.time;
+            for(uint8_t i = 0; i < CELLS; ++i)
+                scan.voltages[i] = varint(data, pos);
+            memcpy(scan.temperatures, data + pos, CELLS);
+            pos += CELLS;
+            scans[When(boot, time)] = scan;
+
+            for(uint16_t n = 1; n < header.scans; ++n) {
+                time += varint(data, pos);
+                int32_t mean = unzigzag(varint(data, pos));
+                uint8_t width = data[pos++];
+                uint64_t bits = 0;
+                uint8_t count = 0;
+                for(uint8_t i = 0; i < CELLS; ++i) {
+                    while(count < width) {
+                        bits |= (uint64_t) data[pos++] << count;
+                        count += 8;
+                    }
+                    uint32_t residual = width ? bits & ((1ull << width) - 1) : 0;
+                    bits >>= width;
+                    count -= width;
+                    scan.voltages[i] += mean + unzigzag(residual);
+                }
+                for(uint8_t i = 0; i < CELLS;) {
+                    uint32_t value = varint(data, pos);
+                    scan.temperatures[i] += unzigzag(value);
+                    ++i;
+                    if(value == 0)
+                        i += varint(data, pos);
+                }
+                scans[When(boot, time)] = scan;
+            }
+            if(pos != header.length)
+                return false;
+            last = time;
+        }
+        return true;
+    }
+
+    /** Check every decoded scan is one recorded.  Boots are counted from the oldest in flash,
+     *  so are lined up on the newest.
+     * @return Scans checked.
+     */
+    uint32_t check(const Scans & recorded, const Scans & decoded) {
+        if(decoded.empty())
+            return 0;
+        uint32_t boots = recorded.rbegin()->first.first - decoded.rbegin()->first.first;
+        uint32_t matched = 0;
+        for(const auto & scan : decoded) {
+            auto truth = recorded.find(When(scan.first.first + boots, scan.first.second));
+            if(truth == recorded.end()) {
+                CHECK(false, "scan at boot %lu, %lu ms decoded but never recorded",
+                        (unsigned long) scan.first.first, (unsigned long) scan.first.second);
+                continue;
+            }
+            bool same = memcmp(&truth->second, &scan.second, sizeof(Scan)) == 0;
+            CHECK(same, "scan at boot %lu, %lu ms decoded differently",
+                    (unsigned long) scan.first.first, (unsigned long) scan.first.second);
+            matched += same;
+        }
+        return matched;
+    }
+
+    /** Record one scan, keeping what was recorded.
+     * @param[out] ns Time taken to encode it is added here.
+     * @return True if a scan was due and recorded.
+     */
+    bool record(CellHistory & history, const uint16_t codes[Config::NUM_CMUs][12],
+            const uint8_t temperatures[Config::NUM_CMUs][12], uint32_t boot, Scans & recorded, uint64_t & ns) {
+        uint32_t before = history.raw_bytes;
+        auto start = std::chrono::steady_clock::now();
+        history.add(codes, temperatures);
+        auto end = std::chrono::steady_clock::now();
+        if(history.raw_bytes == before)
+            return false;
+
+        Scan & scan = recorded[When(boot, history.now)];
+        for(uint8_t i = 0; i < CELLS; ++i) {
+            scan.voltages[i] = codes[i / 12][i % 12] / 10;
+            scan.temperatures[i] = temperatures[i / 12][i % 12];
+        }
+        ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        return true;
+    }
+}
+
+int main() {
+    IAPSim::reset();
+    Scans recorded;
+    uint32_t boots = 0;
+    CellHistory * history = &boot();
+
+    double ocv[CELLS], resistance[CELLS], temperature[CELLS];
+    for(uint8_t i = 0; i < CELLS; ++i) {
+        ocv[i] = 4100 + noise(i) % 20; // mV
+        resistance[i] = 2 + noise(i + CELLS) % 100 / 100.0; // mOhm, of the parallel group
+        temperature[i] = 25 + noise(i + 2 * CELLS) % 3; // CMUControl::temp_scaled
+    }
+
+    // Drive 45 minutes with flash locked, then rest 15 with it writable
+    uint16_t codes[Config::NUM_CMUs][12];
+    uint8_t temperatures[Config::NUM_CMUs][12];
+    uint64_t encode_ns = 0;
+    uint32_t scans = 0;
+    uint32_t raw = 0;
+    uint32_t encoded = 0;
+    uint32_t largest = 0;
+    bool writable = false;
+    for(uint32_t second = 0; second < HOURS * 3600; ++second) {
+        bool driving = second % 3600 < 2700;
+        double current = driving ? -(20 + noise(second) % 40 + 20 * sin(second / 30.0)) : 0; // A
+        for(uint8_t i = 0; i < CELLS; ++i) {
+            ocv[i] += current * 0.0002 * (1 + 0.05 * (i % 5));
+            temperature[i] += driving ? 0.0001 * (1 + i % 4) : -0.00005;
+            double voltage = ocv[i] + current * resistance[i] + (int32_t) (noise(second * CELLS + i) % 21 - 10) / 10.0;
+            codes[i / 12][i % 12] = (uint16_t) (voltage * 10);
+            temperatures[i / 12][i % 12] = (uint8_t) temperature[i];
+        }
+        if(second % 3600 == 0)
+            for(uint8_t i = 0; i < CELLS; ++i)
+                ocv[i] = 4100 + noise(i) % 20; // Charged between drives
+
+        HostTest::advance(1000000);
+        uint32_t bytes = history->encoded_bytes;
+        if(record(*history, codes, temperatures, boots, recorded, encode_ns)) {
+            ++scans;
+            largest = history->encoded_bytes - bytes > largest ? history->encoded_bytes - bytes : largest;
+        }
+
+        if(driving == writable) {
+            writable = !driving;
+            history->setWritable(writable);
+        }
+
+        // The flush thread wakes far more often, but this is plenty to keep up
+        if(second % 10 == 0) {
+            // A power cut during a few of the flash operations, as the contactors open
+            if(writable && second % 3600 == 2700 && second / 3600 % 3 == 1)
+                IAPSim::cutAt(IAPSim::operations() + second / 3600 % 5);
+            try {
+                flush(*history);
+            } catch(IAPSim::PowerCut &) {
+                IAPSim::cutAt(-1);
+                raw += history->raw_bytes;
+                encoded += history->encoded_bytes;
+                ++boots;
+                history = &boot();
+                history->setWritable(writable);
+            }
+        }
+    }
+    history->setWritable(false);
+    history->setWritable(true);
+    flush(*history);
+    raw += history->raw_bytes;
+    encoded += history->encoded_bytes;
+
+    Scans decoded;
+    uint32_t blocks = 0;
+    CHECK(decode(decoded, blocks), "a block didn't decode to its length");
+    uint32_t matched = check(recorded, decoded);
+    // All but the sector erased last, less a slot torn by each cut
+    CHECK(blocks + boots >= CellHistory::SLOTS / Config::HISTORY_SECTORS * (Config::HISTORY_SECTORS - 1),
+            "%lu blocks in %lu slots", (unsigned long) blocks, (unsigned long) CellHistory::SLOTS);
+    CHECK(boots >= 3, "only %lu power cuts", (unsigned long) boots);
+    CHECK(!decoded.empty() && decoded.rbegin()->first.second == recorded.rbegin()->first.second,
+            "newest scan not in flash");
+    CHECK(largest <= CellHistory::MAX_SCAN, "a scan took %lu bytes", (unsigned long) largest);
+    CHECK(raw > 4 * encoded, "compressed only %.1f:1", (double) raw / encoded);
+    for(uint8_t sector = Config::HISTORY_FIRST_SECTOR; sector < Config::HISTORY_FIRST_SECTOR + Config::HISTORY_SECTORS; ++sector)
+        CHECK(IAPSim::erases(sector) >= 1, "sector %u never erased, the ring didn't wrap", sector);
+
+    printf("CellHistoryTest: %lu scans in flash of %lu recorded over %lu boots, %.1f:1, %.1f bytes a scan, %.0f ns to encode on the host\n",
+            (unsigned long) matched, (unsigned long) scans, (unsigned long) boots + 1, (double) raw / encoded,
+            (double) encoded / scans, (double) encode_ns / scans);
+
+    // Uncorrelated noise in every cell and temperature, the worst case, still fits and round trips
+    IAPSim::reset();
+    recorded.clear();
+    history = &boot();
+    history->setWritable(true);
+    for(uint32_t n = 0; n < 200; ++n) {
+        for(uint8_t i = 0; i < CELLS; ++i) {
+            codes[i / 12][i % 12] = 25000 + noise(n * CELLS + i) % 17000;
+            temperatures[i / 12][i % 12] = noise(n * CELLS + i + 7) % 256;
+        }
+        HostTest::advance(Config::HISTORY_PERIOD * 1000);
+        uint32_t bytes = history->encoded_bytes;
+        record(*history, codes, temperatures, 0, recorded, encode_ns);
+        CHECK(history->encoded_bytes - bytes <= CellHistory::MAX_SCAN, "noise scan %lu took %lu bytes",
+                (unsigned long) n, (unsigned long) (history->encoded_bytes - bytes));
+        flush(*history);
+    }
+    history->setWritable(false);
+    history->setWritable(true);
+    flush(*history);
+
+    decoded.clear();
+    CHECK(decode(decoded, blocks), "a noise block didn't decode to its length");
+    CHECK(check(recorded, decoded) == 200 && history->dropped == 0, "noise scans lost");
+
+    return HostTest::finish("CellHistoryTest");
+}
@@ -0,0 +1,162 @@
+#include "CoulombCounter.hpp"
+#include "OCVTable.hpp"
+#include "HostTest.hpp"
+#include <math.h>
+#include <stdlib.h>
+
+/* An hour of driving sampled at the ADC rate, with jittered sample times and the us ticker
+ * wrapping part way, integrated against the exact charge of the current waveform.  Alongside,
+ * the estimate counting replaced: every Config::CAN_GROUP1_PERIOD, an open circuit voltage guess
+ * from the loaded pack voltage and that moment's current sample, from a pack following the cell
+ * model's equivalent circuit.  Then the pack rests, and must only count as at rest after
+ * Config::REST_PERIOD.
+ */
+
+namespace {
+    constexpr double PI = 3.14159265358979;
+    constexpr uint32_t PERIOD = 1163; // us: 860 SPS
+    constexpr uint32_t START = 0xF0000000; // us: The ticker wraps 1192 s in
+    constexpr int32_t INITIAL = 33000; // mAh: 94 %, the hour takes it to 23 %
+
+    /** Drive current in mA, positive for charge: a 30 A draw swinging 20 A every 20 s, with
+     *  regenerative braking every 90 s. */
+    double current(double t) {
+        double i = -30000 + 20000 * sin(2 * PI * t / 20);
+        if(fmod(t, 90) >= 80)
+            i += 45000;
+        return i;
+    }
+
+    /** Exact charge from 0 to t in mAh. */
+    double integral(double t) {
+        double braking = floor(t / 90) * 10 + (fmod(t, 90) >= 80 ? fmod(t, 90) - 80 : 0);
+        double mas = -30000 * t + 20000 * 20 / (2 * PI) * (1 - cos(2 * PI * t / 20)) + 45000 * braking;
+        return mas / 3600;
+    }
+
+    /** Repeatable sample time jitter of up to 200 us, from ADC conversion and thread scheduling */
+    uint32_t jitter(uint32_t i) {
+        return ((i * 2654435761u) >> 24) % 201;
+    }
+
+    /** A pack of cell groups following CellEKF's equivalent circuit: open circuit voltage, an
+     *  ohmic drop and an RC pair. */
+    class Pack {
+        public:
+            Pack() : v1(0), last(0) {}
+
+            /** Advance to a sample.
+             * @param t Time in s.
+             * @param current Pack current in mA.
+             * @param charge Charge in the pack in mAh.
+             * @return Pack voltage in mV.
+             */
+            voltage_t sample(double t, double current, double charge) {
+                double cell_current = current / Config::NUM_CELLS_PARALLEL / 1000; // A
+                double decay = exp(-(t - last) * 1000 / Config::CELL_TIME_CONSTANT);
+                v1 = v1 * decay + (1 - decay) * (Config::CELL_RESISTANCE - Config::CELL_OHMIC_RESISTANCE) * cell_current;
+                last = t;
+                double ocv = OCV::cellVoltage((uint16_t) (charge / Config::PACK_CAPACITY * OCV::FULL));
+                return lround((ocv + Config::CELL_OHMIC_RESISTANCE * cell_current + v1) * Config::NUM_CELLS_SERIES);
+            }
+
+        private:
+            double v1; // mV: Across the RC pair
+            double last; // s
+    };
+}
+
+int main() {
+    CoulombCounter coulombs;
+    coulombs.setCharge(INITIAL);
+    CHECK(coulombs.isInitialised() && coulombs.getCharge() == INITIAL, "charge not set");
+
+    // Drive for an hour
+    uint32_t i = 0;
+    uint32_t us = 0;
+    double t = 0;
+    double charged = 0;
+    double discharged = 0;
+    double last = 0;
+    bool rested = false;
+    Pack pack;
+    uint32_t next_guess = 0; // ms
+    double counted_error = 0;
+    double counted_sum = 0;
+    double guess_error = 0;
+    double guess_sum = 0;
+    uint32_t guesses = 0;
+    for(; t < 3600; ++i) {
+        us = i * PERIOD + jitter(i);
+        t = us / 1e6;
+        current_t sample = (current_t) lround(current(t));
+        coulombs.addSample(sample, START + us);
+        rested |= coulombs.isAtRest();
+
+        double now = integral(t);
+        (now > last ? charged : discharged) += fabs(now - last);
+        last = now;
+
+        voltage_t voltage = pack.sample(t, current(t), INITIAL + now);
+        if(us / 1000 >= next_guess) {
+            // Taken from the same instant, which flatters the old estimate: on target the pack
+            // voltage came from the last CMU scan
+            next_guess += Config::CAN_GROUP1_PERIOD;
+            double error = fabs(OCV::packCharge(voltage, sample) - (INITIAL + now));
+            guess_error = error > guess_error ? error : guess_error;
+            guess_sum += error;
+            error = fabs(coulombs.getCharge() - (INITIAL + now));
+            counted_error = error > counted_error ? error : counted_error;
+            counted_sum += error;
+            ++guesses;
+        }
+    }
+
+    double expected = INITIAL + integral(t);
+    CHECK(fabs(coulombs.getCharge() - expected) <= 1, "counted %li mAh after an hour, expected %.1f mAh",
+            (long) coulombs.getCharge(), expected);
+    CHECK(fabs(coulombs.getCharged() - charged) <= 2 && fabs(coulombs.getDischarged() - discharged) <= 2,
+            "counted %lu mAh in and %lu mAh out, expected %.1f mAh and %.1f mAh",
+            (unsigned long) coulombs.getCharged(), (unsigned long) coulombs.getDischarged(), charged, discharged);
+    CHECK(abs(coulombs.getNetCharge() - ((int32_t) coulombs.getCharged() - (int32_t) coulombs.getDischarged())) <= 1,
+            "net charge %li mAh doesn't match in and out", (long) coulombs.getNetCharge());
+    CHECK(!rested, "at rest while driving");
+    printf("CoulombCounterTest: counted %li mAh after an hour, %.2f mAh from exact\n",
+            (long) coulombs.getCharge(), coulombs.getCharge() - expected);
+    CHECK(counted_error * 100 < guess_error, "counting up to %.0f mAh from exact, the voltage guess %.0f mAh",
+            counted_error, guess_error);
+    printf("CoulombCounterTest: every %li ms, counting %.1f mAh from exact on average (%.1f mAh worst), "
+            "the voltage guess it replaced %.0f mAh (%.0f mAh worst)\n", (long) Config::CAN_GROUP1_PERIOD,
+            counted_sum / guesses, counted_error, guess_sum / guesses, guess_error);
+
+    // Rest from the last drive sample, with current sensor noise below Config::REST_CURRENT
+    uint32_t rest_start = us;
+    for(;; ++i) {
+        us = i * PERIOD;
+        coulombs.addSample((current_t) jitter(i) * 4 - 400, START + us);
+        uint32_t resting = (us - rest_start) / 1000;
+        if(coulombs.isAtRest()) {
+            CHECK(resting >= (uint32_t) Config::REST_PERIOD && resting <= Config::REST_PERIOD + 2,
+                    "at rest after %lu ms", (unsigned long) resting);
+            break;
+        }
+        if(resting > 2 * Config::REST_PERIOD) {
+            CHECK(false, "not at rest after %lu ms", (unsigned long) resting);
+            break;
+        }
+    }
+
+    // One sample over the rest current starts the wait again
+    coulombs.addSample(-Config::REST_CURRENT, START + ++i * PERIOD);
+    CHECK(!coulombs.isAtRest(), "still at rest after a current spike");
+
+    // State of charge clamps to the pack's capacity
+    coulombs.setCharge(Config::PACK_CAPACITY / 2);
+    CHECK(coulombs.getSOC() == 500, "half charge is %u", coulombs.getSOC());
+    coulombs.setCharge(-100);
+    CHECK(coulombs.getSOC() == 0, "overdischarge is %u", coulombs.getSOC());
+    coulombs.setCharge(Config::PACK_CAPACITY + 100);
+    CHECK(coulombs.getSOC() == 1000, "overcharge is %u", coulombs.getSOC());
+
+    return HostTest::finish("CoulombCounterTest");
+}
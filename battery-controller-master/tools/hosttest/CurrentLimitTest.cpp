@@ -0,0 +1,101 @@
+#include "CurrentLimit.hpp"
+#include "HostTest.hpp"
+#include <stdlib.h>
+
+/* The derating curves against a floating point reference: each factor falls linearly from full
+ * current at the start of its band to zero at its limit, the limit is the most restrictive of
+ * them, and never rises as any input moves towards its limit.
+ */
+
+namespace {
+    constexpr voltage_t CELL = 3700; // mV: Nominal, outside every band
+    constexpr temperature_t TEMPERATURE = 250; // 1/10 C
+    constexpr uint16_t SOC = 500; // 1/10 %
+
+    /** Linear reference factor, 1 at or before start, 0 at or beyond end. */
+    double reference(double value, double start, double end) {
+        double factor = (end - value) / (end - start);
+        return factor > 1 ? 1 : factor < 0 ? 0 : factor;
+    }
+
+    /** Check a limit against the reference, to within the 1/1000 steps of the factors. */
+    void check(const char * name, int32_t value, current_t limit, current_t max, double factor) {
+        double expected = max * factor;
+        CHECK(abs(limit - expected) <= abs(max) / 1000, "%s limit at %li is %li mA, expected %.0f mA",
+                name, (long) value, (long) limit, expected);
+        CHECK(limit == 0 || (limit > 0) == (max > 0), "%s limit at %li has the wrong sign", name, (long) value);
+    }
+}
+
+int main() {
+    CHECK(CurrentLimit::charge(CELL, TEMPERATURE, TEMPERATURE, SOC) == Config::MAX_CHARGE_CURRENT,
+            "charge derated at nominal");
+    CHECK(CurrentLimit::discharge(CELL, TEMPERATURE, TEMPERATURE, SOC) == Config::MAX_DISCHARGE_CURRENT,
+            "discharge derated at nominal");
+
+    // Each input swept through its band on its own, and the limit never rises along the way
+    current_t last_charge = Config::MAX_CHARGE_CURRENT;
+    for(voltage_t v = Config::CHARGE_DERATE_CELL_VOLTAGE - 100; v <= Config::MAX_CELL_VOLTAGE + 100; ++v) {
+        current_t limit = CurrentLimit::charge(v, TEMPERATURE, TEMPERATURE, SOC);
+        check("charge cell voltage", v, limit, Config::MAX_CHARGE_CURRENT,
+                reference(v, Config::CHARGE_DERATE_CELL_VOLTAGE, Config::MAX_CELL_VOLTAGE));
+        CHECK(limit <= last_charge, "charge limit rose at %i mV", v);
+        last_charge = limit;
+    }
+
+    current_t last_discharge = Config::MAX_DISCHARGE_CURRENT;
+    for(voltage_t v = Config::DISCHARGE_DERATE_CELL_VOLTAGE + 100; v >= Config::UNDER_CELL_VOLTAGE - 100; --v) {
+        current_t limit = CurrentLimit::discharge(v, TEMPERATURE, TEMPERATURE, SOC);
+        check("discharge cell voltage", v, limit, Config::MAX_DISCHARGE_CURRENT,
+                reference(v, Config::DISCHARGE_DERATE_CELL_VOLTAGE, Config::UNDER_CELL_VOLTAGE));
+        CHECK(limit >= last_discharge, "discharge limit rose at %i mV", v);
+        last_discharge = limit;
+    }
+
+    for(uint16_t soc = Config::CHARGE_DERATE_SOC - 50; soc <= 1000; ++soc)
+        check("charge SOC", soc, CurrentLimit::charge(CELL, TEMPERATURE, TEMPERATURE, soc),
+                Config::MAX_CHARGE_CURRENT, reference(soc, Config::CHARGE_DERATE_SOC, 1000));
+    for(int32_t soc = Config::DISCHARGE_DERATE_SOC + 50; soc >= 0; --soc)
+        check("discharge SOC", soc, CurrentLimit::discharge(CELL, TEMPERATURE, TEMPERATURE, soc),
+                Config::MAX_DISCHARGE_CURRENT, reference(soc, Config::DISCHARGE_DERATE_SOC, 0));
+
+    // Temperature derates both ways, hot from the highest cell and cold from the lowest
+    constexpr temperature_t HOT = Config::MAX_CELL_TEMPERATURE - Config::DERATE_TEMPERATURE_BAND;
+    constexpr temperature_t COLD = Config::MIN_CELL_TEMPERATURE + Config::DERATE_TEMPERATURE_BAND;
+    for(temperature_t t = HOT - 20; t <= Config::MAX_CELL_TEMPERATURE + 20; ++t) {
+        double factor = reference(t, HOT, Config::MAX_CELL_TEMPERATURE);
+        check("charge hot", t, CurrentLimit::charge(CELL, TEMPERATURE, t, SOC), Config::MAX_CHARGE_CURRENT, factor);
+        check("discharge hot", t, CurrentLimit::discharge(CELL, TEMPERATURE, t, SOC),
+                Config::MAX_DISCHARGE_CURRENT, factor);
+    }
+    for(temperature_t t = COLD + 20; t >= Config::MIN_CELL_TEMPERATURE - 20; --t) {
+        double factor = reference(t, COLD, Config::MIN_CELL_TEMPERATURE);
+        check("charge cold", t, CurrentLimit::charge(CELL, t, TEMPERATURE, SOC), Config::MAX_CHARGE_CURRENT, factor);
+        check("discharge cold", t, CurrentLimit::discharge(CELL, t, TEMPERATURE, SOC),
+                Config::MAX_DISCHARGE_CURRENT, factor);
+    }
+
+    // Several inputs in their bands at once: the most restrictive wins
+    for(voltage_t v = Config::CHARGE_DERATE_CELL_VOLTAGE; v <= Config::MAX_CELL_VOLTAGE; v += 10)
+        for(temperature_t t = HOT; t <= Config::MAX_CELL_TEMPERATURE; t += 10)
+            for(uint16_t soc = Config::CHARGE_DERATE_SOC; soc <= 1000; soc += 10) {
+                double factor = reference(v, Config::CHARGE_DERATE_CELL_VOLTAGE, Config::MAX_CELL_VOLTAGE);
+                double hot = reference(t, HOT, Config::MAX_CELL_TEMPERATURE);
+                double full = reference(soc, Config::CHARGE_DERATE_SOC, 1000);
+                factor = hot < factor ? hot : factor;
+                factor = full < factor ? full : factor;
+                check("charge combined", v, CurrentLimit::charge(v, TEMPERATURE, t, soc),
+                        Config::MAX_CHARGE_CURRENT, factor);
+            }
+
+    // Predicted current from group resistance, in uOhm: 100 mV over 10 mOhm is 10 A
+    CHECK(CurrentLimit::predicted(4000, 4100, 10000) == 10000, "predicted charge current");
+    CHECK(CurrentLimit::predicted(4000, 3900, 10000) == -10000, "predicted discharge current");
+    CHECK(CurrentLimit::predicted(3000, 4200, 1000) == Config::MAX_CHARGE_CURRENT, "predicted charge not clamped");
+    CHECK(CurrentLimit::predicted(4200, 2700, 1000) == Config::MAX_DISCHARGE_CURRENT,
+            "predicted discharge not clamped");
+    CHECK(CurrentLimit::predicted(4000, 4100, 0) == Config::MAX_CHARGE_CURRENT
+            && CurrentLimit::predicted(4000, 4000, 0) == 0, "predicted with no resistance estimate");
+
+    return HostTest::finish("CurrentLimitTest");
+}
@@ -0,0 +1,111 @@
+#include "Filters.hpp"
+#include "BCTypes.hpp"
+#include "BCConfig.hpp"
+#include "HostTest.hpp"
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+
+/* Each filter against a direct floating point or sorting reference, at the types and lengths the
+ * firmware uses: spike rejection, step and DC responses, and CIC integrators left to wrap over a
+ * long run of large samples.
+ */
+
+namespace {
+    constexpr double PI = 3.14159265358979;
+
+    /** Repeatable pseudo-random samples */
+    int32_t noise(uint32_t i, int32_t range) {
+        return (int32_t) ((i * 2654435761u) >> 8) % (2 * range + 1) - range;
+    }
+}
+
+int main() {
+    // Median: the sorted middle of the window, so single spikes go and steps pass a sample late
+    Filters::Median<current_t, Config::SPIKE_FILTER_N> median;
+    current_t window[Config::SPIKE_FILTER_N];
+    for(uint32_t i = 0; i < 10000; ++i) {
+        current_t sample = noise(i, 100000);
+        current_t output = median.add(sample);
+        window[i % Config::SPIKE_FILTER_N] = sample;
+        uint32_t count = i < Config::SPIKE_FILTER_N ? i + 1 : Config::SPIKE_FILTER_N;
+        current_t sorted[Config::SPIKE_FILTER_N];
+        std::copy(window, window + count, sorted);
+        std::sort(sorted, sorted + count);
+        CHECK(output == sorted[count / 2], "median of sample %lu is %li, expected %li",
+                (unsigned long) i, (long) output, (long) sorted[count / 2]);
+    }
+
+    Filters::Median<voltage_t, Config::SPIKE_FILTER_N> spikes;
+    const voltage_t signal[] = {130000, 130000, 130000, 180000, 130000, 130000, 0, 130000, 140000, 140000, 140000};
+    const voltage_t expected[] = {130000, 130000, 130000, 130000, 130000, 130000, 130000, 130000, 130000, 140000, 140000};
+    for(uint8_t i = 0; i < sizeof(signal) / sizeof(signal[0]); ++i) {
+        voltage_t output = spikes.add(signal[i]);
+        CHECK(output == expected[i], "spike filter gave %li at %u, expected %li", (long) output, i, (long) expected[i]);
+    }
+
+    // IIR: the first sample sets the output, then the step response follows the float filter,
+    // lagging by up to a count more as the state truncates, and settles within a count of the input
+    for(voltage_t step : {-150000, -1, 1, 7, 150000}) {
+        Filters::IIR<voltage_t, int32_t, Config::CAR_VOLTAGE_FILTER_SHIFT> iir;
+        CHECK(iir.add(100000) == 100000, "IIR didn't start at the first sample");
+        double reference = 100000;
+        double alpha = 1.0 / (1 << Config::CAR_VOLTAGE_FILTER_SHIFT);
+        for(uint32_t i = 0; i < 50 << Config::CAR_VOLTAGE_FILTER_SHIFT; ++i) {
+            voltage_t output = iir.add(100000 + step);
+            reference += (100000 + step - reference) * alpha;
+            CHECK(fabs(output - reference) <= 2, "IIR step of %li gave %li after %lu samples, float %.1f",
+                    (long) step, (long) output, (unsigned long) i, reference);
+        }
+        CHECK(abs(iir.get() - (100000 + step)) <= 1, "IIR settled %li from a step of %li",
+                (long) (iir.get() - 100000 - step), (long) step);
+        iir.reset(5000);
+        CHECK(iir.get() == 5000, "IIR reset to %li", (long) iir.get());
+    }
+
+    // Boxcar: exactly the mean of each block, over enough full scale samples for the integrator
+    // to wrap many times
+    Filters::Boxcar<current_t, int32_t, Config::CURRENT_DECIMATION> boxcar;
+    int64_t sum = 0;
+    uint32_t outputs = 0;
+    for(uint32_t i = 0; i < 1000000; ++i) {
+        current_t sample = -180000 + noise(i, 20000);
+        sum += sample;
+        if(boxcar.add(sample)) {
+            ++outputs;
+            CHECK(boxcar.get() == sum / Config::CURRENT_DECIMATION, "boxcar %lu gave %li, expected %li",
+                    (unsigned long) outputs, (long) boxcar.get(), (long) (sum / Config::CURRENT_DECIMATION));
+            sum = 0;
+        }
+    }
+    CHECK(outputs == 1000000 / Config::CURRENT_DECIMATION, "boxcar gave %lu outputs", (unsigned long) outputs);
+
+    // Second order CIC: the triangular weighting of the last 2R - 1 samples, with unity DC gain
+    // and nulls at multiples of the output rate
+    constexpr uint16_t R = 8;
+    Filters::CIC<int32_t, int32_t, 2, R> cic;
+    int32_t history[2 * R - 1] = {};
+    for(uint32_t i = 0; i < 100000; ++i) {
+        int32_t sample = 50000 + noise(i, 50000);
+        for(uint8_t j = 2 * R - 2; j > 0; --j)
+            history[j] = history[j - 1];
+        history[0] = sample;
+        if(cic.add(sample) && i >= 2 * R) {
+            int64_t weighted = 0;
+            for(uint8_t j = 0; j < 2 * R - 1; ++j)
+                weighted += (int64_t) history[j] * (j < R ? j + 1 : 2 * R - 1 - j);
+            CHECK(cic.get() == weighted / (R * R), "CIC at %lu gave %li, expected %li",
+                    (unsigned long) i, (long) cic.get(), (long) (weighted / (R * R)));
+        }
+    }
+
+    Filters::CIC<int32_t, int32_t, 2, R> null;
+    for(uint32_t i = 0; i < 100 * R; ++i) {
+        // Any frequency a multiple of fs / R, on top of an offset
+        int32_t sample = 1000 + lround(20000 * sin(2 * PI * 3 * i / R) + 20000 * sin(2 * PI * i / R));
+        if(null.add(sample) && i >= 2 * R)
+            CHECK(abs(null.get() - 1000) <= 1, "CIC passed %li of a tone at its null", (long) (null.get() - 1000));
+    }
+
+    return HostTest::finish("FiltersTest");
+}
@@ -0,0 +1,112 @@
+#include "FixedPoint.hpp"
+#include "BCConfig.hpp"
+#include "HostTest.hpp"
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+/* The measurement scale factors over the whole ADC range against the float conversion they
+ * replaced, and Fixed arithmetic against double, rounding to nearest both ways from zero.  Then
+ * the host time to scale a current sample both ways.
+ */
+
+namespace {
+    /** Within the rounding of a result, or on a tie the double can't settle. */
+    bool rounds(double exact, int64_t result) {
+        return fabs(exact - result) < 0.5 + 1e-6;
+    }
+
+    /** Repeatable pseudo-random values across the whole range of an int32_t */
+    int32_t noise(uint32_t i) {
+        return (int32_t) (i * 2654435761u);
+    }
+
+    constexpr float OLD_CURRENT_SCALING = 3.263; // mA per ADC division, as the float Config was
+
+    typedef std::chrono::steady_clock Clock;
+
+    double nsSince(Clock::time_point start, uint32_t samples) {
+        return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count() / samples;
+    }
+}
+
+int main() {
+    // Current is scaled from 1/16 ADC counts of the filtered shunt reading, positive and negative.
+    // The factors are held to 2^-24, so results round from them, and are within a count of float.
+    double current_scale = Config::PACK_CURRENT_SCALING.getRaw() / (double) (1 << 24);
+    CHECK(fabs(current_scale - 3.263) < 1e-7, "current scale is %.9f", current_scale);
+    for(int32_t code = -32768 * 16; code < 32768 * 16; ++code) {
+        int32_t current = Config::PACK_CURRENT_SCALING.scale(code, 4);
+        double exact = code * current_scale / 16;
+        if(!rounds(exact, current) || fabs(code * 3.263 / 16 - current) > 0.51) {
+            CHECK(false, "%li / 16 counts gave %li mA, float %.3f mA", (long) code, (long) current, exact);
+            break;
+        }
+    }
+
+    double voltage_scale = Config::PACK_VOLTAGE_SCALING.getRaw() / (double) (1 << 24);
+    for(int32_t code = 0; code < 32768; ++code) {
+        int32_t voltage = Config::PACK_VOLTAGE_SCALING.scale(code);
+        double exact = code * voltage_scale;
+        if(!rounds(exact, voltage) || fabs(code * 2 * 6.28 - voltage) > 0.51) {
+            CHECK(false, "%li counts gave %li mV, float %.3f mV", (long) code, (long) voltage, exact);
+            break;
+        }
+    }
+
+    // Arithmetic, in the Fixed<16> the cell model uses
+    typedef Fixed<16> F;
+    const double LSB = 1.0 / (1 << 16);
+    for(uint32_t i = 0; i < 100000; ++i) {
+        // Operands up to +-256 so products stay in range
+        F a = F::fromRaw(noise(i) >> 7);
+        F b = F::fromRaw(noise(i + 100000) >> 7);
+        double x = a.getRaw() * LSB;
+        double y = b.getRaw() * LSB;
+
+        CHECK((a + b).getRaw() == a.getRaw() + b.getRaw() && (a - b).getRaw() == a.getRaw() - b.getRaw(),
+                "%.6f +- %.6f", x, y);
+        CHECK(rounds(x * y / LSB, (a * b).getRaw()), "%.6f * %.6f gave %.6f", x, y, (a * b).getRaw() * LSB);
+        if(fabs(y) > 1 && fabs(x / y) < 32000)
+            CHECK(rounds(x / y / LSB, (a / b).getRaw()), "%.6f / %.6f gave %.6f", x, y, (a / b).getRaw() * LSB);
+        CHECK(rounds(x, a.round()), "%.6f rounded to %li", x, (long) a.round());
+
+        int64_t num = noise(i + 200000);
+        int64_t den = noise(i + 300000) | 1;
+        if(fabs((double) num / den) < 32000)
+            CHECK(rounds((double) num / den / LSB, F::fromRatio(num, den).getRaw()), "%lli / %lli gave %.6f",
+                    (long long) num, (long long) den, F::fromRatio(num, den).getRaw() * LSB);
+    }
+
+    // Scalar<T> gives the float and fixed point instantiations the same results, ties included
+    for(int32_t num = -5000; num <= 5000; num += 7) {
+        CHECK(Scalar<float>::round(Scalar<float>::ratio(num, 10)) == Scalar<F>::round(Scalar<F>::ratio(num, 10)),
+                "%li / 10 rounds differently", (long) num);
+    }
+
+    // Host time per current sample, scaled as BCInputInterface::addCurrent() does and as the float
+    // code before it did.  The host has an FPU where the LPC1768 doesn't, so this understates the
+    // saving there; BCInputInterface::getScaleCycles() measures it on target.
+    std::vector<int32_t> offsets(1 << 20); // 1/16 ADC counts from the shunt offset
+    for(uint32_t i = 0; i < offsets.size(); ++i)
+        offsets[i] = noise(i) >> 12;
+    int64_t fixed_sum = 0;
+    int64_t float_sum = 0;
+    Clock::time_point start = Clock::now();
+    for(uint8_t pass = 0; pass < 20; ++pass)
+        for(int32_t offset : offsets)
+            fixed_sum += Config::PACK_CURRENT_SCALING.scale(offset, 4);
+    double fixed_ns = nsSince(start, 20 * offsets.size());
+    start = Clock::now();
+    for(uint8_t pass = 0; pass < 20; ++pass)
+        for(int32_t offset : offsets)
+            float_sum += (current_t) (offset * OLD_CURRENT_SCALING / 16);
+    double float_ns = nsSince(start, 20 * offsets.size());
+    // Float truncates towards zero where scale() rounds, so they differ by under a count a sample
+    CHECK(llabs(fixed_sum - float_sum) < 20 * (int64_t) offsets.size(), "scaled sums %lli and %lli",
+            (long long) fixed_sum, (long long) float_sum);
+    printf("FixedPointTest: a current sample scales in %.2f ns fixed point and %.2f ns float on the host\n",
+            fixed_ns, float_ns);
+
+    return HostTest::finish("FixedPointTest");
+}
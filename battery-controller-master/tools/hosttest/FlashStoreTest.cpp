@@ -0,0 +1,164 @@
+// The flush thread never runs here, so its work, flush(), is called directly
+#define private public
+#include "FlashStore.cpp"
+#undef private
+
+#include "HostTest.hpp"
+#include "IAPSim.hpp"
+#include <new>
+#include <vector>
+
+/* Power is cut at every erase and program of a workload that wraps the sector ring several times,
+ * one run per operation.  After each cut the store is mounted again and every key must read back
+ * as its latest committed value, or one written since that was on its way to flash - never an
+ * older value and never lost.  Keys written once at the start only survive by being copied
+ * forward by retire() each time the ring wraps.  The store must then carry on as normal.
+ */
+
+namespace {
+    typedef std::vector<uint8_t> Value;
+
+    constexpr uint16_t ROUNDS = 480;
+    constexpr uint8_t HOT_KEYS = 6;
+
+    alignas(FlashStore) uint8_t storage[sizeof(FlashStore)];
+
+    FlashStore & mount() {
+        FlashStore * store = new (storage) FlashStore();
+        store->setWritable(true);
+        return *store;
+    }
+
+    /** Distinct value for every key and version, one key always the largest record.  A round's
+     *  records fit in the RAM buffer. */
+    Value make(uint8_t key, uint32_t version) {
+        uint8_t length = key == 1 ? Config::STORE_MAX_RECORD : 1 + (key * 37 + version * 11) % 100;
+        Value value(length);
+        for(uint8_t i = 0; i < length; ++i)
+            value[i] = key * 31 + version * 7 + i;
+        return value;
+    }
+
+    /** Keys written in a round: every key once over the first rounds, then only the hot ones. */
+    void writeRound(FlashStore & store, uint16_t round, std::vector<Value> pending[]) {
+        uint16_t first = round * 3;
+        for(uint16_t key = first; key < first + 3 && key < Config::STORE_KEYS; ++key) {
+            Value value = make(key, round);
+            CHECK(store.write(key, value.data(), value.size()), "key %hhu dropped", key);
+            pending[key].push_back(value);
+        }
+
+        for(uint8_t key = 0; key < HOT_KEYS; ++key) {
+            Value value = make(key, round + 1000);
+            CHECK(store.write(key, value.data(), value.size()), "key %hhu dropped", key);
+            pending[key].push_back(value);
+        }
+    }
+
+    bool readBack(FlashStore & store, uint8_t key, Value & value) {
+        uint8_t data[Config::STORE_MAX_RECORD];
+        int16_t length = store.read(key, data);
+        if(length < 0)
+            return false;
+        value.assign(data, data + length);
+        return true;
+    }
+
+    /** Run the workload with power cut at one operation.
+     * @return True if the cut came, false if the workload finished first.
+     */
+    bool run(long cut) {
+        IAPSim::reset();
+        IAPSim::cutAt(cut);
+
+        std::vector<Value> committed(Config::STORE_KEYS);
+        std::vector<bool> have(Config::STORE_KEYS, false);
+        std::vector<Value> pending[Config::STORE_KEYS];
+
+        FlashStore * store = &mount();
+        for(uint16_t round = 0; round < ROUNDS; ++round) {
+            writeRound(*store, round, pending);
+            try {
+                store->flush();
+            } catch(IAPSim::PowerCut &) {
+                store = &mount();
+
+                for(uint8_t key = 0; key < Config::STORE_KEYS; ++key) {
+                    Value value;
+                    if(!readBack(*store, key, value)) {
+                        CHECK(!have[key], "cut at %ld: key %hhu lost", cut, key);
+                        continue;
+                    }
+
+                    bool latest = have[key] && value == committed[key];
+                    for(const Value & written : pending[key])
+                        latest = latest || value == written;
+                    CHECK(latest, "cut at %ld: key %hhu read back an older value", cut, key);
+
+                    committed[key] = value;
+                    have[key] = true;
+                }
+
+                // And the store recovers: everything from here on is committed again
+                for(uint16_t more = 0; more < 40; ++more) {
+                    for(uint8_t key = 0; key < Config::STORE_KEYS; ++key)
+                        pending[key].clear();
+                    writeRound(*store, round + 1 + more, pending);
+                    store->flush();
+                    for(uint8_t key = 0; key < Config::STORE_KEYS; ++key) {
+                        if(!pending[key].empty()) {
+                            committed[key] = pending[key].back();
+                            have[key] = true;
+                        }
+                    }
+                }
+
+                store = &mount();
+                for(uint8_t key = 0; key < Config::STORE_KEYS; ++key) {
+                    Value value;
+                    bool found = readBack(*store, key, value);
+                    CHECK(found == have[key] && (!found || value == committed[key]),
+                            "cut at %ld: key %hhu wrong after recovery", cut, key);
+                }
+                return true;
+            }
+
+            for(uint8_t key = 0; key < Config::STORE_KEYS; ++key) {
+                if(!pending[key].empty()) {
+                    committed[key] = pending[key].back();
+                    have[key] = true;
+                    pending[key].clear();
+                }
+            }
+        }
+
+        store = &mount();
+        for(uint8_t key = 0; key < Config::STORE_KEYS; ++key) {
+            Value value;
+            bool found = readBack(*store, key, value);
+            CHECK(found && value == committed[key], "key %hhu wrong after a clean run", key);
+        }
+        CHECK(store->getDropped() == 0, "%lu records dropped", (unsigned long) store->getDropped());
+        return false;
+    }
+}
+
+int main() {
+    run(-1);
+    long operations = IAPSim::operations();
+
+    // The ring must have wrapped for retire() to be covered
+    uint32_t least = UINT32_MAX;
+    for(uint8_t s = 0; s < Config::STORE_SECTORS; ++s) {
+        uint32_t erases = IAPSim::erases(Config::STORE_FIRST_SECTOR + s);
+        least = erases < least ? erases : least;
+    }
+    CHECK(least >= 2, "every sector should have been erased at least twice, least %lu", (unsigned long) least);
+    printf("FlashStoreTest: %ld operations, each sector erased at least %lu times\n", operations,
+            (unsigned long) least);
+
+    for(long cut = 0; cut < operations; ++cut)
+        CHECK(run(cut), "cut at %ld never came", cut);
+
+    return HostTest::finish("FlashStoreTest");
+}
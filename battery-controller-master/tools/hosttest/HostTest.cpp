@@ -0,0 +1,22 @@
+#include "HostTest.hpp"
+#include <mbed.h>
+
+uint32_t host_us = 0;
+DWT_Type host_dwt;
+CoreDebug_Type host_core_debug;
+
+namespace HostTest {
+    uint32_t failures = 0;
+
+    int finish(const char * name) {
+        if(failures)
+            printf("%s: %lu checks FAILED\n", name, (unsigned long) failures);
+        else
+            printf("%s: ok\n", name);
+        return failures ? 1 : 0;
+    }
+
+    void advance(uint32_t us) {
+        host_us += us;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef HOST_TEST_HPP
+#define HOST_TEST_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+
+/** Assertions for the host tests.  A failed CHECK is reported and counted, and the test carries
+ *  on, so one run shows every failure; main() returns finish() so make stops on a failing test.
+ */
+namespace HostTest {
+    extern uint32_t failures;
+
+    /** Report the result of a test.
+     * @return Exit status for main().
+     */
+    int finish(const char * name);
+
+    /** Move the simulated us_ticker_read() clock on. */
+    void advance(uint32_t us);
+}
+
+#define CHECK(condition, ...) do { \
+        if(!(condition)) { \
+            ++HostTest::failures; \
+            printf("%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #condition); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } while(0)
+
+#endif
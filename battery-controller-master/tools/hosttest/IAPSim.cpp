@@ -0,0 +1,107 @@
+#include "IAPSim.hpp"
+#include "HostTest.hpp"
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+    constexpr uint8_t FIRST_SECTOR = 22;
+    constexpr uint8_t SECTORS = 8;
+    constexpr uint32_t BASE = IAP::sectorAddress(FIRST_SECTOR);
+    constexpr uint32_t SECTOR_SIZE = IAP::sectorSize(FIRST_SECTOR);
+
+    uint8_t flash[SECTORS * SECTOR_SIZE];
+    bool programmed[SECTORS * SECTOR_SIZE / IAP::PAGE_SIZE];
+    uint32_t sector_erases[SECTORS];
+    long count;
+    long cut = -1;
+    uint32_t seed;
+
+    /** Repeatable pseudo random bytes for the half done operation. */
+    uint32_t noise() {
+        seed = seed * 1103515245 + 12345;
+        return seed >> 16;
+    }
+
+    uint32_t offset(uint32_t address) {
+        if(address < BASE || address >= BASE + sizeof(flash)) {
+            printf("IAPSim: address %lX outside the simulated flash\n", (unsigned long) address);
+            abort();
+        }
+        return address - BASE;
+    }
+
+    /** Count an operation, true if power is cut during it. */
+    bool cutting() {
+        seed = count;
+        return count++ == cut;
+    }
+}
+
+namespace IAP {
+    uint32_t erase(uint8_t sector) {
+        uint32_t start = offset(sectorAddress(sector));
+        if(cutting()) {
+            // An interrupted erase leaves any mix of erased and old bytes
+            for(uint32_t i = 0; i < SECTOR_SIZE; ++i)
+                if(noise() & 1)
+                    flash[start + i] = 0xFF;
+            throw IAPSim::PowerCut();
+        }
+
+        memset(flash + start, 0xFF, SECTOR_SIZE);
+        memset(programmed + start / PAGE_SIZE, 0, SECTOR_SIZE / PAGE_SIZE);
+        ++sector_erases[sector - FIRST_SECTOR];
+        return CMD_SUCCESS;
+    }
+
+    uint32_t program(uint32_t address, const uint32_t * data) {
+        uint32_t start = offset(address);
+        CHECK(start % PAGE_SIZE == 0, "page %lX not aligned", (unsigned long) address);
+        CHECK(!programmed[start / PAGE_SIZE], "page %lX programmed twice", (unsigned long) address);
+        programmed[start / PAGE_SIZE] = true;
+
+        const uint8_t * bytes = (const uint8_t *) data;
+        if(cutting()) {
+            // Programmed in order up to the cut, then a byte with only some of its bits
+            uint32_t done = noise() % PAGE_SIZE;
+            for(uint32_t i = 0; i < done; ++i)
+                flash[start + i] &= bytes[i];
+            flash[start + done] &= bytes[done] | noise();
+            throw IAPSim::PowerCut();
+        }
+
+        for(uint32_t i = 0; i < PAGE_SIZE; ++i)
+            flash[start + i] &= bytes[i];
+        return CMD_SUCCESS;
+    }
+
+    const uint8_t * read(uint32_t address) {
+        return flash + offset(address);
+    }
+
+    uint32_t imageEnd() {
+        return BASE; // Right up to the history, and no further
+    }
+}
+
+namespace IAPSim {
+    void reset() {
+        memset(flash, 0xFF, sizeof(flash));
+        memset(programmed, 0, sizeof(programmed));
+        memset(sector_erases, 0, sizeof(sector_erases));
+        count = 0;
+        cut = -1;
+    }
+
+    void cutAt(long operation) {
+        cut = operation;
+    }
+
+    long operations() {
+        return count;
+    }
+
+    uint32_t erases(uint8_t sector) {
+        return sector_erases[sector - FIRST_SECTOR];
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef IAP_SIM_HPP
+#define IAP_SIM_HPP
+
+#include "IAP.hpp"
+
+/** Simulated flash behind the IAP calls, covering the history and store sectors (0x40000 up).
+ *
+ * Erases set a sector to 0xFF and programming can only clear bits, as on the LPC1768, and a page
+ * programmed twice between erases fails the test.  Power can be cut at any erase or program:
+ * that operation is left half done, a sector partly erased or a page partly programmed, and
+ * PowerCut is thrown for the test to catch and "reboot".
+ */
+namespace IAPSim {
+    struct PowerCut {};
+
+    /** Erase the whole simulated flash and restart the operation count. */
+    void reset();
+
+    /** Throw PowerCut during an operation.
+     * @param operation Count from reset() of the erase or program to cut, or -1 for none.
+     */
+    void cutAt(long operation);
+
+    /** Erases and programs since reset(). */
+    long operations();
+
+    /** Erases of one sector since reset(). */
+    uint32_t erases(uint8_t sector);
+}
+
+#endif
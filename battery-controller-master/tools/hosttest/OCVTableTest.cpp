@@ -0,0 +1,175 @@
+#include "OCVTable.hpp"
+#include "HostTest.hpp"
+#include <math.h>
+#include <stdlib.h>
+#include <chrono>
+#include <initializer_list>
+
+/* The open circuit voltage table against the piecewise linear fit it was generated from, and
+ * cellVoltage() against cellSOC(), which it inverts.  Then packCharge() against the float if
+ * chain it replaced, for results and host time.
+ */
+
+namespace {
+    struct Segment {
+        double low; // V
+        double offset; // V
+        double slope; // V/Ah
+    };
+
+    constexpr Segment SEGMENTS[] = {{4.17, 4.2303, 0.437}, {4.14, 4.197, 0.206}, {4.12, 4.183, 0.149},
+            {4.09, 4.216, 0.229}, {3.5, 4.215, 0.262}, {3.485, 4.021, 0.195},
+            {3.32, 5.28, 0.653}, {3.0, 6.516, 1.065}};
+
+    /** The fit, in Ah of a 3.2 Ah cell, as in the generator in OCVTable.hpp. */
+    double capacity(double v) {
+        if(v >= 4.2)
+            return 3.2;
+        for(const Segment & segment : SEGMENTS)
+            if(v > segment.low)
+                return 3.2 + (v - segment.offset) / segment.slope;
+        return 0;
+    }
+
+    /** Within a step of the fit's own jumps, which the table interpolates across. */
+    bool nearJump(voltage_t mv) {
+        if(abs(mv - 4200) <= OCV::TABLE_STEP)
+            return true;
+        for(const Segment & segment : SEGMENTS)
+            if(abs(mv - (voltage_t) lround(segment.low * 1000)) <= OCV::TABLE_STEP)
+                return true;
+        return false;
+    }
+
+    /** The float chain packCharge() replaced, as it was in BCStateMachine, in mAh. */
+    int32_t oldCharge(voltage_t packVoltage, current_t packCurrent) {
+        float amp_hours;
+        float comp_voltage;
+        comp_voltage = ((float)packVoltage/36000) - ((float)packCurrent / 11000 * 0.06);
+        if(comp_voltage >= 4.2){
+            amp_hours = 11 * 3.2;
+        }else if (comp_voltage > 4.17){
+            amp_hours = 11 * (3.2 + (comp_voltage - 4.2303) / 0.437);
+        }else if (comp_voltage > 4.14){
+            amp_hours = 11 * (3.2 + (comp_voltage - 4.197) / 0.206);
+        }else if (comp_voltage > 4.12){
+            amp_hours = 11 * (3.2 + (comp_voltage - 4.183) / 0.149);
+        }else if (comp_voltage > 4.09){
+            amp_hours = 11 * (3.2 + (comp_voltage - 4.216) / 0.229);
+        }else if (comp_voltage > 3.5){
+            amp_hours = 11 * (3.2 + (comp_voltage - 4.215) / 0.262);
+        }else if (comp_voltage > 3.485){
+            amp_hours = 11 * (3.2 + (comp_voltage - 4.021) / 0.195);
+        }else if (comp_voltage > 3.32){
+            amp_hours = 11 * (3.2 + (comp_voltage - 5.28) / 0.653);
+        }else if (comp_voltage > 3.0){
+            amp_hours = 11 * (3.2 + (comp_voltage - 6.516) / 1.065);
+        }else {
+            amp_hours = 0;
+        }
+        return amp_hours * 1000;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+
+    /** Pack voltages of the sweep, a cell from below the table to above full, every mV. */
+    constexpr voltage_t SWEEP_FIRST = OCV::TABLE_MIN - 100; // mV a cell
+    constexpr voltage_t SWEEP_LAST = 4300; // mV a cell
+    constexpr uint32_t SWEEP_PASSES = 200;
+
+    /** Host time of a charge estimate over the sweep, in ns a call.
+     * @param[out] sum Of every estimate, so the calls can't be optimised away.
+     */
+    template<typename Estimate>
+    double timeSweep(Estimate estimate, int64_t & sum) {
+        sum = 0;
+        Clock::time_point start = Clock::now();
+        for(uint32_t pass = 0; pass < SWEEP_PASSES; ++pass) {
+            current_t current = -(current_t) (pass % 40) * 1000; // mA: Discharging, differently each pass
+            for(voltage_t mv = SWEEP_FIRST; mv <= SWEEP_LAST; ++mv)
+                sum += estimate(mv * Config::NUM_CELLS_SERIES, current);
+        }
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        return (double) ns / (SWEEP_PASSES * (SWEEP_LAST - SWEEP_FIRST + 1));
+    }
+}
+
+int main() {
+    // The table is the fit, clamped and made monotonic
+    double last = 0;
+    for(uint16_t i = 0; i < OCV::TABLE_LEN; ++i) {
+        double soc = capacity((OCV::TABLE_MIN + i * OCV::TABLE_STEP) / 1000.0) / 3.2 * OCV::FULL;
+        soc = soc < last ? last : soc > OCV::FULL ? OCV::FULL : soc;
+        last = soc;
+        CHECK(fabs(OCV::TABLE[i] - soc) <= 1, "entry %u is %u, generated %.1f", i, OCV::TABLE[i], soc);
+        CHECK(i == 0 || OCV::TABLE[i] >= OCV::TABLE[i - 1], "entry %u falls", i);
+    }
+    CHECK(OCV::TABLE[0] == 0 && OCV::TABLE[OCV::TABLE_LEN - 1] == OCV::FULL, "table doesn't span empty to full");
+
+    // Every mV against the fit, to 1 % of capacity away from the fit's jumps
+    double worst = 0;
+    voltage_t worst_at = 0;
+    for(voltage_t mv = OCV::TABLE_MIN - 100; mv <= 4300; ++mv) {
+        uint16_t soc = OCV::cellSOC(mv);
+        CHECK(mv == OCV::TABLE_MIN - 100 || soc >= OCV::cellSOC(mv - 1), "SOC falls at %i mV", mv);
+        double fit = capacity(mv / 1000.0) / 3.2 * OCV::FULL;
+        fit = fit < 0 ? 0 : fit;
+        double error = fabs(soc - fit) / OCV::FULL;
+        if(!nearJump(mv) && error > worst) {
+            worst = error;
+            worst_at = mv;
+        }
+    }
+    CHECK(worst < 0.01, "SOC %.2f %% from the fit at %i mV", worst * 100, worst_at);
+    printf("OCVTableTest: cell SOC within %.2f %% of the fit\n", worst * 100);
+
+    // Pack charge scales a cell by capacity, after taking out the load's drop across the cells
+    for(voltage_t mv = 3100; mv <= 4200; mv += 50) {
+        int32_t expected = (int64_t) OCV::cellSOC(mv) * Config::PACK_CAPACITY / OCV::FULL;
+        CHECK(abs(OCV::packCharge(mv * Config::NUM_CELLS_SERIES, 0) - expected) <= 1,
+                "pack charge at %i mV a cell", mv);
+        current_t current = -20000;
+        voltage_t drop = current * Config::CELL_RESISTANCE / (Config::NUM_CELLS_PARALLEL * 1000);
+        CHECK(OCV::packCharge((mv + drop) * Config::NUM_CELLS_SERIES, current) == expected,
+                "pack charge at %i mV a cell under load", mv);
+    }
+
+    // cellVoltage() inverts cellSOC() to within a mV's worth of charge, which is any voltage
+    // along a flat segment
+    for(voltage_t mv = OCV::TABLE_MIN; mv <= OCV::TABLE_MIN + (OCV::TABLE_LEN - 1) * OCV::TABLE_STEP; ++mv) {
+        uint16_t soc = OCV::cellSOC(mv);
+        int32_t slope = 0;
+        voltage_t voltage = OCV::cellVoltage(soc, &slope);
+        CHECK(slope > 0, "slope %li mV per full at %i mV", (long) slope, mv);
+        CHECK(abs(OCV::cellSOC(voltage) - soc) <= OCV::FULL / slope + 1,
+                "%i mV gave %u, which gave %i mV", mv, soc, voltage);
+    }
+
+    // packCharge() against the float chain over the sweep, to 1 % of capacity away from the
+    // fit's jumps, which the old chain steps across and the table interpolates.  Below 3.1 V the
+    // chain went negative where the table stops at empty.
+    double worst_old = 0;
+    for(current_t current : {0, -20000, 10000}) {
+        voltage_t drop = current * Config::CELL_RESISTANCE / (Config::NUM_CELLS_PARALLEL * 1000);
+        for(voltage_t mv = SWEEP_FIRST; mv <= SWEEP_LAST; ++mv) {
+            if(nearJump(mv - drop) || nearJump(mv - drop - 1))
+                continue;
+            int32_t table = OCV::packCharge(mv * Config::NUM_CELLS_SERIES, current);
+            int32_t old = oldCharge(mv * Config::NUM_CELLS_SERIES, current);
+            double error = fabs(table - (old > 0 ? old : 0)) / Config::PACK_CAPACITY;
+            worst_old = error > worst_old ? error : worst_old;
+        }
+    }
+    CHECK(worst_old < 0.01, "pack charge up to %.2f %% from the float chain", worst_old * 100);
+
+    int64_t table_sum;
+    int64_t old_sum;
+    double table_ns = timeSweep(OCV::packCharge, table_sum);
+    double old_ns = timeSweep(oldCharge, old_sum);
+    CHECK(llabs(table_sum - old_sum) < (int64_t) SWEEP_PASSES * (SWEEP_LAST - SWEEP_FIRST + 1) * Config::PACK_CAPACITY / 100,
+            "sweep sums %lli and %lli mAh", (long long) table_sum, (long long) old_sum);
+    printf("OCVTableTest: pack charge within %.2f %% of the float chain, %.1f ns from the table and %.1f ns from the chain on the host\n",
+            worst_old * 100, table_ns, old_ns);
+
+    return HostTest::finish("OCVTableTest");
+}
@@ -0,0 +1,101 @@
+#include "PrechargeMonitor.hpp"
+#include "HostTest.hpp"
+#include <math.h>
+#include <stdlib.h>
+
+/* The car bus charging through the precharge resistor, V = Vf (1 - exp(-t / tau)), sampled with
+ * ADC noise.  The fit must converge on tau and the final voltage, complete on the first sample past
+ * the threshold, and fail each fault early rather than at Config::PRECHARGE_ERROR_PERIOD.
+ */
+
+namespace {
+    constexpr voltage_t PACK = 36 * 3700; // mV
+    constexpr uint32_t PERIOD = 10000; // us: Car voltage sample period
+    constexpr uint32_t START = 0xFFFF0000; // us: Just before the ticker wraps
+
+    struct Result {
+        PrechargeMonitor::Status status;
+        uint32_t at; // ms from start
+        uint32_t crossed; // ms the bus crossed the threshold, 0 if it didn't
+        voltage_t final_voltage; // Fitted half way to the threshold
+        uint32_t predicted; // ms, predicted half way
+    };
+
+    /** Repeatable noise of a few ADC counts, each 12.56 mV */
+    int32_t noise(uint32_t i) {
+        return (int32_t) ((i * 2654435761u) >> 29) * 13 - 45;
+    }
+
+    /** Precharge a bus until it completes or fails.
+     * @param tau Bus time constant in ms, 0 for a bus that charges within a sample.
+     */
+    Result run(float final_voltage, float tau, current_t current) {
+        PrechargeMonitor precharge;
+        precharge.start(START, PACK);
+
+        Result result = {};
+        float threshold = Config::PRECHARGE_COMPLETE_PERCENTAGE * PACK;
+        for(uint32_t i = 0; ; ++i) {
+            uint32_t t = i * PERIOD / 1000; // ms
+            float v = tau > 0 ? final_voltage * (1 - expf(-(float) t / tau)) : final_voltage;
+            if(!result.crossed && v > threshold)
+                result.crossed = t;
+
+            result.status = precharge.update(START + i * PERIOD, (voltage_t) v + noise(i), current);
+            result.at = t;
+            if(v < threshold / 2) {
+                result.final_voltage = precharge.finalVoltage();
+                result.predicted = precharge.predictedCompletion();
+            }
+            if(result.status != PrechargeMonitor::IN_PROGRESS || t > 2 * Config::PRECHARGE_ERROR_PERIOD)
+                return result;
+        }
+    }
+}
+
+int main() {
+    // A healthy bus, tau 80 ms: completes on the first sample past 95 %, about 240 ms
+    Result healthy = run(PACK, 80, 2000);
+    CHECK(healthy.status == PrechargeMonitor::COMPLETE, "healthy bus gave status %d", healthy.status);
+    CHECK(healthy.at <= healthy.crossed + PERIOD / 1000, "completed at %lu ms, crossed at %lu ms",
+            (unsigned long) healthy.at, (unsigned long) healthy.crossed);
+    CHECK(abs(healthy.final_voltage - PACK) < PACK / 50, "final voltage fitted as %li mV half way",
+            (long) healthy.final_voltage);
+    CHECK(abs((int32_t) healthy.predicted - (int32_t) healthy.crossed) < 30,
+            "completion predicted half way as %lu ms, crossed at %lu ms",
+            (unsigned long) healthy.predicted, (unsigned long) healthy.crossed);
+    printf("PrechargeMonitorTest: healthy bus complete at %lu ms, predicted %lu ms half way\n",
+            (unsigned long) healthy.at, (unsigned long) healthy.predicted);
+
+    // Too little bus capacitance to fit: complete once over the threshold for the fixed time
+    Result instant = run(PACK, 0, 0);
+    CHECK(instant.status == PrechargeMonitor::COMPLETE && instant.at >= Config::PRECHARGE_MIN_PERIOD,
+            "bus with no capacitance gave status %d at %lu ms", instant.status, (unsigned long) instant.at);
+
+    // A load on the bus holds it at 70 %: caught once the fit converges, long before the timeout
+    Result loaded = run(PACK * 7 / 10, 80, 4000);
+    CHECK(loaded.status == PrechargeMonitor::SHORT_CIRCUIT && loaded.at < Config::PRECHARGE_ERROR_PERIOD / 2,
+            "loaded bus gave status %d at %lu ms", loaded.status, (unsigned long) loaded.at);
+
+    // Nothing moves: open precharge circuit without current, a short with it
+    Result open = run(0, 80, 0);
+    CHECK(open.status == PrechargeMonitor::OPEN_CIRCUIT && open.at <= Config::PRECHARGE_OPEN_PERIOD + 10,
+            "open circuit gave status %d at %lu ms", open.status, (unsigned long) open.at);
+    Result shorted = run(0, 80, 3000);
+    CHECK(shorted.status == PrechargeMonitor::SHORT_CIRCUIT && shorted.at <= Config::PRECHARGE_OPEN_PERIOD + 10,
+            "shorted bus gave status %d at %lu ms", shorted.status, (unsigned long) shorted.at);
+
+    // Too much capacitance, tau 600 ms: would take 1.8 s, so fails before the timeout, once the
+    // fit has seen enough of the curve through the noise
+    Result slow = run(PACK, 600, 2000);
+    CHECK(slow.status == PrechargeMonitor::TOO_SLOW && slow.at < Config::PRECHARGE_ERROR_PERIOD,
+            "slow bus gave status %d at %lu ms", slow.status, (unsigned long) slow.at);
+
+    // Samples queued before the precharge contactor closed are ignored
+    PrechargeMonitor precharge;
+    precharge.start(START, PACK);
+    CHECK(precharge.update(START - 400000, PACK, 0) == PrechargeMonitor::IN_PROGRESS
+            && precharge.elapsed() == 0, "sample from before start() was used");
+
+    return HostTest::finish("PrechargeMonitorTest");
+}
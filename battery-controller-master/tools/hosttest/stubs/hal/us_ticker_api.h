@@ -0,0 +1,15 @@
+#ifndef HOST_US_TICKER_API_H
+#define HOST_US_TICKER_API_H
+
+#include <stdint.h>
+
+typedef uint32_t timestamp_t;
+
+// Simulated microsecond clock, moved on by the tests
+extern uint32_t host_us;
+
+inline uint32_t us_ticker_read() {
+    return host_us;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef HOST_MBED_H
+#define HOST_MBED_H
+
+// Just enough of mbed OS for the modules under test to build on a host.  Threads never run, so
+// tests call the work a thread would do themselves; time is the simulated clock in HostTest.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hal/us_ticker_api.h"
+
+template<typename F> class Callback;
+
+template<typename R, typename... A>
+class Callback<R(A...)> {
+    public:
+        Callback() {}
+        Callback(R (*)(A...)) {}
+        template<typename T> Callback(T *, R (T::*)(A...)) {}
+        R operator()(A...) const { return R(); }
+};
+
+template<typename T, typename R, typename... A>
+Callback<R(A...)> callback(T * object, R (T::*method)(A...)) {
+    return Callback<R(A...)>(object, method);
+}
+
+enum osPriority { osPriorityLow = -2, osPriorityNormal = 0, osPriorityHigh = 2 };
+
+class Thread {
+    public:
+        Thread(osPriority = osPriorityNormal, uint32_t = 0) {}
+        int start(Callback<void()>) { return 0; }
+        static int wait(uint32_t) { return 0; }
+};
+
+class Mutex {
+    public:
+        void lock() {}
+        void unlock() {}
+};
+
+inline void wait_ms(int) {}
+inline void wait_us(int) {}
+inline void core_util_critical_section_enter() {}
+inline void core_util_critical_section_exit() {}
+inline void __DMB() {}
+inline void __disable_irq() {}
+inline uint32_t __get_PRIMASK() { return 0; }
+inline void __set_PRIMASK(uint32_t) {}
+
+// Cycle counter registers, counted by the tests
+struct DWT_Type { volatile uint32_t CTRL; volatile uint32_t CYCCNT; };
+struct CoreDebug_Type { volatile uint32_t DEMCR; };
+extern DWT_Type host_dwt;
+extern CoreDebug_Type host_core_debug;
+#define DWT (&host_dwt)
+#define CoreDebug (&host_core_debug)
+#define DWT_CTRL_CYCCNTENA_Msk 1u
+#define CoreDebug_DEMCR_TRCENA_Msk (1u << 24)
+#define SystemCoreClock 96000000u
+
+#endif
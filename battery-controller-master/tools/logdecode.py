@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+"""Decode the battery controller's deferred binary log.
+
+The firmware sends each DEBUG/INFO/WARN/ERROR/DEBUG_ARRAY/DEBUG_CAN record as a COBS frame
+between zero bytes, holding a message ID (FNV-1a hash of the level and format string), a us
+timestamp, the source line and the raw arguments.  This finds the same strings in the source
+to build the ID table, then turns frames back into text.  Anything outside frames (plain
+printf output) is passed through.
+
+    tools/logdecode.py /dev/ttyACM0          # needs pyserial, 460800 baud
+    tools/logdecode.py capture.bin
+    tools/logdecode.py --table table.json    # save the ID table for a build
+    tools/logdecode.py --load table.json capture.bin
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import struct
+import sys
+
+MACROS = {
+    'DEBUG': 'DEBUG', 'INFO': 'INFO', 'WARN': 'WARN', 'ERROR': 'ERROR',
+    'DEBUG_CAN': 'CAN', 'DEBUG_ARRAY': 'ARRAY',
+}
+DROPPED = 0
+TRACE_START = 1
+TRACE = 2
+
+CALL = re.compile(r'\b(' + '|'.join(MACROS) + r')\s*\(')
+STRING = re.compile(r'\s*"((?:[^"\\]|\\.)*)"')
+SPEC = re.compile(r'%([-+ #0]*)(\d+|\*)?(?:\.(\d+|\*))?(hh|h|ll|l|j|z|t|L)?([diouxXcsfFeEgGp%])')
+
+
+def fnv1a(data, h=2166136261):
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def message_id(level, text, extra=b''):
+    return fnv1a(extra, fnv1a(text, fnv1a(b':', fnv1a(level.encode()))))
+
+
+def unescape(literal):
+    # C escapes as written in the source, to the bytes the compiler hashes
+    return literal.encode('latin-1').decode('unicode_escape').encode('latin-1')
+
+
+def literals(source, pos):
+    """Parse adjacent string literals from pos, returning (bytes, end) or (None, pos)."""
+    parts = []
+    while True:
+        m = STRING.match(source, pos)
+        if not m:
+            break
+        parts.append(unescape(m.group(1)))
+        pos = m.end()
+    return (b''.join(parts), pos) if parts else (None, pos)
+
+
+def build_table(directory):
+    table = {}
+    for path in sorted(glob.glob(os.path.join(directory, '*.[ch]pp'))):
+        if os.path.basename(path) == 'Debug.hpp':
+            continue
+        source = open(path, encoding='latin-1').read()
+        for m in CALL.finditer(source):
+            level = MACROS[m.group(1)]
+            text, pos = literals(source, m.end())
+            if text is None:
+                continue
+            extra = b''
+            if level == 'ARRAY':
+                comma = re.compile(r'\s*,').match(source, pos)
+                if not comma:
+                    continue
+                extra, _ = literals(source, comma.end())
+                if extra is None:
+                    continue
+            key = message_id(level, text, extra)
+            line = source.count('\n', 0, m.start()) + 1
+            entry = table.setdefault(key, {'level': level, 'text': text.decode('latin-1'),
+                                           'extra': extra.decode('latin-1'), 'sites': []})
+            if entry['text'] != text.decode('latin-1') or entry['extra'] != extra.decode('latin-1'):
+                print('ID collision: %08X' % key, file=sys.stderr)
+            entry['sites'].append('%s:%d' % (os.path.basename(path), line))
+    return table
+
+
+def format_args(fmt, data):
+    """printf a format from packed arguments, returning (text, bytes used)."""
+    out = []
+    pos = 0
+    last = 0
+    for m in SPEC.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, width, precision, length, conv = m.groups()
+        if conv == '%':
+            out.append('%')
+            continue
+        spec = '%' + (flags or '') + (width or '') + ('.' + precision if precision else '')
+        if conv == 's':
+            end = data.find(b'\0', pos)
+            if end < 0:
+                end = len(data)
+            out.append((spec + 's') % data[pos:end].decode('latin-1'))
+            pos = end + 1
+            continue
+        if conv in 'fFeEgG':
+            if pos + 4 > len(data):
+                out.append('?')
+                continue
+            out.append((spec + conv) % struct.unpack_from('<f', data, pos)[0])
+            pos += 4
+            continue
+        size = 8 if length in ('ll', 'j') else 4
+        if pos + size > len(data):
+            out.append('?')
+            continue
+        value = int.from_bytes(data[pos:pos + size], 'little')
+        pos += size
+        bits = {'hh': 8, 'h': 16}.get(length, size * 8)
+        value &= (1 << bits) - 1
+        if conv in 'di' and value >> (bits - 1):
+            value -= 1 << bits
+        if conv == 'c':
+            out.append((spec + 'c') % chr(value & 0xFF))
+        elif conv == 'p':
+            out.append('0x%08x' % value)
+        else:
+            out.append((spec + ('d' if conv in 'diu' else conv)) % value)
+    out.append(fmt[last:])
+    return ''.join(out), pos
+
+
+def decode_record(table, record):
+    if len(record) < 10:
+        return '[ BAD - short record %s]' % record.hex()
+    key, timestamp, line = struct.unpack_from('<IIH', record)
+    args = record[10:]
+    stamp = '%10.6f' % (timestamp / 1e6)
+
+    if key == DROPPED:
+        text = '%d records dropped' % int.from_bytes(args[:4], 'little')
+        if len(args) >= 8:
+            text += ', %d console characters dropped' % int.from_bytes(args[4:8], 'little')
+        return '%s [ WARN - logger] %s' % (stamp, text)
+    if key == TRACE_START and len(args) >= 8:
+        return '%s [TRACE - start] %d Hz, %d events' % ((stamp,) + struct.unpack_from('<II', args))
+    if key == TRACE and len(args) >= 16:
+        # Left for tools/trace2json.py
+        return '%s [TRACE] %08X %04X %02X %02X' % ((stamp,) + struct.unpack_from('<IIII', args))
+
+    entry = table.get(key)
+    if entry is None:
+        return '%s [ ???? - line %d] unknown ID %08X: %s' % (stamp, line, key, args.hex())
+
+    sites = [s for s in entry['sites'] if s.endswith(':%d' % line)] or entry['sites']
+    where = ' '.join(sites)
+    level = entry['level']
+    if level == 'CAN':
+        if len(args) < 5:
+            text = args.hex()
+        else:
+            can_id, length = struct.unpack_from('<IB', args)
+            text = '0x%X - %s' % (can_id, ' '.join('%02X' % b for b in args[5:5 + length]))
+        return '%s [DEBUG - %s] %s: %s' % (stamp, where, entry['text'], text)
+    if level == 'ARRAY':
+        values = []
+        pos = 0
+        while pos < len(args):
+            text, used = format_args(entry['extra'], args[pos:])
+            if used == 0:
+                break
+            values.append(text)
+            pos += used
+        return '%s [DEBUG - %s] %s: [%s]' % (stamp, where, entry['text'], ', '.join(values))
+
+    text, _ = format_args(entry['text'], args)
+    return '%s [%5s - %s] %s' % (stamp, level, where, text)
+
+
+def cobs_decode(frame):
+    out = bytearray()
+    pos = 0
+    while pos < len(frame):
+        code = frame[pos]
+        if code == 0 or pos + code > len(frame) + 1:
+            return None
+        out += frame[pos + 1:pos + code]
+        pos += code
+        if code < 0xFF and pos < len(frame):
+            out.append(0)
+    return bytes(out)
+
+
+def decode_stream(table, chunks, output):
+    in_frame = False
+    frame = bytearray()
+    for chunk in chunks:
+        for b in chunk:
+            if b == 0:
+                if in_frame and frame:
+                    record = cobs_decode(bytes(frame))
+                    output.write((decode_record(table, record) if record is not None
+                                  else '[ BAD - frame %s]' % frame.hex()) + '\n')
+                    in_frame = False
+                else:
+                    in_frame = True
+                frame = bytearray()
+            elif in_frame:
+                frame.append(b)
+            else:
+                output.write(chr(b))
+        output.flush()
+
+
+def read_chunks(source):
+    if source == '-':
+        stream = sys.stdin.buffer
+    elif os.path.exists(source) and not source.startswith('/dev/'):
+        stream = open(source, 'rb')
+    else:
+        import serial
+        stream = serial.Serial(source, 460800)
+    while True:
+        chunk = stream.read(max(1, stream.in_waiting)) if hasattr(stream, "in_waiting") else stream.read(4096)
+        if not chunk:
+            return
+        yield chunk
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('input', nargs='?', help='Capture file, serial port or - for stdin')
+    parser.add_argument('--source', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'),
+                        help='Firmware source directory to take format strings from')
+    parser.add_argument('--load', help='Use a saved ID table instead of the source')
+    parser.add_argument('--table', help='Save the ID table as JSON')
+    args = parser.parse_args()
+
+    if args.load:
+        table = {int(k, 16): v for k, v in json.load(open(args.load)).items()}
+    else:
+        table = build_table(args.source)
+
+    if args.table:
+        json.dump({'%08X' % k: v for k, v in table.items()}, open(args.table, 'w'), indent=1)
+    if args.input:
+        decode_stream(table, read_chunks(args.input), sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
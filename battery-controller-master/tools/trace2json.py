@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+"""Convert a battery controller trace dump to Chrome trace JSON.
+
+A dump is requested with the RX::TraceRequest CAN frame, and arrives either on the console as
+log records, read with tools/logdecode.py, or on the bus as TX::TraceStart and TX::TraceEvent
+frames, read from a candump log.  Open the output in https://ui.perfetto.dev or chrome://tracing.
+
+    tools/logdecode.py capture.bin | tools/trace2json.py - > trace.json
+    tools/trace2json.py candump.log > trace.json
+
+Event IDs are hashes of the names given to the TRACE_* macros, so names are taken from the
+source.  Each dump in the input becomes one process in the trace.
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import struct
+import sys
+
+CALL = re.compile(r'\bTRACE_(?:SCOPE|BEGIN|END|INSTANT)\s*\(\s*"((?:[^"\\]|\\.)*)"')
+CAN_BASE = re.compile(r'\bCAN_TX_BASE\s*=\s*(0x[0-9A-Fa-f]+|\d+)')
+
+CONSOLE_START = re.compile(r'\[TRACE - start\] (\d+) Hz')
+CONSOLE_EVENT = re.compile(r'\[TRACE\] ([0-9A-F]{8}) ([0-9A-F]{4}) ([0-9A-F]{2}) ([0-9A-F]{2})')
+CANDUMP = re.compile(r'\b([0-9A-Fa-f]{3,8})(?:#([0-9A-Fa-f]*)|\s+\[\d\]\s+((?:[0-9A-Fa-f]{2}\s*)*))')
+
+# BCCANPackets::TX IDs, relative to CAN_TX_BASE
+TRACE_START_ID = 0x11
+TRACE_EVENT_ID = 0x12
+
+PHASES = {0: 'B', 1: 'E', 2: 'i'}
+CONTEXT_MASK = 0x3F
+PHASE_SHIFT = 6
+
+LPC17XX_IRQS = [
+    'WDT', 'TIMER0', 'TIMER1', 'TIMER2', 'TIMER3', 'UART0', 'UART1', 'UART2', 'UART3', 'PWM1',
+    'I2C0', 'I2C1', 'I2C2', 'SPI', 'SSP0', 'SSP1', 'PLL0', 'RTC', 'EINT0', 'EINT1', 'EINT2',
+    'EINT3', 'ADC', 'BOD', 'USB', 'CAN', 'DMA', 'I2S', 'ENET', 'RIT', 'MCPWM', 'QEI', 'PLL1',
+    'USBActivity', 'CANActivity',
+]
+
+
+def fnv1a(data, h=2166136261):
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def event_id(name):
+    h = fnv1a(name)
+    return (h ^ (h >> 16)) & 0xFFFF
+
+
+def build_names(directory):
+    names = {}
+    for path in sorted(glob.glob(os.path.join(directory, '*.[ch]pp'))):
+        if os.path.basename(path) == 'Trace.hpp':
+            continue
+        for m in CALL.finditer(open(path, encoding='latin-1').read()):
+            name = m.group(1).encode('latin-1').decode('unicode_escape')
+            key = event_id(name.encode('latin-1'))
+            if names.setdefault(key, name) != name:
+                print('ID collision: %04X %s, %s' % (key, names[key], name), file=sys.stderr)
+    return names
+
+
+def can_base(directory):
+    m = CAN_BASE.search(open(os.path.join(directory, 'BCConfig.hpp'), encoding='latin-1').read())
+    return int(m.group(1), 0) if m else 0x600
+
+
+def context_name(context):
+    if context == 0:
+        return 'other threads'
+    if context < 16:
+        return 'thread %d' % context
+    if context == CONTEXT_MASK:
+        return 'exception'
+    irq = context - 16
+    return 'IRQ %s' % (LPC17XX_IRQS[irq] if irq < len(LPC17XX_IRQS) else irq)
+
+
+def read_dumps(lines, base):
+    """Yield (clock, [(cycles, id, arg, flags)]) per dump, from console or candump lines."""
+    clock = None
+    events = []
+    for line in lines:
+        m = CONSOLE_START.search(line)
+        if m:
+            if clock is not None:
+                yield clock, events
+            clock, events = int(m.group(1)), []
+            continue
+        m = CONSOLE_EVENT.search(line)
+        if m:
+            if clock is not None:
+                events.append(tuple(int(g, 16) for g in m.groups()))
+            continue
+        m = CANDUMP.search(line)
+        if not m:
+            continue
+        data = bytes.fromhex(m.group(2) if m.group(2) is not None else m.group(3).replace(' ', ''))
+        frame = int(m.group(1), 16) - base
+        if frame == TRACE_START_ID and len(data) >= 6:
+            if clock is not None:
+                yield clock, events
+            clock, events = struct.unpack_from('<I', data)[0], []
+        elif frame == TRACE_EVENT_ID and len(data) == 8 and clock is not None:
+            events.append(struct.unpack('<IHBB', data))
+    if clock is not None:
+        yield clock, events
+
+
+def convert(dumps, names):
+    trace = []
+    for pid, (clock, events) in enumerate(dumps, 1):
+        trace.append({'ph': 'M', 'name': 'process_name', 'pid': pid, 'tid': 0,
+                      'args': {'name': 'dump %d' % pid}})
+        depth = {}
+        time = 0
+        last = events[0][0] if events else 0
+        for cycles, key, arg, flags in events:
+            # Cycles wrap every 2^32, far longer than the gaps between events
+            time += (cycles - last) & 0xFFFFFFFF
+            last = cycles
+            phase = PHASES.get(flags >> PHASE_SHIFT)
+            tid = flags & CONTEXT_MASK
+            if tid not in depth:
+                depth[tid] = 0
+                trace.append({'ph': 'M', 'name': 'thread_name', 'pid': pid, 'tid': tid,
+                              'args': {'name': context_name(tid)}})
+            if phase is None:
+                continue
+            if phase == 'E':
+                # The begin of an event at the start of the ring may have been overwritten
+                if depth[tid] == 0:
+                    continue
+                depth[tid] -= 1
+            elif phase == 'B':
+                depth[tid] += 1
+
+            event = {'name': names.get(key, '0x%04X' % key), 'ph': phase, 'pid': pid, 'tid': tid,
+                     'ts': time * 1e6 / clock}
+            if phase == 'i':
+                event['s'] = 't'
+            if phase != 'E':
+                event['args'] = {'arg': arg}
+            trace.append(event)
+    return {'traceEvents': trace, 'displayTimeUnit': 'ms'}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('input', help='Decoded console log or candump log, or - for stdin')
+    parser.add_argument('--source', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'),
+                        help='Firmware source directory to take event names from')
+    parser.add_argument('--can-base', type=lambda x: int(x, 0),
+                        help='CAN TX base address, default from BCConfig.hpp')
+    args = parser.parse_args()
+
+    names = build_names(args.source)
+    base = args.can_base if args.can_base is not None else can_base(args.source)
+    lines = sys.stdin if args.input == '-' else open(args.input, encoding='latin-1')
+    json.dump(convert(read_dumps(lines, base), names), sys.stdout)
+    sys.stdout.write('\n')
+
+
+if __name__ == '__main__':
+    main()